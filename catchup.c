@@ -0,0 +1,306 @@
+#include "catchup.h"
+
+#include "message.h"
+#include "dataManager.h"
+#include "history.h"
+#include "inputReader.h"
+#include "sendQueue.h"
+#include "timerWheel.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+// Taille maximale (entete compris) des datagrammes du rattrapage: sous le
+// MTU minimal d'IPv6.
+#define CATCHUP_DATAGRAM 1200
+
+// Delai (ms) avant l'envoi d'un datagramme incomplet.
+#define CATCHUP_FLUSH_DELAY 10
+
+// Nombre maximal de destinations en attente d'envoi.
+#define CATCHUP_DESTS 64
+
+// Une donnee demandee n'est pas redemandee (a un autre voisin) avant
+// CATCHUP_RETRY ms.
+#define CATCHUP_RETRY 2000
+#define ASKED_SLOTS 1024
+
+static short debug = 0;
+static short enabled = 0;
+
+struct pending {
+    struct sockaddr_in6 dest;
+    struct msg* m;
+    int length;                 // Taille du datagramme en cours.
+    short has_data;
+};
+
+struct asked {
+    uint64_t id;
+    uint32_t nonce;
+    uint64_t at;
+};
+
+static struct pending pendings[CATCHUP_DESTS];
+static int pending_count = 0;
+static struct timer* flush_timer = NULL;
+
+static struct asked asked[ASKED_SLOTS];
+
+static unsigned long summaries_sent = 0;
+static unsigned long summaries_received = 0;
+static unsigned long requested = 0;
+static unsigned long served = 0;
+static unsigned long datagrams = 0;
+
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/*******************/
+/*       Lock      */
+/*******************/
+
+static void lock(const char* func_name) {
+    if( pthread_mutex_lock(&mutex) != 0 ) {
+        perror(func_name);
+        exit(EXIT_FAILURE);
+    }
+}
+
+static void unlock(const char* func_name) {
+    if( pthread_mutex_unlock(&mutex) != 0 ) {
+        perror(func_name);
+        exit(EXIT_FAILURE);
+    }
+}
+
+/*******************/
+/*      Envois     */
+/*******************/
+
+// Envoie le datagramme en cours de p. Verrou pris.
+static void send_pending(struct pending* p) {
+    // Les donnees rattrapees passent apres les nouvelles.
+    send_msg_class(p->m, (struct sockaddr*)&p->dest, sizeof(p->dest),
+                   p->has_data ? SEND_RETRANSMIT : SEND_CONTROL);
+    destroy_msg(p->m);
+    p->m = NULL;
+    p->length = 0;
+    p->has_data = 0;
+    datagrams++;
+}
+
+// Verrou pris.
+static void flush_all() {
+    for(int i = 0; i < pending_count; i++)
+        if(pendings[i].m != NULL)
+            send_pending(&pendings[i]);
+    pending_count = 0;
+}
+
+static void flush(void* arg) {
+    (void)arg;
+    lock("flush");
+    flush_all();
+    unlock("flush");
+}
+
+// Renvoie l'envoi en cours vers dest, apres avoir reserve 'length' octets
+// dans son datagramme (le precedent part s'il n'a plus la place). Verrou pris.
+static struct pending* reserve(struct sockaddr_in6* dest, int length) {
+    struct pending* p = NULL;
+    for(int i = 0; i < pending_count && p == NULL; i++)
+        if( memcmp(&pendings[i].dest.sin6_addr, &dest->sin6_addr, sizeof(struct in6_addr)) == 0
+            && pendings[i].dest.sin6_port == dest->sin6_port )
+            p = &pendings[i];
+
+    if(p == NULL) {
+        if(pending_count == CATCHUP_DESTS)
+            flush_all();
+
+        // Premiere destination: on arme l'envoi des datagrammes incomplets.
+        if(pending_count == 0) {
+            if(flush_timer == NULL)
+                flush_timer = create_timer(flush, NULL);
+            schedule_timer(flush_timer, CATCHUP_FLUSH_DELAY);
+        }
+
+        p = &pendings[pending_count++];
+        p->dest = *dest;
+        p->m = NULL;
+        p->length = 0;
+        p->has_data = 0;
+    }
+
+    if(p->m != NULL && p->length + length > CATCHUP_DATAGRAM)
+        send_pending(p);
+
+    if(p->m == NULL) {
+        p->m = create_msg();
+        p->length = 4;
+    }
+
+    p->length += length;
+    return p;
+}
+
+/*******************/
+/*    Protocole    */
+/*******************/
+
+void catchup_offer(struct neighbour* n, uint64_t ids[], uint32_t nonces[], int count) {
+    struct sockaddr_in6 dest;
+    get_sockaddr6(n, &dest);
+
+    lock("catchup_offer");
+    for(int i = 0; i < count; i += MAX_IHAVE) {
+        int k = count - i < MAX_IHAVE ? count - i : MAX_IHAVE;
+        add_summary_tlv(reserve(&dest, 2 + 12*k)->m, ids+i, nonces+i, k);
+        summaries_sent++;
+    }
+    unlock("catchup_offer");
+}
+
+void enable_catchup() {
+    enabled = 1;
+}
+
+short catchup_enabled() {
+    return enabled;
+}
+
+void start_catchup(struct neighbour* n) {
+    uint64_t ids[CATCHUP_WINDOW];
+    uint32_t nonces[CATCHUP_WINDOW];
+    int count = get_received_ids(ids, nonces, CATCHUP_WINDOW);
+    if(count == 0)
+        return;
+
+    catchup_offer(n, ids, nonces, count);
+
+    if(debug)
+        printn("Rattrapage: résumé de %d données envoyé.", count);
+}
+
+// Renvoie 1 si (id,nonce) n'a pas ete demandee recemment, et la note comme
+// demandee maintenant. Verrou pris.
+static short should_ask(uint64_t id, uint32_t nonce, uint64_t now) {
+    struct asked* a = &asked[((id ^ nonce) * 0x9E3779B97F4A7C15ULL) >> 54];
+    if( a->id == id && a->nonce == nonce && now - a->at < CATCHUP_RETRY )
+        return 0;
+
+    a->id = id;
+    a->nonce = nonce;
+    a->at = now;
+    return 1;
+}
+
+void catchup_request(struct neighbour* n, uint64_t ids[], uint32_t nonces[], int count) {
+    uint64_t ask_ids[MAX_IHAVE];
+    uint32_t ask_nonces[MAX_IHAVE];
+    int asked_count = 0;
+    uint64_t now = timer_now();
+
+    struct sockaddr_in6 dest;
+    get_sockaddr6(n, &dest);
+
+    lock("catchup_request");
+    for(int i = 0; i < count; i++) {
+        if( get_received_data(ids[i], nonces[i]) != NULL || !should_ask(ids[i], nonces[i], now) )
+            continue;
+
+        ask_ids[asked_count] = ids[i];
+        ask_nonces[asked_count] = nonces[i];
+        asked_count++;
+
+        if(asked_count == MAX_IHAVE) {
+            add_request_tlv(reserve(&dest, 2 + 12*asked_count)->m, ask_ids, ask_nonces, asked_count);
+            requested += asked_count;
+            asked_count = 0;
+        }
+    }
+    if(asked_count > 0) {
+        add_request_tlv(reserve(&dest, 2 + 12*asked_count)->m, ask_ids, ask_nonces, asked_count);
+        requested += asked_count;
+    }
+    unlock("catchup_request");
+}
+
+void catchup_send(struct neighbour* n, uint64_t ids[], uint32_t nonces[], int count) {
+    struct sockaddr_in6 dest;
+    get_sockaddr6(n, &dest);
+
+    for(int i = 0; i < count; i++) {
+        uint8_t type;
+
+        // Dans la liste des donnees recues, ou sinon dans le journal.
+        struct payload* p = NULL;
+        struct received_data* rd = get_received_data(ids[i], nonces[i]);
+        if( rd != NULL && get_received_payload(rd) != NULL ) {
+            p = hold_payload(get_received_payload(rd));
+            type = get_received_type(rd);
+        } else {
+            p = history_lookup(ids[i], nonces[i], &type);
+        }
+
+        if(p == NULL)
+            continue;
+
+        lock("catchup_send");
+        struct pending* pending = reserve(&dest, 2 + 13 + payload_length(p));
+        add_data_payload_tlv(pending->m, ids[i], nonces[i], type, p);
+        pending->has_data = 1;
+        served++;
+        unlock("catchup_send");
+
+        release_payload(p);
+    }
+}
+
+// Copie les identifiants du tlv t dans ids et nonces et renvoie leur nombre.
+static int read_ids(struct tlv* t, uint64_t ids[], uint32_t nonces[]) {
+    int count = get_id_list_count(t);
+    for(int i = 0; i < count; i++)
+        get_id_list_item(t, i, &ids[i], &nonces[i]);
+    return count;
+}
+
+void catchup_on_summary(struct tlv* t, struct neighbour* from) {
+    if(from == NULL)
+        return;
+
+    uint64_t ids[MAX_IHAVE];
+    uint32_t nonces[MAX_IHAVE];
+    int count = read_ids(t, ids, nonces);
+
+    lock("catchup_on_summary");
+    summaries_received++;
+    unlock("catchup_on_summary");
+
+    catchup_request(from, ids, nonces, count);
+}
+
+void catchup_on_request(struct tlv* t, struct neighbour* from) {
+    if(from == NULL)
+        return;
+
+    uint64_t ids[MAX_IHAVE];
+    uint32_t nonces[MAX_IHAVE];
+    int count = read_ids(t, ids, nonces);
+
+    catchup_send(from, ids, nonces, count);
+}
+
+/*******************/
+/*   Statistiques  */
+/*******************/
+
+void print_catchup_stats() {
+    lock("print_catchup_stats");
+    unsigned long ss = summaries_sent, sr = summaries_received, rq = requested, sv = served, dg = datagrams;
+    unlock("print_catchup_stats");
+
+    printn("Rattrapage: %lu résumés envoyés, %lu reçus, %lu données demandées, %lu renvoyées, %lu datagrammes.",
+           ss, sr, rq, sv, dg);
+}
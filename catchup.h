@@ -0,0 +1,69 @@
+#ifndef CATCHUP_H
+#define CATCHUP_H
+
+#include "neighbour.h"
+#include "tlv.h"
+
+/*
+ * Rattrapage: quand un voisin devient symetrique, on lui envoie (Summary)
+ * les identifiants des CATCHUP_WINDOW dernieres donnees que l'on a. Il
+ * demande (Request) celles qui lui manquent, qu'on lui renvoie. Chaque
+ * etape regroupe ses tlvs dans de grands datagrammes, par destination.
+ */
+
+// Nombre de donnees recentes comparees.
+#define CATCHUP_WINDOW 256
+
+/*
+ * Lance le rattrapage avec chaque voisin qui devient symetrique. (Tous les
+ * pairs doivent l'activer: les anciennes versions rejettent les messages
+ * contenant des Summary ou des Request.)
+ */
+void enable_catchup();
+
+/*
+ * Renvoie 1 si le rattrapage est active et 0 sinon.
+ */
+short catchup_enabled();
+
+/*
+ * Envoie au voisin n le resume des donnees recentes (meme si le rattrapage
+ * n'est pas active: l'anti-entropie s'en sert avec des pairs qui le
+ * comprennent).
+ */
+void start_catchup(struct neighbour* n);
+
+/*
+ * Envoie au voisin n un resume des donnees (ids[i],nonces[i]): il demandera
+ * celles qui lui manquent.
+ */
+void catchup_offer(struct neighbour* n, uint64_t ids[], uint32_t nonces[], int count);
+
+/*
+ * Demande au voisin n celles des donnees (ids[i],nonces[i]) qui nous
+ * manquent et n'ont pas ete demandees recemment.
+ */
+void catchup_request(struct neighbour* n, uint64_t ids[], uint32_t nonces[], int count);
+
+/*
+ * Envoie au voisin n celles des donnees (ids[i],nonces[i]) que l'on a
+ * encore (dans la liste des donnees recues ou dans le journal).
+ */
+void catchup_send(struct neighbour* n, uint64_t ids[], uint32_t nonces[], int count);
+
+/*
+ * Traite un tlv Summary envoye par 'from' (ignore si ce n'est pas un voisin).
+ */
+void catchup_on_summary(struct tlv* t, struct neighbour* from);
+
+/*
+ * Traite un tlv Request envoye par 'from' (ignore si ce n'est pas un voisin).
+ */
+void catchup_on_request(struct tlv* t, struct neighbour* from);
+
+/*
+ * Affiche le nombre de resumes, de demandes et de donnees renvoyees.
+ */
+void print_catchup_stats();
+
+#endif /* CATCHUP_H */
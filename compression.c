@@ -0,0 +1,575 @@
+#include "compression.h"
+
+#include "dataManager.h"
+#include "fragment.h"
+#include "inputReader.h"
+#include "idGenerator.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include <arpa/inet.h>
+
+#define MIN_MATCH 4
+#define MAX_OFFSET 65535
+#define HASH_LOG 12
+
+#define COMPRESSED_HEADER_LEN 7
+
+#define DICT_MAX_LEN 2048
+#define DICT_SLOTS 32
+#define DICT_RETRAIN_COUNT 64
+// Laisse le temps au dictionnaire d'etre inonde avant de s'en servir.
+#define DICT_ACTIVATION_DELAY 10
+
+// Donnees compressees avec un dictionnaire inconnu gardees en attendant de
+// le recevoir (au plus DICT_PENDING_TIMEOUT s, DICT_PENDING donnees et
+// DICT_PENDING_BYTES octets: de quoi tenir un rattrapage). Un dictionnaire
+// manquant est demande au plus une fois toutes les DICT_REQUEST_INTERVAL s,
+// et son emetteur ne le rediffuse pas plus souvent.
+#define DICT_PENDING 256
+#define DICT_PENDING_BYTES (1 << 22)
+#define DICT_PENDING_TIMEOUT 30
+#define DICT_REQUEST_INTERVAL 10
+
+#define DICT_REQUEST_LEN 10
+
+static short debug = 0;
+
+struct dictionary {
+    uint64_t sender_id;
+    uint16_t id;
+    long last_use;
+    size_t len;
+    uint8_t* data;  // NULL si l'emplacement est libre.
+};
+
+struct pending {
+    uint64_t sender_id;
+    uint16_t id;
+    long received_at;
+    long requested_at;  // Derniere demande du dictionnaire (par nous ou un autre).
+    size_t len;
+    uint8_t* data;      // NULL si l'emplacement est libre.
+};
+
+static short enabled = 0;
+
+// Dictionnaires des autres pairs.
+static struct dictionary dicts[DICT_SLOTS];
+
+// Notre dictionnaire actif et celui en cours de diffusion.
+static uint16_t my_dict_id = 0;
+static uint8_t my_dict[DICT_MAX_LEN];
+static size_t my_dict_len = 0;
+
+static uint16_t next_dict_id = 0;
+static uint8_t next_dict[DICT_MAX_LEN];
+static size_t next_dict_len = 0;
+static long next_dict_activation = 0;
+
+// Donnees en attente de leur dictionnaire.
+static struct pending pendings[DICT_PENDING];
+static size_t pending_bytes = 0;
+
+// Derniere rediffusion de notre dictionnaire a la demande d'un pair.
+static long last_republish = 0;
+
+// Historique des derniers textes (les plus recents a la fin).
+static uint8_t history[DICT_MAX_LEN];
+static size_t history_len = 0;
+static int observed = 0;
+
+/*******************/
+/*   Compression   */
+/*******************/
+
+static uint32_t hash4(const uint8_t* p) {
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return (v * 2654435761U) >> (32 - HASH_LOG);
+}
+
+// Ecrit une longueur etendue (suite d'octets 255 puis le reste).
+static short write_length(size_t l, uint8_t* dst, size_t* op, size_t cap) {
+    while(l >= 255) {
+        if(*op >= cap) return 0;
+        dst[(*op)++] = 255;
+        l -= 255;
+    }
+    if(*op >= cap) return 0;
+    dst[(*op)++] = l;
+    return 1;
+}
+
+// Ecrit une sequence: litteraux puis (si match_len > 0) une correspondance.
+static short write_sequence(const uint8_t* lit, size_t lit_len, size_t offset, size_t match_len,
+                            uint8_t* dst, size_t* op, size_t cap) {
+    size_t ml = match_len > 0 ? match_len - MIN_MATCH : 0;
+
+    if(*op >= cap) return 0;
+    dst[(*op)++] = ((lit_len < 15 ? lit_len : 15) << 4) | (ml < 15 ? ml : 15);
+
+    if( lit_len >= 15 && !write_length(lit_len - 15, dst, op, cap) )
+        return 0;
+
+    if(*op + lit_len > cap) return 0;
+    memcpy(dst + *op, lit, lit_len);
+    *op += lit_len;
+
+    if(match_len == 0)
+        return 1;
+
+    if(*op + 2 > cap) return 0;
+    dst[(*op)++] = offset & 0xff;
+    dst[(*op)++] = offset >> 8;
+
+    if( ml >= 15 && !write_length(ml - 15, dst, op, cap) )
+        return 0;
+
+    return 1;
+}
+
+size_t lz_compress(const uint8_t* dict, size_t dict_len, const uint8_t* src, size_t len, uint8_t* dst, size_t cap) {
+    // On travaille sur dict + src pour que les correspondances puissent
+    // pointer dans le dictionnaire.
+    size_t total = dict_len + len;
+    uint8_t* buf = malloc(total);
+    if(buf == NULL) {
+        fprintf(stderr, "malloc() failed.");
+        exit(1);
+    }
+    memcpy(buf, dict, dict_len);
+    memcpy(buf + dict_len, src, len);
+
+    long table[1 << HASH_LOG];
+    for(int i = 0; i < (1 << HASH_LOG); i++)
+        table[i] = -1;
+
+    for(size_t i = 0; i + MIN_MATCH <= dict_len; i++)
+        table[hash4(buf+i)] = i;
+
+    size_t ip = dict_len;
+    size_t anchor = dict_len;
+    size_t op = 0;
+    short ok = 1;
+
+    while(ok && ip + MIN_MATCH <= total) {
+        uint32_t h = hash4(buf+ip);
+        long ref = table[h];
+        table[h] = ip;
+
+        if( ref < 0 || ip - ref > MAX_OFFSET || memcmp(buf+ref, buf+ip, MIN_MATCH) != 0 ) {
+            ip++;
+            continue;
+        }
+
+        size_t match_len = MIN_MATCH;
+        while(ip + match_len < total && buf[ref+match_len] == buf[ip+match_len])
+            match_len++;
+
+        ok = write_sequence(buf+anchor, ip-anchor, ip-ref, match_len, dst, &op, cap);
+        ip += match_len;
+        anchor = ip;
+    }
+
+    if(ok)
+        ok = write_sequence(buf+anchor, total-anchor, 0, 0, dst, &op, cap);
+
+    free(buf);
+    return ok ? op : 0;
+}
+
+// Lit une longueur etendue. Renvoie 0 si src est trop court.
+static short read_length(const uint8_t* src, size_t len, size_t* ip, size_t* l) {
+    uint8_t b;
+    do {
+        if(*ip >= len) return 0;
+        b = src[(*ip)++];
+        *l += b;
+    } while(b == 255);
+    return 1;
+}
+
+long lz_decompress(const uint8_t* dict, size_t dict_len, const uint8_t* src, size_t len, uint8_t* dst, size_t cap) {
+    // La sortie est ecrite a la suite du dictionnaire.
+    uint8_t* buf = malloc(dict_len + cap);
+    if(buf == NULL) {
+        fprintf(stderr, "malloc() failed.");
+        exit(1);
+    }
+    memcpy(buf, dict, dict_len);
+
+    size_t ip = 0;
+    size_t op = dict_len;
+    long res = -1;
+
+    while(ip < len) {
+        uint8_t token = src[ip++];
+
+        size_t lit_len = token >> 4;
+        if( lit_len == 15 && !read_length(src, len, &ip, &lit_len) )
+            goto end;
+        if(ip + lit_len > len || op + lit_len > dict_len + cap)
+            goto end;
+        memcpy(buf+op, src+ip, lit_len);
+        ip += lit_len;
+        op += lit_len;
+
+        // Derniere sequence: pas de correspondance.
+        if(ip == len)
+            break;
+
+        if(ip + 2 > len)
+            goto end;
+        size_t offset = src[ip] | (src[ip+1] << 8);
+        ip += 2;
+
+        size_t match_len = token & 0x0f;
+        if( match_len == 15 && !read_length(src, len, &ip, &match_len) )
+            goto end;
+        match_len += MIN_MATCH;
+
+        if(offset == 0 || offset > op || op + match_len > dict_len + cap)
+            goto end;
+
+        // Copie octet par octet: la correspondance peut chevaucher la sortie.
+        for(size_t i = 0; i < match_len; i++, op++)
+            buf[op] = buf[op-offset];
+    }
+
+    res = op - dict_len;
+    memcpy(dst, buf+dict_len, res);
+
+ end:
+    free(buf);
+    return res;
+}
+
+/*******************/
+/*  Dictionnaires  */
+/*******************/
+
+static struct dictionary* get_dictionary(uint64_t sender_id, uint16_t id) {
+    for(int i = 0; i < DICT_SLOTS; i++)
+        if( dicts[i].data != NULL && dicts[i].sender_id == sender_id && dicts[i].id == id )
+            return &dicts[i];
+    return NULL;
+}
+
+static void decode(uint64_t sender_id, const uint8_t* d, size_t len, struct dictionary* dictionary);
+
+// Decompresse les donnees de sender_id qui attendaient son dictionnaire id.
+static void release_pendings(uint64_t sender_id, uint16_t id) {
+    struct dictionary* dictionary = get_dictionary(sender_id, id);
+
+    for(int i = 0; i < DICT_PENDING; i++)
+        if( pendings[i].data != NULL && pendings[i].sender_id == sender_id && pendings[i].id == id ) {
+            decode(sender_id, pendings[i].data, pendings[i].len, dictionary);
+            free(pendings[i].data);
+            pendings[i].data = NULL;
+            pending_bytes -= pendings[i].len;
+        }
+}
+
+void receive_dictionary(uint64_t sender_id, const uint8_t* d, size_t len) {
+    if(len <= 2 || len - 2 > DICT_MAX_LEN)
+        return;
+
+    uint16_t id;
+    memcpy(&id, d, 2);
+    id = ntohs(id);
+
+    if( id == 0 || get_dictionary(sender_id, id) != NULL )
+        return;
+
+    // On remplace le dictionnaire utilise le moins recemment.
+    struct dictionary* slot = &dicts[0];
+    for(int i = 0; i < DICT_SLOTS && slot->data != NULL; i++)
+        if( dicts[i].data == NULL || dicts[i].last_use < slot->last_use )
+            slot = &dicts[i];
+
+    free(slot->data);
+    slot->data = malloc(len - 2);
+    if(slot->data == NULL) {
+        fprintf(stderr, "malloc() failed.");
+        exit(1);
+    }
+    memcpy(slot->data, d+2, len-2);
+    slot->len = len - 2;
+    slot->sender_id = sender_id;
+    slot->id = id;
+    slot->last_use = time(NULL);
+
+    if(debug)
+        printn("Dictionnaire %u reçu (%lu octets).", id, (unsigned long)slot->len);
+
+    release_pendings(sender_id, id);
+}
+
+// Diffuse le dictionnaire id (actif ou en cours de diffusion).
+static void publish_dictionary(uint16_t id, const uint8_t* dict, size_t dict_len) {
+    uint8_t payload[DICT_MAX_LEN + 2];
+    uint16_t nid = htons(id);
+    memcpy(payload, &nid, 2);
+    memcpy(payload+2, dict, dict_len);
+    add_my_payload(DATA_TYPE_DICTIONARY, payload, dict_len + 2);
+}
+
+// Note que le dictionnaire (sender_id,id) vient d'etre demande.
+static void mark_requested(uint64_t sender_id, uint16_t id, long now) {
+    for(int i = 0; i < DICT_PENDING; i++)
+        if( pendings[i].data != NULL && pendings[i].sender_id == sender_id && pendings[i].id == id )
+            pendings[i].requested_at = now;
+}
+
+void receive_dictionary_request(const uint8_t* d, size_t len) {
+    if(len != DICT_REQUEST_LEN)
+        return;
+
+    uint64_t sender_id;
+    uint16_t id;
+    memcpy(&sender_id, d, 8);
+    memcpy(&id, d+8, 2);
+    id = ntohs(id);
+
+    long now = time(NULL);
+
+    // Les autres pairs a qui il manque n'ont pas a le demander de nouveau.
+    mark_requested(sender_id, id, now);
+
+    if( sender_id != get_my_id() || id == 0 || now - last_republish < DICT_REQUEST_INTERVAL )
+        return;
+
+    if( id == my_dict_id && my_dict_len > 0 )
+        publish_dictionary(my_dict_id, my_dict, my_dict_len);
+    else if( id == next_dict_id && next_dict_len > 0 )
+        publish_dictionary(next_dict_id, next_dict, next_dict_len);
+    else
+        return;
+
+    last_republish = now;
+
+    if(debug)
+        printn("Dictionnaire %u rediffusé à la demande d'un pair.", id);
+}
+
+// Abandonne la donnee en attente p.
+static void drop_pending(struct pending* p) {
+    fprintn(stderr, "Message compressé illisible (dictionnaire %u jamais reçu).", p->id);
+    free(p->data);
+    p->data = NULL;
+    pending_bytes -= p->len;
+}
+
+// Renvoie un emplacement libre, et NULL s'il n'y en a pas.
+static struct pending* free_pending(long now, struct pending** oldest) {
+    struct pending* slot = NULL;
+    *oldest = NULL;
+
+    for(int i = 0; i < DICT_PENDING; i++) {
+        struct pending* p = &pendings[i];
+
+        if( p->data != NULL && now - p->received_at >= DICT_PENDING_TIMEOUT )
+            drop_pending(p);
+
+        if(p->data == NULL)
+            slot = p;
+        else if( *oldest == NULL || p->received_at < (*oldest)->received_at )
+            *oldest = p;
+    }
+
+    return slot;
+}
+
+// Garde la donnee compressee d (dictionnaire (sender_id,id) inconnu) et
+// demande le dictionnaire si personne ne l'a fait recemment.
+static void wait_dictionary(uint64_t sender_id, uint16_t id, const uint8_t* d, size_t len) {
+    long now = time(NULL);
+    long requested_at = 0;
+    struct pending* slot;
+    struct pending* oldest;
+
+    if(len > DICT_PENDING_BYTES) {
+        fprintn(stderr, "Message compressé illisible (dictionnaire %u inconnu).", id);
+        return;
+    }
+
+    // On fait de la place en abandonnant les plus anciennes.
+    while( (slot = free_pending(now, &oldest)) == NULL || pending_bytes + len > DICT_PENDING_BYTES )
+        drop_pending(oldest);
+
+    for(int i = 0; i < DICT_PENDING; i++)
+        if( pendings[i].data != NULL && pendings[i].sender_id == sender_id && pendings[i].id == id
+            && pendings[i].requested_at > requested_at )
+            requested_at = pendings[i].requested_at;
+
+    slot->data = malloc(len);
+    if(slot->data == NULL) {
+        fprintf(stderr, "malloc() failed.");
+        exit(1);
+    }
+    memcpy(slot->data, d, len);
+    slot->len = len;
+    pending_bytes += len;
+    slot->sender_id = sender_id;
+    slot->id = id;
+    slot->received_at = now;
+    slot->requested_at = requested_at;
+
+    if(now - requested_at < DICT_REQUEST_INTERVAL)
+        return;
+
+    uint8_t request[DICT_REQUEST_LEN];
+    uint16_t nid = htons(id);
+    memcpy(request, &sender_id, 8);
+    memcpy(request+8, &nid, 2);
+    add_my_payload(DATA_TYPE_DICTIONARY_REQUEST, request, DICT_REQUEST_LEN);
+    mark_requested(sender_id, id, now);
+
+    if(debug)
+        printn("Dictionnaire %u demandé.", id);
+}
+
+// Construit un dictionnaire a partir de l'historique et le diffuse.
+static void train_dictionary() {
+    if(history_len < DICT_MAX_LEN / 4)
+        return;
+
+    if(next_dict_id == 0)
+        next_dict_id = (random() % 0xfffe) + 1;
+    else
+        next_dict_id = next_dict_id % 0xffff + 1;
+
+    memcpy(next_dict, history, history_len);
+    next_dict_len = history_len;
+    next_dict_activation = time(NULL) + DICT_ACTIVATION_DELAY;
+
+    publish_dictionary(next_dict_id, next_dict, next_dict_len);
+
+    if(debug)
+        printn("Dictionnaire %u publié (%lu octets).", next_dict_id, (unsigned long)next_dict_len);
+}
+
+void compression_observe(const uint8_t* d, size_t len) {
+    if(len >= DICT_MAX_LEN) {
+        memcpy(history, d + len - DICT_MAX_LEN, DICT_MAX_LEN);
+        history_len = DICT_MAX_LEN;
+    } else {
+        // On fait de la place a la fin en oubliant le plus ancien.
+        size_t keep = history_len + len > DICT_MAX_LEN ? DICT_MAX_LEN - len : history_len;
+        memmove(history, history + history_len - keep, keep);
+        memcpy(history + keep, d, len);
+        history_len = keep + len;
+    }
+
+    if( enabled && ++observed % DICT_RETRAIN_COUNT == 0 )
+        train_dictionary();
+}
+
+/*******************/
+/*    Protocole    */
+/*******************/
+
+void enable_compression() {
+    enabled = 1;
+}
+
+size_t compress_data(uint8_t type, const uint8_t* d, size_t len, uint8_t** out) {
+    if( !enabled || len <= COMPRESSED_HEADER_LEN + MIN_MATCH )
+        return 0;
+
+    // Le dictionnaire diffuse devient actif apres un delai.
+    if( next_dict_len > 0 && time(NULL) >= next_dict_activation ) {
+        my_dict_id = next_dict_id;
+        memcpy(my_dict, next_dict, next_dict_len);
+        my_dict_len = next_dict_len;
+        next_dict_len = 0;
+    }
+
+    // On ne garde le resultat que si il est plus petit.
+    size_t cap = len - 1 - COMPRESSED_HEADER_LEN;
+    uint8_t* z = malloc(COMPRESSED_HEADER_LEN + cap);
+    if(z == NULL) {
+        fprintf(stderr, "malloc() failed.");
+        exit(1);
+    }
+
+    size_t zlen = lz_compress(my_dict, my_dict_len, d, len, z + COMPRESSED_HEADER_LEN, cap);
+    if(zlen == 0) {
+        free(z);
+        return 0;
+    }
+
+    uint16_t nid = htons(my_dict_id);
+    uint32_t nlen = htonl(len);
+    z[0] = type;
+    memcpy(z+1, &nid, 2);
+    memcpy(z+3, &nlen, 4);
+
+    *out = z;
+    return COMPRESSED_HEADER_LEN + zlen;
+}
+
+void receive_compressed(uint64_t sender_id, const uint8_t* d, size_t len) {
+    if(len <= COMPRESSED_HEADER_LEN)
+        return;
+
+    uint8_t type = d[0];
+    uint16_t id;
+    uint32_t orig_len;
+    memcpy(&id, d+1, 2);
+    memcpy(&orig_len, d+3, 4);
+    id = ntohs(id);
+    orig_len = ntohl(orig_len);
+
+    if(orig_len > FRAGMENT_MAX_PAYLOAD || type == DATA_TYPE_COMPRESSED)
+        return;
+
+    struct dictionary* dictionary = NULL;
+    if(id != 0) {
+        dictionary = get_dictionary(sender_id, id);
+        // Dictionnaire pas encore recu (ou oublie): on le demande.
+        if(dictionary == NULL) {
+            wait_dictionary(sender_id, id, d, len);
+            return;
+        }
+    }
+
+    decode(sender_id, d, len, dictionary);
+}
+
+// Decompresse et livre d (valide, cf. receive_compressed) avec dictionary
+// (NULL si la donnee n'en utilise pas).
+static void decode(uint64_t sender_id, const uint8_t* d, size_t len, struct dictionary* dictionary) {
+    uint8_t type = d[0];
+    uint32_t orig_len;
+    memcpy(&orig_len, d+3, 4);
+    orig_len = ntohl(orig_len);
+
+    const uint8_t* dict = NULL;
+    size_t dict_len = 0;
+    if(dictionary != NULL) {
+        dictionary->last_use = time(NULL);
+        dict = dictionary->data;
+        dict_len = dictionary->len;
+    }
+
+    uint8_t* out = malloc(orig_len);
+    if(out == NULL && orig_len > 0) {
+        fprintf(stderr, "malloc() failed.");
+        exit(1);
+    }
+
+    long rc = lz_decompress(dict, dict_len, d + COMPRESSED_HEADER_LEN, len - COMPRESSED_HEADER_LEN, out, orig_len);
+    if(rc != orig_len) {
+        if(debug)
+            printn("Donnée compressée invalide ignorée.");
+    } else {
+        deliver_data(sender_id, type, out, orig_len);
+    }
+
+    free(out);
+}
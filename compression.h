@@ -0,0 +1,86 @@
+#ifndef COMPRESSION_H
+#define COMPRESSION_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Type des donnees compressees. Le contenu d'un tlv data de ce type est:
+ * type de la donnee d'origine (1), id du dictionnaire de l'emetteur (2, 0 si
+ * aucun), taille d'origine (4) puis la donnee compressee (format de bloc LZ4).
+ * (entiers dans l'ordre du reseau)
+ */
+#define DATA_TYPE_COMPRESSED 221
+
+/*
+ * Type des dictionnaires. Contenu: id du dictionnaire (2) puis le dictionnaire.
+ */
+#define DATA_TYPE_DICTIONARY 222
+
+/*
+ * Type des demandes de dictionnaire, inondees par un pair qui a recu une
+ * donnee compressee avec un dictionnaire inconnu. Contenu: id de l'emetteur
+ * du dictionnaire (8) puis id du dictionnaire (2, dans l'ordre du reseau).
+ */
+#define DATA_TYPE_DICTIONARY_REQUEST 223
+
+/*******************/
+/*   Compression   */
+/*******************/
+
+/*
+ * Compresse src (len octets) dans dst (cap octets au plus) en utilisant les
+ * dict_len octets de dict comme historique. Renvoie la taille compressee
+ * et 0 si le resultat ne tient pas dans dst.
+ */
+size_t lz_compress(const uint8_t* dict, size_t dict_len, const uint8_t* src, size_t len, uint8_t* dst, size_t cap);
+
+/*
+ * Decompresse src (len octets) dans dst (cap octets au plus) avec le meme
+ * dictionnaire que celui utilise pour la compression. Renvoie la taille
+ * decompressee et -1 si les donnees sont invalides.
+ */
+long lz_decompress(const uint8_t* dict, size_t dict_len, const uint8_t* src, size_t len, uint8_t* dst, size_t cap);
+
+/*******************/
+/*    Protocole    */
+/*******************/
+
+/*
+ * Active la compression de nos donnees.
+ */
+void enable_compression();
+
+/*
+ * Si la compression est activee et utile, stocke dans *out (a liberer) la
+ * donnee d de type 'type' compressee (contenu d'un tlv data de type
+ * DATA_TYPE_COMPRESSED) et renvoie sa taille. Renvoie 0 sinon.
+ */
+size_t compress_data(uint8_t type, const uint8_t* d, size_t len, uint8_t** out);
+
+/*
+ * Decompresse une donnee de type DATA_TYPE_COMPRESSED recue de 'sender_id'
+ * et la livre (deliver_data). Si son dictionnaire est inconnu, elle attend
+ * qu'il arrive et il est demande (DATA_TYPE_DICTIONARY_REQUEST).
+ */
+void receive_compressed(uint64_t sender_id, const uint8_t* d, size_t len);
+
+/*
+ * Enregistre un dictionnaire (donnee de type DATA_TYPE_DICTIONARY) recu de 'sender_id'.
+ */
+void receive_dictionary(uint64_t sender_id, const uint8_t* d, size_t len);
+
+/*
+ * Traite une demande de dictionnaire (donnee de type
+ * DATA_TYPE_DICTIONARY_REQUEST): on rediffuse le dictionnaire si c'est le
+ * notre.
+ */
+void receive_dictionary_request(const uint8_t* d, size_t len);
+
+/*
+ * Ajoute un texte envoye ou recu a l'historique servant a construire
+ * notre dictionnaire. Un nouveau dictionnaire est publie regulierement.
+ */
+void compression_observe(const uint8_t* d, size_t len);
+
+#endif /* COMPRESSION_H */
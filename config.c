@@ -0,0 +1,231 @@
+#include "config.h"
+
+#include "inputReader.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <signal.h>
+#include <stdatomic.h>
+
+// Nombre maximal de parametres donnes sur la ligne de commande.
+#define MAX_OVERRIDES 32
+
+#define LINE_LEN 256
+
+// Plus petit tampon de reception accepte: nos plus grands datagrammes
+// (liste de 63 voisins: 4+18+63*20 = 1282 octets, rattrapage: 1200,
+// esquisses: environ 1080) doivent y tenir, au-dela du MTU minimal d'IPv6.
+#define MIN_RECEIVE_BUFFER 1500
+
+static short debug = 0;
+
+struct param {
+    const char* name;
+    int default_value;
+    int min;
+    int max;
+};
+
+static const struct param params[CONFIG_PARAMS] = {
+    {"min_sym",             8,    1,       64},
+    {"long_hello_interval", 20,   2,       3600},
+    {"max_received",        8192, 64,      1 << 20},
+    {"max_send",            4,    0,       10},
+    {"max_age",             120,  10,      3600},
+    {"receive_buffer",      4096, MIN_RECEIVE_BUFFER, 65535},
+    {"input_timeout",       5,    1,       3600},
+    {"phi_threshold",       8,    1,       64},
+    {"rl_data_rate",        200,  1,       100000},
+    {"rl_data_burst",       1000, 1,       100000},
+    {"rl_symmetric_factor", 32,   1,       1000}
+};
+
+static atomic_int values[CONFIG_PARAMS];
+
+static const char* config_path = NULL;
+static const char* overrides[MAX_OVERRIDES];
+static int override_count = 0;
+
+static volatile sig_atomic_t reload_requested = 0;
+
+/*******************/
+/*     Analyse     */
+/*******************/
+
+static int find_param(const char* name) {
+    for(int p = 0; p < CONFIG_PARAMS; p++)
+        if( strcmp(params[p].name, name) == 0 )
+            return p;
+    return -1;
+}
+
+// Enleve les blancs au debut et a la fin de s (modifie).
+static char* trim(char* s) {
+    while( isspace((unsigned char)*s) )
+        s++;
+
+    char* end = s + strlen(s);
+    while( end > s && isspace((unsigned char)end[-1]) )
+        *--end = '\0';
+    return s;
+}
+
+// Applique "nom = valeur" a set. Renvoie 0 (et signale l'erreur, 'where'
+// la situant) si la ligne est invalide.
+static short parse_assignment(const char* line, int set[], const char* where) {
+    char buffer[LINE_LEN];
+    snprintf(buffer, sizeof(buffer), "%s", line);
+
+    char* equal = strchr(buffer, '=');
+    if(equal == NULL) {
+        fprintn(stderr, "Configuration (%s): '=' manquant.", where);
+        return 0;
+    }
+
+    *equal = '\0';
+    char* name = trim(buffer);
+    char* value = trim(equal + 1);
+
+    int p = find_param(name);
+    if(p < 0) {
+        fprintn(stderr, "Configuration (%s): paramètre inconnu '%s'.", where, name);
+        return 0;
+    }
+
+    char* end;
+    long v = strtol(value, &end, 10);
+    if(*value == '\0' || *end != '\0' || v < params[p].min || v > params[p].max) {
+        fprintn(stderr, "Configuration (%s): %s doit être un entier entre %d et %d.",
+                where, name, params[p].min, params[p].max);
+        return 0;
+    }
+
+    set[p] = (int)v;
+    return 1;
+}
+
+// Lit le fichier de configuration dans set. Renvoie 0 s'il ne peut pas etre lu.
+static short read_file(const char* path, int set[]) {
+    FILE* f = fopen(path, "r");
+    if(f == NULL) {
+        fprintn(stderr, "Impossible de lire la configuration '%s'.", path);
+        return 0;
+    }
+
+    char line[LINE_LEN];
+    int number = 0;
+    while( fgets(line, sizeof(line), f) != NULL ) {
+        number++;
+
+        char* comment = strchr(line, '#');
+        if(comment != NULL)
+            *comment = '\0';
+        if( *trim(line) == '\0' )
+            continue;
+
+        char where[LINE_LEN];
+        snprintf(where, sizeof(where), "ligne %d", number);
+        parse_assignment(line, set, where);
+    }
+
+    fclose(f);
+    return 1;
+}
+
+// Calcule la configuration (defauts, fichier puis ligne de commande) et
+// l'applique. Renvoie 0 (sans rien changer) si le fichier ne peut pas etre lu.
+static short load(short report) {
+    int set[CONFIG_PARAMS];
+    for(int p = 0; p < CONFIG_PARAMS; p++)
+        set[p] = params[p].default_value;
+
+    if( config_path != NULL && !read_file(config_path, set) )
+        return 0;
+
+    for(int i = 0; i < override_count; i++)
+        parse_assignment(overrides[i], set, "ligne de commande");
+
+    for(int p = 0; p < CONFIG_PARAMS; p++) {
+        int old = atomic_exchange(&values[p], set[p]);
+        if(report && old != set[p])
+            printn("Configuration: %s %d -> %d.", params[p].name, old, set[p]);
+    }
+
+    return 1;
+}
+
+/*******************/
+/*   Chargement    */
+/*******************/
+
+void init_config() {
+    for(int p = 0; p < CONFIG_PARAMS; p++)
+        atomic_init(&values[p], params[p].default_value);
+}
+
+short set_config_file(const char* path) {
+    config_path = path;
+    return load(0);
+}
+
+short add_config_override(const char* assignment) {
+    int set[CONFIG_PARAMS];
+    for(int p = 0; p < CONFIG_PARAMS; p++)
+        set[p] = atomic_load(&values[p]);
+
+    if( override_count == MAX_OVERRIDES || !parse_assignment(assignment, set, "ligne de commande") )
+        return 0;
+
+    overrides[override_count++] = assignment;
+    for(int p = 0; p < CONFIG_PARAMS; p++)
+        atomic_store(&values[p], set[p]);
+    return 1;
+}
+
+/*******************/
+/*     Relecture   */
+/*******************/
+
+static void on_sighup(int sig) {
+    (void)sig;
+    reload_requested = 1;
+}
+
+void watch_config() {
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_sighup;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = SA_RESTART;
+
+    if( sigaction(SIGHUP, &sa, NULL) < 0 )
+        perror("watch_config");
+}
+
+void config_maintenance() {
+    if(!reload_requested)
+        return;
+    reload_requested = 0;
+
+    if(debug)
+        printn("SIGHUP: relecture de la configuration.");
+
+    if( !load(1) )
+        printn("Configuration inchangée.");
+}
+
+int config_get(enum config_param p) {
+    return atomic_load_explicit(&values[p], memory_order_relaxed);
+}
+
+/*******************/
+/*   Statistiques  */
+/*******************/
+
+void print_config() {
+    printn("Configuration%s%s:", config_path != NULL ? " " : "", config_path != NULL ? config_path : "");
+    for(int p = 0; p < CONFIG_PARAMS; p++)
+        printn("  %-20s %d", params[p].name, config_get(p));
+}
@@ -0,0 +1,66 @@
+#ifndef CONFIG_H
+#define CONFIG_H
+
+/*
+ * Parametres reglables sans recompiler. Chacun a une valeur par defaut et
+ * des bornes; il peut etre donne dans un fichier (lignes "nom = valeur",
+ * '#' commence un commentaire) et sur la ligne de commande ("nom=valeur",
+ * qui l'emporte sur le fichier). Sur SIGHUP, le fichier est relu et les
+ * nouvelles valeurs s'appliquent aux prochaines utilisations.
+ */
+
+enum config_param {
+    CONFIG_MIN_SYM,                 // Voisins symetriques vises.
+    CONFIG_LONG_HELLO_INTERVAL,     // Periode des hellos longs (s).
+    CONFIG_MAX_RECEIVED,            // Donnees recues gardees (jusqu'au double en innondation).
+    CONFIG_MAX_SEND,                // Renvois d'une donnee non acquittee.
+    CONFIG_MAX_AGE,                 // Age maximal du dernier hello d'un voisin (s).
+    CONFIG_RECEIVE_BUFFER,          // Taille maximale d'un datagramme recu (octets).
+    CONFIG_INPUT_TIMEOUT,           // Delai avant de masquer la ligne d'entree (s).
+    CONFIG_PHI_THRESHOLD,           // Suspicion au-dela de laquelle un voisin est suspect.
+    CONFIG_RL_DATA_RATE,            // Tlvs de donnees acceptes par seconde d'un pair.
+    CONFIG_RL_DATA_BURST,           // Rafale de tlvs de donnees acceptee d'un pair.
+    CONFIG_RL_SYMMETRIC_FACTOR,     // Multiplicateur des deux pour un voisin symetrique.
+    CONFIG_PARAMS
+};
+
+/*
+ * Met tous les parametres a leur valeur par defaut. A appeler en premier.
+ */
+void init_config();
+
+/*
+ * Lit le fichier de configuration 'path' (relu ensuite a chaque SIGHUP).
+ * Renvoie 0 s'il ne peut pas etre lu et 1 sinon (les lignes invalides sont
+ * signalees et ignorees).
+ */
+short set_config_file(const char* path);
+
+/*
+ * Applique "nom=valeur" (et le reapplique apres chaque relecture du
+ * fichier). Renvoie 0 si le parametre est inconnu ou la valeur invalide.
+ */
+short add_config_override(const char* assignment);
+
+/*
+ * Installe le traitement de SIGHUP. A appeler avant de creer les threads.
+ */
+void watch_config();
+
+/*
+ * Renvoie la valeur courante du parametre p. Thread-safe, sans verrou.
+ */
+int config_get(enum config_param p);
+
+/*
+ * Relit la configuration si un SIGHUP a ete recu, et affiche les
+ * parametres modifies.
+ */
+void config_maintenance();
+
+/*
+ * Affiche la valeur de chaque parametre.
+ */
+void print_config();
+
+#endif /* CONFIG_H */
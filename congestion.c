@@ -0,0 +1,212 @@
+#include "congestion.h"
+
+#include "neighbourManager.h"
+#include "inputReader.h"
+#include "timerWheel.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+
+#define WINDOW_BITS 10
+#define WINDOWS (1 << WINDOW_BITS)
+#define WINDOW_PROBES 8
+
+// Espacement minimal des reductions quand le RTT est inconnu (ms).
+#define WINDOW_DEFAULT_RTT 200
+
+static short debug = 0;
+
+struct key {
+    uint64_t id;
+    uint32_t nonce;
+};
+
+struct window {
+    short used;
+    uint128_t ip;
+    uint16_t port;
+    double size;                // Fenetre (donnees).
+    int in_flight;              // Donnees envoyees non acquittees.
+    uint64_t last_used;         // Derniere activite (ms).
+    uint64_t last_decrease;     // Derniere reduction (ms).
+    uint64_t last_ack;          // Dernier acquittement (ms), 0 si aucun.
+    struct key* queue;          // File d'attente (WINDOW_QUEUE places), allouee au besoin.
+    int queue_head;
+    int queue_count;
+};
+
+static struct window windows[WINDOWS];
+
+static unsigned long sent = 0;
+static unsigned long acked = 0;
+static unsigned long queued = 0;
+static unsigned long queue_full = 0;
+static unsigned long decreases = 0;
+
+/*******************/
+/*     Fenetres    */
+/*******************/
+
+static unsigned int hash(uint128_t ip, uint16_t port) {
+    uint64_t h = (uint64_t)ip ^ (uint64_t)(ip >> 64) ^ port;
+    h *= 0x9E3779B97F4A7C15ULL;
+    return h >> (64 - WINDOW_BITS);
+}
+
+static struct window* find_window(uint128_t ip, uint16_t port) {
+    unsigned int h = hash(ip, port);
+    for(int i = 0; i < WINDOW_PROBES; i++) {
+        struct window* w = &windows[(h + i) & (WINDOWS - 1)];
+        if( w->used && w->ip == ip && w->port == port )
+            return w;
+    }
+    return NULL;
+}
+
+// Renvoie la fenetre de (ip,port), en la creant (au besoin a la place de
+// la moins recemment utilisee de son voisinage) si elle n'existe pas.
+static struct window* get_window(uint128_t ip, uint16_t port) {
+    unsigned int h = hash(ip, port);
+    struct window* victim = NULL;
+    uint64_t now = timer_now();
+
+    for(int i = 0; i < WINDOW_PROBES; i++) {
+        struct window* w = &windows[(h + i) & (WINDOWS - 1)];
+        if( w->used && w->ip == ip && w->port == port ) {
+            w->last_used = now;
+            return w;
+        }
+
+        if( victim == NULL || !w->used || (victim->used && w->last_used < victim->last_used) )
+            victim = w;
+    }
+
+    // Les donnees de la file perdue repartiront a leur prochaine echeance.
+    free(victim->queue);
+    memset(victim, 0, sizeof(struct window));
+    victim->used = 1;
+    victim->ip = ip;
+    victim->port = port;
+    victim->size = WINDOW_INIT;
+    victim->last_used = now;
+
+    return victim;
+}
+
+short window_open(uint128_t ip, uint16_t port) {
+    struct window* w = get_window(ip, port);
+    return w->in_flight < (int)w->size;
+}
+
+void window_sent(uint128_t ip, uint16_t port) {
+    get_window(ip, port)->in_flight++;
+    sent++;
+}
+
+void window_acked(uint128_t ip, uint16_t port) {
+    struct window* w = get_window(ip, port);
+    if(w->in_flight > 0)
+        w->in_flight--;
+    w->last_ack = w->last_used;
+
+    // Augmentation additive: une donnee de plus par fenetre acquittee.
+    w->size += 1.0 / w->size;
+    if(w->size > WINDOW_MAX)
+        w->size = WINDOW_MAX;
+    acked++;
+}
+
+void window_timeout(uint128_t ip, uint16_t port, unsigned int rtt) {
+    struct window* w = get_window(ip, port);
+
+    // Les renvois d'une meme fenetre ne comptent que pour une perte.
+    if( w->last_decrease != 0 && w->last_used - w->last_decrease < (rtt > 0 ? rtt : WINDOW_DEFAULT_RTT) )
+        return;
+
+    w->last_decrease = w->last_used;
+    w->size /= 2;
+    if(w->size < WINDOW_MIN)
+        w->size = WINDOW_MIN;
+    decreases++;
+
+    if(debug)
+        printn("Congestion: fenêtre réduite à %.1f (%d en vol).", w->size, w->in_flight);
+}
+
+void window_forget(uint128_t ip, uint16_t port) {
+    struct window* w = find_window(ip, port);
+    if(w != NULL && w->in_flight > 0)
+        w->in_flight--;
+}
+
+short window_alive(uint128_t ip, uint16_t port, uint64_t delay) {
+    struct window* w = find_window(ip, port);
+    return w != NULL && w->last_ack != 0 && timer_now() - w->last_ack < delay;
+}
+
+/*******************/
+/*      Files      */
+/*******************/
+
+short window_enqueue(uint128_t ip, uint16_t port, uint64_t id, uint32_t nonce) {
+    struct window* w = get_window(ip, port);
+
+    if(w->queue == NULL) {
+        w->queue = malloc(WINDOW_QUEUE * sizeof(struct key));
+        if(w->queue == NULL) {
+            fprintf(stderr, "malloc() failed.");
+            exit(1);
+        }
+    }
+
+    if(w->queue_count == WINDOW_QUEUE) {
+        queue_full++;
+        return 0;
+    }
+
+    struct key* k = &w->queue[(w->queue_head + w->queue_count) % WINDOW_QUEUE];
+    k->id = id;
+    k->nonce = nonce;
+    w->queue_count++;
+    queued++;
+    return 1;
+}
+
+short window_dequeue(uint128_t ip, uint16_t port, uint64_t* id, uint32_t* nonce) {
+    struct window* w = find_window(ip, port);
+    if(w == NULL || w->queue_count == 0 || w->in_flight >= (int)w->size)
+        return 0;
+
+    *id = w->queue[w->queue_head].id;
+    *nonce = w->queue[w->queue_head].nonce;
+    w->queue_head = (w->queue_head + 1) % WINDOW_QUEUE;
+    w->queue_count--;
+    return 1;
+}
+
+/*******************/
+/*   Statistiques  */
+/*******************/
+
+static void print_window(struct neighbour* n, void* arg) {
+    (void)arg;
+    struct window* w = find_window(get_ip(n), get_port(n));
+    if(w == NULL)
+        return;
+
+    uint128_t ip = get_ip(n);
+    char str[INET6_ADDRSTRLEN];
+    inet_ntop(AF_INET6, &ip, str, INET6_ADDRSTRLEN);
+    printn("  %s %d: fenêtre %.1f, %d en vol, %d en attente", str, ntohs(get_port(n)),
+           w->size, w->in_flight, w->queue_count);
+}
+
+void print_congestion_stats() {
+    printn("Congestion: %lu données envoyées, %lu acquittées, %lu mises en attente (%lu files pleines), %lu réductions.",
+           sent, acked, queued, queue_full, decreases);
+    for_each_neighbour(print_window, NULL);
+}
@@ -0,0 +1,76 @@
+#ifndef CONGESTION_H
+#define CONGESTION_H
+
+#include "neighbour.h"
+
+#include <stdint.h>
+
+/*
+ * Controle de congestion de l'innondation: chaque voisin (ip,port) a une
+ * fenetre, le nombre de donnees qu'on peut lui avoir envoyees sans qu'il les
+ * ait acquittees. Elle grandit d'une donnee par RTT tant que les
+ * acquittements arrivent et est divisee par deux a chaque renvoi (au plus
+ * une fois par RTT). Les donnees au-dela de la fenetre attendent dans une
+ * file, dans l'ordre, et partent quand des acquittements la liberent.
+ */
+
+// Fenetre initiale, minimale et maximale (donnees).
+#define WINDOW_INIT 16
+#define WINDOW_MIN 1
+#define WINDOW_MAX 512
+
+// Places de la file d'attente de chaque voisin.
+#define WINDOW_QUEUE 1024
+
+/*
+ * Renvoie 1 si une nouvelle donnee peut etre envoyee a (ip,port) et 0 si
+ * elle doit attendre.
+ */
+short window_open(uint128_t ip, uint16_t port);
+
+/*
+ * Compte une donnee envoyee (pour la premiere fois) a (ip,port).
+ */
+void window_sent(uint128_t ip, uint16_t port);
+
+/*
+ * Compte l'acquittement par (ip,port) d'une donnee envoyee, et agrandit sa
+ * fenetre.
+ */
+void window_acked(uint128_t ip, uint16_t port);
+
+/*
+ * Reduit la fenetre de (ip,port): une donnee a du lui etre renvoyee. rtt
+ * (ms, 0 si inconnu) espace les reductions.
+ */
+void window_timeout(uint128_t ip, uint16_t port, unsigned int rtt);
+
+/*
+ * Oublie une donnee envoyee a (ip,port) qu'on n'attend plus (abandonnee
+ * ou oubliee sans acquittement).
+ */
+void window_forget(uint128_t ip, uint16_t port);
+
+/*
+ * Renvoie 1 si (ip,port) a acquitte une donnee dans les 'delay' dernieres ms.
+ */
+short window_alive(uint128_t ip, uint16_t port, uint64_t delay);
+
+/*
+ * Met la donnee (id,nonce) en attente de la fenetre de (ip,port). Renvoie 0
+ * si la file est pleine.
+ */
+short window_enqueue(uint128_t ip, uint16_t port, uint64_t id, uint32_t nonce);
+
+/*
+ * Retire la plus ancienne donnee en attente de (ip,port) si sa fenetre le
+ * permet. Renvoie 0 si la fenetre est pleine ou la file vide.
+ */
+short window_dequeue(uint128_t ip, uint16_t port, uint64_t* id, uint32_t* nonce);
+
+/*
+ * Affiche la fenetre de chaque voisin et les compteurs.
+ */
+void print_congestion_stats();
+
+#endif /* CONGESTION_H */
@@ -5,25 +5,65 @@
 #include "message.h"
 #include "idGenerator.h"
 #include "inputReader.h"
+#include "fragment.h"
+#include "compression.h"
+#include "plumtree.h"
+#include "sendQueue.h"
+#include "timerWheel.h"
+#include "history.h"
+#include "reconcile.h"
+#include "config.h"
+#include "congestion.h"
 
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <assert.h>
-#include <math.h>
-#include <unistd.h>
-#include <errno.h>
 #include <pthread.h>
 
-#define MAX_RECEIVED 16
-#define MAX_SEND 4
+#define RECEIVED_BUCKETS 4096
+// Avec l'anti-entropie, qui repare les pertes, une donnee n'est envoyee
+// que MAX_SEND_RECONCILED+1 fois et le voisin n'est pas chasse.
+#define MAX_SEND_RECONCILED 1
+
+// Les acquittements sont regroupes par voisin (ACK_BATCH au plus par
+// message) et envoyes au plus tard ACK_FLUSH_DELAY ms apres la donnee.
+#define ACK_FLUSH_DELAY 10
+#define ACK_FLUSH_DELAY_RECONCILED 50
+#define ACK_BATCH 32
+#define ACK_DESTS 64
+
+// Nombre maximal de GoAway envoyes par echeance d'innondation.
+#define MAX_SEND_SLOW 16
+
+// Une donnee en attente de la fenetre d'un voisin (cf. congestion.h) est
+// reessayee apres WINDOW_RETRY ms si aucun acquittement ne l'a liberee.
+#define WINDOW_RETRY 1000
+// Un voisin qui a acquitte une donnee dans les ALIVE_DELAY dernieres ms est
+// lent, pas inactif: une donnee qu'il n'acquitte pas est abandonnee sans
+// GoAway.
+#define ALIVE_DELAY 30000
+
+// Les envois a un voisin suspect (cf. is_suspected) sont reportes, sans
+// compter comme des renvois: d'abord de SUSPECT_RETRY ms, puis d'un delai
+// qui double a chaque fois. Apres SUSPECT_GIVE_UP ms de suspicion, on
+// renonce a lui envoyer la donnee (le rattrapage la lui rendra s'il revient).
+#define SUSPECT_RETRY 1000
+#define SUSPECT_GIVE_UP 30000
 
 static short debug = 0;
 
 struct symmetric_neighbour_list {
-    struct neighbour* neighbour;
+    // Le voisin est designe par son adresse (l'objet peut etre libere
+    // pendant l'innondation).
+    uint128_t ip;
+    uint16_t port;
+    uint64_t id;
     short received;
+    short waiting;         // En attente de la fenetre du voisin.
+    uint64_t suspected_at; // Voisin suspect depuis (ms), 0 sinon.
     int send_count;
+    uint64_t next_send;    // Date du prochain envoi (ms).
     struct symmetric_neighbour_list* next;
 };
 
@@ -31,20 +71,46 @@ struct received_data {
     uint64_t id;
     uint32_t nonce;
     uint8_t type;
-    uint8_t* data;
-    size_t data_len;
+    struct payload* payload;     // NULL: identifiant seul (cf. add_received_id).
     struct symmetric_neighbour_list* sym_list;
-    struct received_data* next;
+    struct timer* flood_timer;   // Arme tant que l'innondation est en cours.
+    uint128_t from_ip;           // Voisin qui nous l'a envoyee en premier.
+    uint16_t from_port;
+    uint64_t received_at;        // Date de reception (ms), 0 si restauree.
+    struct received_data* next;  // Vers la donnee plus ancienne.
+    struct received_data* prev;  // Vers la donnee plus recente.
+    struct received_data* hnext; // Suivante dans le meme seau de l'index.
 };
 
 static struct received_data* head = NULL;
 static struct received_data* end = NULL;
 static int receivedCount = 0;
 
-static int my_nonce_count = 0;
+// Index (id,nonce) -> donnee, pour ne pas parcourir tout l'anneau.
+static struct received_data* buckets[RECEIVED_BUCKETS];
+
+static uint32_t my_nonce_count = 0;
+
+// Arret en cours: les fenetres des voisins sont ignorees (cf. hasten_floods).
+static short hurry = 0;
+
+struct pending_acks {
+    struct sockaddr_in6 dest;
+    struct msg* m;
+    int count;
+    short echo;            // Reponse a un Echo a joindre.
+    uint32_t echo_stamp;
+    uint64_t echo_at;      // Reception de l'Echo (ms).
+};
+
+static struct pending_acks acks[ACK_DESTS];
+static int ack_dests = 0;
+static struct timer* ack_timer = NULL;
 
 static pthread_mutex_t syms_mutex = PTHREAD_MUTEX_INITIALIZER;
 
+static void send_waiting(uint128_t ip, uint16_t port);
+
 /*******************/
 /*       Lock      */
 /*******************/
@@ -67,7 +133,7 @@ static void unlock(const char* func_name) {
 /*  Constructeur  */
 /******************/
 
-struct received_data* create_received_data(uint64_t id, uint32_t nonce, uint8_t type, const uint8_t* data, size_t data_len) {
+struct received_data* create_received_data(uint64_t id, uint32_t nonce, uint8_t type, struct payload* p) {
     struct received_data* rd = malloc(sizeof(struct received_data));
     if(rd == NULL) {
         fprintf(stderr, "malloc() failed.");
@@ -77,17 +143,16 @@ struct received_data* create_received_data(uint64_t id, uint32_t nonce, uint8_t
     rd->id = id;
     rd->nonce = nonce;
     rd->type = type;
-        
-    rd->data = malloc( sizeof(uint8_t)*data_len );
-    memmove(rd->data, data, data_len);
-    if(rd->data == NULL) {
-        fprintf(stderr, "malloc() failed.");
-        exit(1);
-    }
-    rd->data_len = data_len;
-    
+    rd->payload = p != NULL ? hold_payload(p) : NULL;
+
     rd->sym_list = NULL;
+    rd->flood_timer = NULL;
+    rd->from_ip = 0;
+    rd->from_port = 0;
+    rd->received_at = timer_now();
     rd->next = NULL;
+    rd->prev = NULL;
+    rd->hnext = NULL;
     return rd;
 }
 
@@ -98,9 +163,14 @@ static struct symmetric_neighbour_list* create_sym_list(struct neighbour* n) {
         exit(1);
     }
 
-    l->neighbour = n;
+    l->ip = get_ip(n);
+    l->port = get_port(n);
+    l->id = get_id(n);
     l->received = 0;
+    l->waiting = 0;
+    l->suspected_at = 0;
     l->send_count = 0;
+    l->next_send = 0;
     l->next = NULL;
     return l;
 }
@@ -110,6 +180,9 @@ static struct symmetric_neighbour_list* create_sym_list(struct neighbour* n) {
 /*****************/
 
 static void destroy_sym_list_cell(struct symmetric_neighbour_list* cell) {
+    // Envoyee mais jamais acquittee: elle ne compte plus dans la fenetre.
+    if( !cell->received && cell->send_count > 0 )
+        window_forget(cell->ip, cell->port);
     free(cell);
 }
 
@@ -121,7 +194,8 @@ static void destroy_sym_list(struct symmetric_neighbour_list* l_head) {
 }
 
 void destroy_received_data(struct received_data* rd) {
-    free(rd->data);
+    destroy_timer(rd->flood_timer);
+    release_payload(rd->payload);
     destroy_sym_list(rd->sym_list);
     free(rd);
 }
@@ -130,39 +204,117 @@ void destroy_received_data(struct received_data* rd) {
 /* Getters/Setters */
 /*******************/
 
-struct received_data* get_received_data(uint64_t id, uint32_t nonce) {
+static unsigned int bucket_of(uint64_t id, uint32_t nonce) {
+    uint64_t h = (id ^ nonce) * 0x9E3779B97F4A7C15ULL;
+    return (h >> 32) % RECEIVED_BUCKETS;
+}
 
-    if( head == NULL || (head->id == id && head->nonce == nonce) )
-        return head;
-    
+struct received_data* get_received_data(uint64_t id, uint32_t nonce) {
     struct received_data* aux;
-    for(aux = head->next; aux != head; aux = aux->next)
+    for(aux = buckets[bucket_of(id, nonce)]; aux != NULL; aux = aux->hnext)
         if( aux->id == id && aux->nonce == nonce )
             return aux;
 
     return NULL;
 }
 
+uint64_t get_data_id(struct received_data* rd) {
+    return rd->id;
+}
+
+uint32_t get_data_nonce(struct received_data* rd) {
+    return rd->nonce;
+}
+
+struct payload* get_received_payload(struct received_data* rd) {
+    return rd->payload;
+}
+
+uint8_t get_received_type(struct received_data* rd) {
+    return rd->type;
+}
+
+void set_received_from(struct received_data* rd, struct neighbour* n) {
+    if(n != NULL) {
+        rd->from_ip = get_ip(n);
+        rd->from_port = get_port(n);
+    }
+}
+
+short is_received_from(struct received_data* rd, struct neighbour* n) {
+    return get_ip(n) == rd->from_ip && get_port(n) == rd->from_port;
+}
+
 void received(struct received_data* rd, struct neighbour* n) {
+    short acked = 0;
     lock("received");
 
     struct symmetric_neighbour_list* aux;
     
     for(aux = rd->sym_list; aux != NULL; aux = aux->next)
-        if( equals_neighbours(n, aux->neighbour) ) {
+        if( aux->ip == get_ip(n) && aux->port == get_port(n) ) {
+            if( !aux->received && aux->send_count > 0 ) {
+                window_acked(aux->ip, aux->port);
+                acked = 1;
+            }
             aux->received = 1;
             break;
         }
     
     unlock("received");
+
+    // Une place s'est liberee dans la fenetre de n.
+    if(acked)
+        send_waiting(get_ip(n), get_port(n));
 }
 
-static short is_received(struct symmetric_neighbour_list* l_cell) {
-    short res;
-    lock("is_received");
-    res = l_cell->received;
-    unlock("is_received");
-    return res;
+int get_received_ids(uint64_t ids[], uint32_t nonces[], int max) {
+    lock("get_received_ids");
+
+    if(head == NULL) {
+        unlock("get_received_ids");
+        return 0;
+    }
+
+    int count = 0;
+    struct received_data* aux = head;
+    do {
+        ids[count] = aux->id;
+        nonces[count] = aux->nonce;
+        count++;
+        aux = aux->next;
+    } while(aux != head && count < max);
+
+    unlock("get_received_ids");
+    return count;
+}
+
+int get_received_ids_between(uint64_t ids[], uint32_t nonces[], int max, uint64_t from, uint64_t to) {
+    int count = 0;
+    lock("get_received_ids_between");
+    struct received_data* aux = head;
+    // De la plus recente a la plus ancienne: on s'arrete avant 'from'.
+    while(aux != NULL && count < max && aux->received_at >= from) {
+        if(aux->received_at < to) {
+            ids[count] = aux->id;
+            nonces[count] = aux->nonce;
+            count++;
+        }
+        aux = aux->next;
+        if(aux == head)
+            break;
+    }
+    unlock("get_received_ids_between");
+
+    return count;
+}
+
+uint32_t get_my_nonce() {
+    return my_nonce_count;
+}
+
+void set_my_nonce(uint32_t nonce) {
+    my_nonce_count = nonce;
 }
 
 /*******************/
@@ -180,65 +332,147 @@ short equals_data(struct received_data* d1, struct received_data* d2) {
 void add_symmetric(struct received_data* rd, struct neighbour* n) {
     struct symmetric_neighbour_list* l = create_sym_list(n);
     
+    lock("add_symmetric");
     l->next = rd->sym_list;
     rd->sym_list = l;
+    unlock("add_symmetric");
+}
+
+static void remove_from_index(struct received_data* rd) {
+    struct received_data** aux = &buckets[bucket_of(rd->id, rd->nonce)];
+    while(*aux != NULL && *aux != rd)
+        aux = &(*aux)->hnext;
+
+    if(*aux != NULL)
+        *aux = rd->hnext;
 }
 
 short add_received_data(struct received_data* rd) {
     assert(rd != NULL);
-    struct received_data* aux;
 
     // Si on a déjà la donnée, on ne l'ajoute pas.
-    if(head != NULL) {
-        if( equals_data(head, rd) )
-            return 0;
-        
-        aux = head;
-        while( aux != head ) {
-            if( equals_data(head, rd) )
-                return 0;
-            aux = aux->next;
-        }
-    }
+    if( get_received_data(rd->id, rd->nonce) != NULL )
+        return 0;
+
+    unsigned int b = bucket_of(rd->id, rd->nonce);
+    rd->hnext = buckets[b];
+    buckets[b] = rd;
         
     receivedCount++;
     
-    if(head == NULL && end == NULL) {
+    if(head == NULL) {
         head = rd;
         end = rd;
         rd->next = rd;
+        rd->prev = rd;
         return 1;
     }
     
-    if(head != NULL && end != NULL) {
-        rd->next = head;
-        end->next = rd;
-        head = rd;
-
-        if(receivedCount == MAX_RECEIVED+1) {
-            aux = head;
-            while(aux->next != end && aux->next != head)
-                aux = aux->next;
-
-            if(aux->next == head)
-                assert(0);
-            
-            aux->next = head;
-            destroy_received_data(end);
-            end = aux;
-        }
-        return 1;
+    rd->next = head;
+    rd->prev = end;
+    head->prev = rd;
+    end->next = rd;
+    head = rd;
+
+    // On oublie la donnee la plus ancienne (plusieurs si max_received
+    // vient de baisser). Tant qu'elle est en cours d'innondation, on la
+    // garde, jusqu'au double de max_received: oubliee, elle serait
+    // relivree et reinondee a chaque nouvelle copie (cf. les fragments
+    // d'un fichier, qui prennent chacun une place).
+    int max = config_get(CONFIG_MAX_RECEIVED);
+    while( receivedCount > max && (end->sym_list == NULL || receivedCount > 2*max) ) {
+        struct received_data* old = end;
+        end = old->prev;
+        end->next = head;
+        head->prev = end;
+
+        remove_from_index(old);
+        receivedCount--;
+        destroy_received_data(old);
     }
-
-    receivedCount--;
-    assert(0);
+    return 1;
 }
 
-void add_my_data(const uint8_t* d, size_t len) {
-    struct received_data* rd = create_received_data(get_my_id(), my_nonce_count++, 0, d, len);
-    init_symeterics(rd);
+void add_my_typed_data(uint8_t type, const uint8_t* d, size_t len) {
+    struct payload* p = create_payload(d, len);
+    struct received_data* rd = create_received_data(get_my_id(), my_nonce_count++, type, p);
+    history_append(get_my_id(), rd->nonce, type, p);
+    release_payload(p);
+    init_symeterics(rd, NULL);
     add_received_data(rd);
     inondation(rd);
+    plumtree_announce(rd, NULL);
+}
+
+void add_my_payload(uint8_t type, const uint8_t* d, size_t len) {
+    // Trop grande pour un seul tlv data: on la decoupe.
+    if(len > MAX_DATA_LEN)
+        send_fragmented(type, d, len);
+    else
+        add_my_typed_data(type, d, len);
+}
+
+void add_my_data(const uint8_t* d, size_t len) {
+    compression_observe(d, len);
+
+    uint8_t* z;
+    size_t zlen = compress_data(DATA_TYPE_TEXT, d, len, &z);
+    if(zlen > 0) {
+        add_my_payload(DATA_TYPE_COMPRESSED, z, zlen);
+        free(z);
+    } else {
+        add_my_payload(DATA_TYPE_TEXT, d, len);
+    }
+}
+
+void add_received_id(uint64_t id, uint32_t nonce) {
+    restore_received_data(id, nonce, 0, NULL);
+}
+
+short restore_received_data(uint64_t id, uint32_t nonce, uint8_t type, struct payload* p) {
+    struct received_data* rd = create_received_data(id, nonce, type, p);
+    // Hors de la fenetre de l'anti-entropie: son voisin ne l'a peut-etre
+    // jamais recue.
+    rd->received_at = 0;
+    if( add_received_data(rd) )
+        return 1;
+
+    destroy_received_data(rd);
+    return 0;
+}
+
+/*******************/
+/*    Livraison    */
+/*******************/
+
+void deliver_data(uint64_t id, uint8_t type, const uint8_t* data, size_t len) {
+    switch(type) {
+    case DATA_TYPE_TEXT:
+        printn("%.*s", (int)len, data);
+        compression_observe(data, len);
+        break;
+
+    case DATA_TYPE_FRAGMENT:
+        receive_fragment(id, data, len);
+        break;
+
+    case DATA_TYPE_COMPRESSED:
+        receive_compressed(id, data, len);
+        break;
+
+    case DATA_TYPE_DICTIONARY:
+        receive_dictionary(id, data, len);
+        break;
+
+    case DATA_TYPE_DICTIONARY_REQUEST:
+        receive_dictionary_request(data, len);
+        break;
+
+    default:
+        if(debug)
+            printn("Donnée de type inconnu (%d) ignorée.", type);
+        break;
+    }
 }
 
 /*******************/
@@ -247,28 +481,34 @@ void add_my_data(const uint8_t* d, size_t len) {
 
 void remove_symmetric(struct received_data* rd, uint64_t id) {
     struct symmetric_neighbour_list *aux, *tmp;
+
+    lock("remove_symmetric");
     aux = rd->sym_list;
 
-    if(aux == NULL)
+    if(aux == NULL) {
+        unlock("remove_symmetric");
         return;
+    }
     
-    if( get_id(aux->neighbour) == id ) {
+    if( aux->id == id ) {
         rd->sym_list = aux->next;
         destroy_sym_list_cell(aux);
         aux = NULL;
+        unlock("remove_symmetric");
         return;
     }
     
-    while( aux->next != NULL && get_id(aux->next->neighbour) != id)
+    while( aux->next != NULL && aux->next->id != id)
         aux = aux->next;
 
-    if( aux->next == NULL )
-        return;
-    
-    tmp = aux->next;
-    aux->next = aux->next->next;
-    destroy_sym_list_cell(tmp);
-    tmp = NULL;
+    if( aux->next != NULL ) {
+        tmp = aux->next;
+        aux->next = aux->next->next;
+        destroy_sym_list_cell(tmp);
+        tmp = NULL;
+    }
+
+    unlock("remove_symmetric");
 }
 
 
@@ -277,76 +517,398 @@ void remove_symmetric(struct received_data* rd, uint64_t id) {
 /*******************/
 
 
-static void* inondation_t(void* d) {
-    struct received_data* rd = (struct received_data*)d;
+static void sym_sockaddr(struct symmetric_neighbour_list* l, struct sockaddr_in6* dest) {
+    memset(dest, 0, sizeof(struct sockaddr_in6));
+    dest->sin6_family = AF_INET6;
+    dest->sin6_port = l->port;
+    memcpy(&dest->sin6_addr, &l->ip, sizeof(uint128_t));
+}
+
+// Delai (ms) avant l'envoi suivant le send_count-ieme: tire dans
+// [2^(send_count-1), 2^send_count[ secondes (immediat pour le premier).
+static long retransmit_delay(int send_count) {
+    if(send_count == 0)
+        return 0;
+
+    long min = 1000L << (send_count-1);
+    return min + random() % min;
+}
+
+// Envoie rd a l (le message est cree au premier envoi, dans *data). Un
+// renvoi reduit la fenetre du voisin.
+static void send_to_sym(struct received_data* rd, struct symmetric_neighbour_list* l, struct msg** data, uint64_t now) {
     struct sockaddr_in6 sockaddr;
 
-    struct msg* data = create_msg();
-    add_data_tlv(data, rd->id, rd->nonce, rd->type, rd->data, rd->data_len);
+    if(*data == NULL) {
+        *data = create_msg();
+        add_data_payload_tlv(*data, rd->id, rd->nonce, rd->type, rd->payload);
+    }
 
-    struct msg* goAway = create_msg();
-    char* error = "You are too slow or inactive.";
-    add_goAway_tlv(goAway, 2, (uint8_t*)error, strlen(error)-1);
+    struct neighbour* n = get_neighbour(l->ip, l->port);
+    if(n != NULL)
+        expect_reply(n);
+
+    if(l->send_count == 0)
+        window_sent(l->ip, l->port);
+    else
+        window_timeout(l->ip, l->port, n != NULL ? get_rtt(n) : 0);
+
+    sym_sockaddr(l, &sockaddr);
+    l->waiting = 0;
+    l->send_count++;
+    l->next_send = now + retransmit_delay(l->send_count);
+    send_msg_class(*data, (struct sockaddr*)&sockaddr, sizeof(sockaddr),
+                   l->send_count > 1 ? SEND_RETRANSMIT : SEND_DATA);
+}
 
-    int min, max;
+// Envoie rd aux voisins dont l'echeance est passee et rearme le
+// temporisateur sur la prochaine. Un premier envoi attend si la fenetre du
+// voisin est pleine; tout envoi attend si le voisin est suspect (et on
+// abandonne s'il le reste trop longtemps). Les voisins qui n'ont toujours
+// pas acquitte apres max_send+1 envois recoivent un GoAway (sauf s'ils
+// acquittent encore d'autres donnees, ou avec l'anti-entropie: on
+// abandonne simplement).
+static void flood(void* arg) {
+    struct received_data* rd = (struct received_data*)arg;
+    struct sockaddr_in6 slow[MAX_SEND_SLOW];
+    int slow_count = 0;
+    struct msg* data = NULL;
+
+    uint64_t now = timer_now();
+    uint64_t next = 0;
+    short reconciled = reconcile_enabled();
+    int max_send = reconciled ? MAX_SEND_RECONCILED : config_get(CONFIG_MAX_SEND);
+
+    lock("flood");
+
+    struct symmetric_neighbour_list** aux = &rd->sym_list;
+    while(*aux != NULL) {
+        struct symmetric_neighbour_list* l = *aux;
+
+        if( l->received ) {
+            *aux = l->next;
+            destroy_sym_list_cell(l);
+            continue;
+        }
 
-    struct symmetric_neighbour_list *aux;
+        if( l->next_send > now ) {
+            if(next == 0 || l->next_send < next)
+                next = l->next_send;
+            aux = &l->next;
+            continue;
+        }
 
-    while(rd->sym_list != NULL) {
-        for(aux = rd->sym_list; aux != NULL; aux = aux->next) {
+        // Probablement mort: on ne gaspille ni envoi ni renvoi.
+        struct neighbour* n = get_neighbour(l->ip, l->port);
+        if( n != NULL && is_suspected(n) ) {
+            if(l->suspected_at == 0)
+                l->suspected_at = now;
 
-            if( is_received(aux) ) {
-                remove_symmetric( rd, get_id(aux->neighbour) );
-                break;
+            if( now - l->suspected_at >= SUSPECT_GIVE_UP ) {
+                *aux = l->next;
+                destroy_sym_list_cell(l);
+                continue;
             }
-            
-            get_sockaddr6(aux->neighbour, &sockaddr);
-        
-            if(aux->send_count > MAX_SEND) {
-                send_msg(goAway, (struct sockaddr*)&sockaddr, sizeof(sockaddr));
-                
-                remove_from_neighbours(aux->neighbour);
-                add_potential_neighbour(aux->neighbour);
-                remove_symmetric( rd, get_id(aux->neighbour) );
-                break;
-                
-            } else {
-                
-                min = (int)pow(2, aux->send_count-1);
-                max = (int)pow(2, aux->send_count);
-                sleep( (random() % (max - min)) + min );
-                send_msg(data, (struct sockaddr*)&sockaddr, sizeof(sockaddr));
-                aux->send_count++;
-                
+
+            // Report double a chaque fois: 1 s, 2 s, 4 s...
+            uint64_t delay = now - l->suspected_at;
+            l->next_send = now + (delay > SUSPECT_RETRY ? delay : SUSPECT_RETRY);
+            if(next == 0 || l->next_send < next)
+                next = l->next_send;
+            aux = &l->next;
+            continue;
+        }
+        l->suspected_at = 0;
+
+        if( l->send_count > max_send && (reconciled || window_alive(l->ip, l->port, ALIVE_DELAY)) ) {
+            *aux = l->next;
+            destroy_sym_list_cell(l);
+            continue;
+        }
+
+        if( l->send_count > max_send ) {
+            // Trop de GoAway d'un coup: la suite a la prochaine echeance.
+            if(slow_count == MAX_SEND_SLOW) {
+                next = now;
+                aux = &l->next;
+                continue;
             }
-            
+            sym_sockaddr(l, &slow[slow_count++]);
+            *aux = l->next;
+            destroy_sym_list_cell(l);
+            continue;
+        }
+
+        if( l->send_count == 0 && !hurry && !window_open(l->ip, l->port) ) {
+            // Une seule place dans la file: au pire, on reessaie plus tard.
+            if( !l->waiting )
+                window_enqueue(l->ip, l->port, rd->id, rd->nonce);
+            l->waiting = 1;
+            l->next_send = now + WINDOW_RETRY;
+        } else {
+            send_to_sym(rd, l, &data, now);
         }
+
+        if(next == 0 || l->next_send < next)
+            next = l->next_send;
+        aux = &l->next;
     }
-    
-    destroy_msg(data);
+
+    // On s'arrete quand tout le monde a recu la donnee.
+    if(rd->sym_list != NULL)
+        schedule_timer(rd->flood_timer, next - now);
+
+    unlock("flood");
+
+    if(data != NULL)
+        destroy_msg(data);
+
+    if(slow_count == 0)
+        return;
+
+    struct msg* goAway = create_msg();
+    char* error = "You are too slow or inactive.";
+    add_goAway_tlv(goAway, 2, (uint8_t*)error, strlen(error)-1);
+
+    for(int i = 0; i < slow_count; i++) {
+        send_msg(goAway, (struct sockaddr*)&slow[i], sizeof(slow[i]));
+
+        struct neighbour* n = get_neighbour(((uint128_t*)slow[i].sin6_addr.s6_addr)[0], slow[i].sin6_port);
+        if(n != NULL) {
+            count_go_away(n);
+            demote_neighbour(n);
+        }
+    }
+
     destroy_msg(goAway);
-    
-    return NULL;
 }
-                           
 
 void inondation(struct received_data* rd) {
 
     if(debug)
         printn("Inondation: start.");
 
-    pthread_t thread;
+    lock("inondation");
+    if(rd->flood_timer == NULL)
+        rd->flood_timer = create_timer(flood, rd);
+    unlock("inondation");
 
-    int rc = pthread_create( &thread, NULL, inondation_t, rd);
-    if( rc != 0) {
-        if( rc == EAGAIN ) {
-            sleep(5);
-            inondation(rd);
-            return;
+    schedule_timer(rd->flood_timer, 0);
+}
+
+// Envoie a (ip,port) les donnees en attente que sa fenetre permet.
+static void send_waiting(uint128_t ip, uint16_t port) {
+    uint64_t id;
+    uint32_t nonce;
+
+    while( window_dequeue(ip, port, &id, &nonce) ) {
+        struct received_data* rd = get_received_data(id, nonce);
+        if(rd == NULL || rd->flood_timer == NULL)
+            continue;
+
+        struct msg* data = NULL;
+        uint64_t now = timer_now();
+        uint64_t next = 0;
+
+        lock("send_waiting");
+
+        for(struct symmetric_neighbour_list* l = rd->sym_list; l != NULL; l = l->next) {
+            if( l->ip == ip && l->port == port && l->waiting && !l->received )
+                send_to_sym(rd, l, &data, now);
+            if( !l->received && (next == 0 || l->next_send < next) )
+                next = l->next_send;
         }
-        fprintf(stderr, "Error: Thread create\n");
-        exit(EXIT_FAILURE);
+
+        unlock("send_waiting");
+
+        // Deja envoyee, oubliee ou acquittee entre temps: place suivante.
+        if(data == NULL)
+            continue;
+
+        destroy_msg(data);
+        schedule_timer(rd->flood_timer, next > now ? next - now : 0);
     }
+}
 
-    
+void forget_floods_to(uint128_t ip, uint16_t port) {
+    struct received_data* rd = head;
+
+    while(rd != NULL) {
+        lock("forget_floods_to");
+        struct symmetric_neighbour_list** aux = &rd->sym_list;
+        while(*aux != NULL) {
+            struct symmetric_neighbour_list* l = *aux;
+            if( l->ip == ip && l->port == port ) {
+                *aux = l->next;
+                destroy_sym_list_cell(l);
+            } else {
+                aux = &l->next;
+            }
+        }
+        unlock("forget_floods_to");
+
+        rd = rd->next;
+        if(rd == head)
+            break;
+    }
+}
+
+void hasten_floods() {
+    uint64_t now = timer_now();
+    struct received_data* rd = head;
+    hurry = 1;
+
+    while(rd != NULL) {
+        short pending = 0;
+
+        lock("hasten_floods");
+        for(struct symmetric_neighbour_list* l = rd->sym_list; l != NULL; l = l->next)
+            if( !l->received ) {
+                l->next_send = now;
+                pending = 1;
+            }
+        unlock("hasten_floods");
+
+        if(pending && rd->flood_timer != NULL)
+            schedule_timer(rd->flood_timer, 0);
+
+        rd = rd->next;
+        if(rd == head)
+            break;
+    }
+}
+
+int floods_pending() {
+    int count = 0;
+    struct received_data* rd = head;
+
+    while(rd != NULL) {
+        lock("floods_pending");
+        for(struct symmetric_neighbour_list* l = rd->sym_list; l != NULL; l = l->next) {
+            struct neighbour* n = get_neighbour(l->ip, l->port);
+            if( !l->received && n != NULL && !is_suspected(n) ) {
+                count++;
+                break;
+            }
+        }
+        unlock("floods_pending");
+
+        rd = rd->next;
+        if(rd == head)
+            break;
+    }
+
+    return count;
+}
+
+short resend_data(struct received_data* rd, struct neighbour* n) {
+    // Simple identifiant restaure: on n'a pas le contenu.
+    if(rd->payload == NULL)
+        return 0;
+
+    lock("resend_data");
+
+    // Deja en attente d'envoi vers n.
+    for(struct symmetric_neighbour_list* aux = rd->sym_list; aux != NULL; aux = aux->next)
+        if( aux->ip == get_ip(n) && aux->port == get_port(n) && !aux->received ) {
+            unlock("resend_data");
+            return 1;
+        }
+
+    struct symmetric_neighbour_list* l = create_sym_list(n);
+    l->next = rd->sym_list;
+    rd->sym_list = l;
+    unlock("resend_data");
+
+    inondation(rd);
+
+    return 1;
+}
+
+/*******************/
+/* Acquittements   */
+/*******************/
+
+// Envoie les acquittements de p, avec la reponse a son Echo et le temps
+// qu'elle a attendu (a retrancher du RTT).
+static void send_pending(struct pending_acks* p) {
+    if(p->echo) {
+        uint64_t hold = timer_now() - p->echo_at;
+        add_echo_tlv(p->m, 1, p->echo_stamp, hold < UINT16_MAX ? hold : UINT16_MAX);
+    }
+
+    send_msg(p->m, (struct sockaddr*)&p->dest, sizeof(p->dest));
+    destroy_msg(p->m);
+}
+
+static void flush_acks(void* arg) {
+    (void)arg;
+
+    for(int i = 0; i < ack_dests; i++)
+        send_pending(&acks[i]);
+    ack_dests = 0;
+}
+
+// Renvoie la place des acquittements en attente pour dest (la cree au besoin).
+static int get_pending(struct sockaddr_in6* dest) {
+    int i = 0;
+    while( i < ack_dests && (acks[i].dest.sin6_port != dest->sin6_port
+                             || memcmp(&acks[i].dest.sin6_addr, &dest->sin6_addr, sizeof(dest->sin6_addr)) != 0) )
+        i++;
+
+    if(i == ack_dests) {
+        if(ack_dests == ACK_DESTS) {
+            flush_acks(NULL);
+            i = 0;
+        }
+        acks[i].dest = *dest;
+        acks[i].m = create_msg();
+        acks[i].count = 0;
+        acks[i].echo = 0;
+        ack_dests++;
+    }
+
+    return i;
+}
+
+static void schedule_acks() {
+    if(ack_timer == NULL)
+        ack_timer = create_timer(flush_acks, NULL);
+
+    if( ack_dests > 0 && !timer_pending(ack_timer) )
+        schedule_timer(ack_timer, reconcile_enabled() ? ACK_FLUSH_DELAY_RECONCILED : ACK_FLUSH_DELAY);
+}
+
+void send_ack(struct neighbour* n, uint64_t id, uint32_t nonce) {
+    struct sockaddr_in6 dest;
+    get_sockaddr6(n, &dest);
+
+    int i = get_pending(&dest);
+    add_ack_tlv(acks[i].m, id, nonce);
+    acks[i].count++;
+
+    // Message plein: on l'envoie tout de suite.
+    if(acks[i].count >= ACK_BATCH) {
+        send_pending(&acks[i]);
+        acks[i] = acks[--ack_dests];
+    }
+
+    schedule_acks();
+}
+
+void send_echo_reply(uint128_t ip, uint16_t port, uint32_t stamp) {
+    struct sockaddr_in6 dest;
+    memset(&dest, 0, sizeof(dest));
+    dest.sin6_family = AF_INET6;
+    dest.sin6_port = port;
+    memcpy(&dest.sin6_addr, &ip, sizeof(uint128_t));
+
+    // La reponse part avec les prochains acquittements, au plus tard apres
+    // ACK_FLUSH_DELAY ms.
+    int i = get_pending(&dest);
+    acks[i].echo = 1;
+    acks[i].echo_stamp = stamp;
+    acks[i].echo_at = timer_now();
+
+    schedule_acks();
 }
@@ -2,9 +2,15 @@
 #define DATA_MANAGER_H
 
 #include "neighbour.h"
+#include "payload.h"
 
 #include <stdint.h>
 
+#define DATA_TYPE_TEXT 0
+
+// Taille maximale du contenu d'un tlv data (255 octets moins l'entete).
+#define MAX_DATA_LEN 242
+
 struct received_data;
 
 /******************/
@@ -12,9 +18,10 @@ struct received_data;
 /******************/
 
 /*
- * Creee une donee recement recue. (data est copiee)
+ * Creee une donee recement recue, de contenu p (partage, sans copie; NULL
+ * si on n'en connait que l'identifiant).
  */
-struct received_data* create_received_data(uint64_t id, uint32_t nonce, uint8_t type, const uint8_t* data, size_t data_len);
+struct received_data* create_received_data(uint64_t id, uint32_t nonce, uint8_t type, struct payload* p);
 
 /*****************/
 /*  Destructeur  */
@@ -34,11 +41,65 @@ void destroy_received_data(struct received_data* rd);
  */
 struct received_data* get_received_data(uint64_t id, uint32_t nonce);
 
+/*
+ * Renvoie l'id de l'emetteur de rd.
+ */
+uint64_t get_data_id(struct received_data* rd);
+
+/*
+ * Renvoie le nonce de rd.
+ */
+uint32_t get_data_nonce(struct received_data* rd);
+
+/*
+ * Retient que rd nous a ete envoyee en premier par n (ignore si n est NULL).
+ */
+void set_received_from(struct received_data* rd, struct neighbour* n);
+
+/*
+ * Renvoie 1 si rd nous a ete envoyee en premier par n et 0 sinon.
+ */
+short is_received_from(struct received_data* rd, struct neighbour* n);
+
 /*
  * Met le voisin n dans rd en etat "a recu". Thread-safe.
  */
 void received(struct received_data* rd, struct neighbour* n);
 
+/*
+ * Stocke dans ids et nonces les identifiants (id,nonce) des donnees recement
+ * recues, de la plus recente a la plus ancienne (au plus max).
+ * Renvoie le nombre d'identifiants stockes.
+ */
+int get_received_ids(uint64_t ids[], uint32_t nonces[], int max);
+
+/*
+ * Comme get_received_ids(), mais seulement pour les donnees recues entre
+ * les dates from (comprise) et to (exclue), en ms (cf. timer_now()).
+ */
+int get_received_ids_between(uint64_t ids[], uint32_t nonces[], int max, uint64_t from, uint64_t to);
+
+/*
+ * Renvoie le contenu de rd (NULL si on n'en a que l'identifiant), sans
+ * prendre de reference.
+ */
+struct payload* get_received_payload(struct received_data* rd);
+
+/*
+ * Renvoie le type de la donnee rd.
+ */
+uint8_t get_received_type(struct received_data* rd);
+
+/*
+ * Renvoie le prochain nonce utilise pour nos donnees.
+ */
+uint32_t get_my_nonce();
+
+/*
+ * Change le prochain nonce utilise pour nos donnees.
+ */
+void set_my_nonce(uint32_t nonce);
+
 /*******************/
 /*   Comparator    */
 /*******************/
@@ -63,10 +124,45 @@ void add_symmetric(struct received_data* rd, struct neighbour* n);
 short add_received_data(struct received_data* rd);
 
 /*
- * Envoie une donnee depuis le pair courant.
+ * Envoie une donnee de type 'type' depuis le pair courant.
+ * (len doit etre au plus MAX_DATA_LEN)
+ */
+void add_my_typed_data(uint8_t type, const uint8_t* d, size_t len);
+
+/*
+ * Envoie une donnee de type 'type' depuis le pair courant. Elle est
+ * fragmentee si elle depasse MAX_DATA_LEN.
+ */
+void add_my_payload(uint8_t type, const uint8_t* d, size_t len);
+
+/*
+ * Envoie un texte depuis le pair courant. Il est compresse si la
+ * compression est activee et utile, et fragmente si il depasse MAX_DATA_LEN.
  */
 void add_my_data(const uint8_t* d, size_t len);
 
+/*
+ * Marque la donnee (id,nonce) comme deja recue sans son contenu
+ * (elle ne sera ni affichee ni inondee si on la recoit a nouveau).
+ */
+void add_received_id(uint64_t id, uint32_t nonce);
+
+/*
+ * Remet la donnee (id,nonce) de contenu p (partage) dans la liste des
+ * donnees recues, sans l'inonder. Renvoie 1 si elle n'y etait pas et 0 sinon.
+ */
+short restore_received_data(uint64_t id, uint32_t nonce, uint8_t type, struct payload* p);
+
+/*******************/
+/*    Livraison    */
+/*******************/
+
+/*
+ * Remet une donnee recue de l'emetteur 'id' a l'application
+ * (affichage, reassemblage...) selon son type.
+ */
+void deliver_data(uint64_t id, uint8_t type, const uint8_t* data, size_t len);
+
 /*******************/
 /*   Suppression   */
 /*******************/
@@ -83,8 +179,49 @@ void remove_symmetric(struct received_data* rd, uint64_t id);
 /*******************/
 
 /*
- * Lance l'innondation pour la donee rd.
+ * Lance l'innondation pour la donee rd: elle est envoyee a chaque voisin
+ * de sa liste d'attente, puis renvoyee (temporisateurs a delai exponentiel)
+ * jusqu'a son acquittement.
  */
 void inondation(struct received_data* rd);
 
+/*
+ * Envoie (de maniere fiable) rd au voisin n, en relancant l'innondation
+ * si elle est terminee. Renvoie 0 si on n'a pas le contenu de rd.
+ */
+short resend_data(struct received_data* rd, struct neighbour* n);
+
+/*
+ * Retire (ip,port) des destinataires de toutes les innondations en cours.
+ */
+void forget_floods_to(uint128_t ip, uint16_t port);
+
+/*
+ * Avant l'arret: renvoie tout de suite chaque donnee a ceux qui ne l'ont pas
+ * encore acquittee, sans attendre leur fenetre (cf. congestion.h).
+ */
+void hasten_floods();
+
+/*
+ * Renvoie le nombre d'innondations qui attendent encore l'acquittement d'un
+ * voisin non suspect.
+ */
+int floods_pending();
+
+/*******************/
+/* Acquittements   */
+/*******************/
+
+/*
+ * Acquitte la donnee (id,nonce) aupres de n. Les acquittements d'un meme
+ * voisin sont regroupes dans un seul message, envoye apres quelques ms.
+ */
+void send_ack(struct neighbour* n, uint64_t id, uint32_t nonce);
+
+/*
+ * Repond au tlv Echo de date 'stamp' recu de (ip,port): la reponse est
+ * jointe aux prochains acquittements envoyes a ce pair.
+ */
+void send_echo_reply(uint128_t ip, uint16_t port, uint32_t stamp);
+
 #endif /* DATA_MANAGER */
@@ -0,0 +1,169 @@
+#include "epoch.h"
+
+#include "inputReader.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+static short debug = 0;
+
+struct reader {
+    atomic_int used;
+    atomic_int active;          // En section de lecture.
+    atomic_ulong epoch;         // Epoque vue a l'entree de la section.
+};
+
+struct retired {
+    void* ptr;
+    void (*destroy)(void*);
+    unsigned long epoch;        // Epoque du retrait.
+    struct retired* next;
+};
+
+static atomic_ulong global_epoch = 0;
+static struct reader readers[EPOCH_MAX_THREADS];
+static __thread struct reader* me = NULL;
+static __thread int depth = 0;          // Imbrication des sections.
+
+static struct retired* retired_head = NULL;
+
+static unsigned long retired_count = 0;
+static unsigned long freed_count = 0;
+
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/*******************/
+/*       Lock      */
+/*******************/
+
+static void lock(const char* func_name) {
+    if( pthread_mutex_lock(&mutex) != 0 ) {
+        perror(func_name);
+        exit(EXIT_FAILURE);
+    }
+}
+
+static void unlock(const char* func_name) {
+    if( pthread_mutex_unlock(&mutex) != 0 ) {
+        perror(func_name);
+        exit(EXIT_FAILURE);
+    }
+}
+
+/*******************/
+/*     Lecteurs    */
+/*******************/
+
+static struct reader* register_reader() {
+    for(int i = 0; i < EPOCH_MAX_THREADS; i++) {
+        int unused = 0;
+        if( atomic_compare_exchange_strong(&readers[i].used, &unused, 1) )
+            return &readers[i];
+    }
+
+    fprintf(stderr, "epoch: trop de threads lecteurs (%d au plus).\n", EPOCH_MAX_THREADS);
+    exit(EXIT_FAILURE);
+}
+
+void epoch_enter() {
+    if(me == NULL)
+        me = register_reader();
+    if(depth++ > 0)
+        return;
+
+    // Actif avant de lire l'epoque: try_advance() voit au pire une epoque
+    // perimee, ce qui ne fait que retarder l'avancee.
+    atomic_store(&me->active, 1);
+    atomic_store(&me->epoch, atomic_load(&global_epoch));
+}
+
+void epoch_exit() {
+    if(--depth > 0)
+        return;
+    atomic_store(&me->active, 0);
+}
+
+/*******************/
+/*   Liberation    */
+/*******************/
+
+void retire(void* ptr, void (*destroy)(void*)) {
+    struct retired* r = malloc(sizeof(struct retired));
+    if(r == NULL) {
+        fprintf(stderr, "malloc() failed.");
+        exit(1);
+    }
+
+    r->ptr = ptr;
+    r->destroy = destroy;
+
+    lock("retire");
+    r->epoch = atomic_load(&global_epoch);
+    r->next = retired_head;
+    retired_head = r;
+    retired_count++;
+    unlock("retire");
+}
+
+// L'epoque avance quand tous les lecteurs en section l'ont vue.
+static void try_advance() {
+    unsigned long epoch = atomic_load(&global_epoch);
+
+    for(int i = 0; i < EPOCH_MAX_THREADS; i++)
+        if( atomic_load(&readers[i].used) && atomic_load(&readers[i].active)
+            && atomic_load(&readers[i].epoch) != epoch )
+            return;
+
+    atomic_compare_exchange_strong(&global_epoch, &epoch, epoch + 1);
+}
+
+void epoch_reclaim() {
+    try_advance();
+
+    // Un objet retire a l'epoque e peut encore etre vu par un lecteur entre
+    // a l'epoque e: il est libre des que l'epoque vaut e+2.
+    unsigned long epoch = atomic_load(&global_epoch);
+    struct retired* to_free = NULL;
+
+    lock("epoch_reclaim");
+    struct retired** aux = &retired_head;
+    while(*aux != NULL) {
+        struct retired* r = *aux;
+        if(r->epoch + 2 <= epoch) {
+            *aux = r->next;
+            r->next = to_free;
+            to_free = r;
+            freed_count++;
+        } else {
+            aux = &r->next;
+        }
+    }
+    unlock("epoch_reclaim");
+
+    int count = 0;
+    while(to_free != NULL) {
+        struct retired* r = to_free;
+        to_free = r->next;
+        r->destroy(r->ptr);
+        free(r);
+        count++;
+    }
+
+    if(debug && count > 0)
+        printn("Epoque %lu: %d objets libérés.", epoch, count);
+}
+
+/*******************/
+/*   Statistiques  */
+/*******************/
+
+void print_epoch_stats() {
+    lock("print_epoch_stats");
+    unsigned long r = retired_count, f = freed_count;
+    unlock("print_epoch_stats");
+
+    printn("Libération différée: époque %lu, %lu objets retirés, %lu libérés, %lu en attente.",
+           atomic_load(&global_epoch), r, f, r - f);
+}
@@ -0,0 +1,44 @@
+#ifndef EPOCH_H
+#define EPOCH_H
+
+/*
+ * Liberation differee par epoques (epoch-based reclamation).
+ * Un lecteur entoure son acces aux objets partages par epoch_enter() et
+ * epoch_exit(), sans prendre de verrou. Un objet retire des structures
+ * partagees est confie a retire(): il n'est libere qu'une fois que plus
+ * aucun lecteur entre avant son retrait n'est encore en section critique.
+ */
+
+// Nombre maximal de threads lecteurs.
+#define EPOCH_MAX_THREADS 16
+
+/*
+ * Debut d'une section de lecture du thread courant (qui est enregistre
+ * a son premier appel). Les sections peuvent s'imbriquer: seule la plus
+ * externe compte.
+ */
+void epoch_enter();
+
+/*
+ * Fin de la section de lecture du thread courant.
+ */
+void epoch_exit();
+
+/*
+ * Confie ptr a la liberation differee: destroy(ptr) sera appelee quand
+ * plus aucun lecteur ne pourra le voir.
+ */
+void retire(void* ptr, void (*destroy)(void*));
+
+/*
+ * Avance l'epoque si possible et libere les objets qui ne sont plus
+ * visibles. A appeler regulierement, hors section de lecture.
+ */
+void epoch_reclaim();
+
+/*
+ * Affiche le nombre d'objets retires, liberes et en attente.
+ */
+void print_epoch_stats();
+
+#endif /* EPOCH_H */
@@ -0,0 +1,194 @@
+#include "fragment.h"
+
+#include "dataManager.h"
+#include "inputReader.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include <arpa/inet.h>
+
+#define FRAGMENT_HEADER_LEN 13
+#define FRAGMENT_DATA_LEN (MAX_DATA_LEN - FRAGMENT_HEADER_LEN)
+
+#define REASSEMBLY_SLOTS 16
+#define REASSEMBLY_MAX_BYTES (8 << 20)
+#define REASSEMBLY_TIMEOUT 60
+
+static short debug = 0;
+
+struct reassembly {
+    uint64_t sender_id;
+    uint32_t payload_id;
+    uint32_t total_len;
+    uint32_t received_len;
+    uint8_t type;
+    long started;
+    uint8_t* data;      // NULL si l'emplacement est libre.
+    uint8_t* received;  // Un octet par fragment.
+};
+
+static struct reassembly slots[REASSEMBLY_SLOTS];
+static size_t reserved_bytes = 0;
+
+/*******************/
+/*      Envoie     */
+/*******************/
+
+int send_fragmented(uint8_t type, const uint8_t* d, size_t len) {
+    if(len > FRAGMENT_MAX_PAYLOAD || type == DATA_TYPE_FRAGMENT) {
+        fprintn(stderr, "Donnée trop grande (%lu octets, maximum %d).", (unsigned long)len, FRAGMENT_MAX_PAYLOAD);
+        return 0;
+    }
+
+    // Le nonce du premier fragment est unique pour nous: il sert d'id.
+    uint32_t payload_id = htonl(get_my_nonce());
+    uint32_t total_len = htonl(len);
+
+    uint8_t fragment[MAX_DATA_LEN];
+    int count = 0;
+
+    for(size_t offset = 0; offset < len; offset += FRAGMENT_DATA_LEN) {
+        size_t flen = len - offset < FRAGMENT_DATA_LEN ? len - offset : FRAGMENT_DATA_LEN;
+        uint32_t noffset = htonl(offset);
+
+        memcpy(fragment, &payload_id, 4);
+        memcpy(fragment+4, &total_len, 4);
+        memcpy(fragment+8, &noffset, 4);
+        fragment[12] = type;
+        memcpy(fragment+FRAGMENT_HEADER_LEN, d+offset, flen);
+
+        add_my_typed_data(DATA_TYPE_FRAGMENT, fragment, FRAGMENT_HEADER_LEN + flen);
+        count++;
+    }
+
+    if(debug)
+        printn("Donnée de %lu octets envoyée en %d fragments.", (unsigned long)len, count);
+
+    return count;
+}
+
+/*******************/
+/*   Reassemblage  */
+/*******************/
+
+static void free_slot(struct reassembly* r) {
+    reserved_bytes -= r->total_len;
+    free(r->data);
+    free(r->received);
+    r->data = NULL;
+    r->received = NULL;
+}
+
+// Libere l'emplacement le plus ancien. Renvoie 0 si tous sont libres.
+static short evict_oldest() {
+    struct reassembly* oldest = NULL;
+    for(int i = 0; i < REASSEMBLY_SLOTS; i++)
+        if( slots[i].data != NULL && (oldest == NULL || slots[i].started < oldest->started) )
+            oldest = &slots[i];
+
+    if(oldest == NULL)
+        return 0;
+
+    if(debug)
+        printn("Reassemblage abandonné (%u/%u octets).", oldest->received_len, oldest->total_len);
+
+    free_slot(oldest);
+    return 1;
+}
+
+static struct reassembly* get_slot(uint64_t sender_id, uint32_t payload_id) {
+    for(int i = 0; i < REASSEMBLY_SLOTS; i++)
+        if( slots[i].data != NULL && slots[i].sender_id == sender_id && slots[i].payload_id == payload_id )
+            return &slots[i];
+    return NULL;
+}
+
+static struct reassembly* new_slot(uint64_t sender_id, uint32_t payload_id, uint32_t total_len, uint8_t type) {
+    struct reassembly* r = NULL;
+
+    // On fait de la place en abandonnant les reassemblages les plus anciens.
+    while( reserved_bytes + total_len > REASSEMBLY_MAX_BYTES && evict_oldest() );
+
+    for(int i = 0; i < REASSEMBLY_SLOTS && r == NULL; i++)
+        if(slots[i].data == NULL)
+            r = &slots[i];
+
+    if(r == NULL) {
+        evict_oldest();
+        return new_slot(sender_id, payload_id, total_len, type);
+    }
+
+    r->data = malloc(total_len);
+    r->received = calloc((total_len + FRAGMENT_DATA_LEN - 1) / FRAGMENT_DATA_LEN, 1);
+    if(r->data == NULL || r->received == NULL) {
+        fprintf(stderr, "malloc() failed.");
+        exit(1);
+    }
+
+    r->sender_id = sender_id;
+    r->payload_id = payload_id;
+    r->total_len = total_len;
+    r->received_len = 0;
+    r->type = type;
+    r->started = time(NULL);
+    reserved_bytes += total_len;
+
+    return r;
+}
+
+void receive_fragment(uint64_t sender_id, const uint8_t* fragment, size_t len) {
+    if(len <= FRAGMENT_HEADER_LEN)
+        return;
+
+    uint32_t payload_id, total_len, offset;
+    memcpy(&payload_id, fragment, 4);
+    memcpy(&total_len, fragment+4, 4);
+    memcpy(&offset, fragment+8, 4);
+    total_len = ntohl(total_len);
+    offset = ntohl(offset);
+
+    uint8_t type = fragment[12];
+    size_t flen = len - FRAGMENT_HEADER_LEN;
+
+    // Fragment incoherent: on l'ignore.
+    if( total_len > FRAGMENT_MAX_PAYLOAD || type == DATA_TYPE_FRAGMENT
+        || offset % FRAGMENT_DATA_LEN != 0 || offset >= total_len
+        || flen != (total_len - offset < FRAGMENT_DATA_LEN ? total_len - offset : FRAGMENT_DATA_LEN) ) {
+        if(debug)
+            printn("Fragment invalide ignoré.");
+        return;
+    }
+
+    fragment_maintenance();
+
+    struct reassembly* r = get_slot(sender_id, payload_id);
+    if(r == NULL)
+        r = new_slot(sender_id, payload_id, total_len, type);
+    else if(r->total_len != total_len || r->type != type)
+        return;
+
+    int index = offset / FRAGMENT_DATA_LEN;
+    if( !r->received[index] ) {
+        memcpy(r->data + offset, fragment + FRAGMENT_HEADER_LEN, flen);
+        r->received[index] = 1;
+        r->received_len += flen;
+    }
+
+    if(r->received_len == r->total_len) {
+        deliver_data(sender_id, r->type, r->data, r->total_len);
+        free_slot(r);
+    }
+}
+
+void fragment_maintenance() {
+    long now = time(NULL);
+    for(int i = 0; i < REASSEMBLY_SLOTS; i++)
+        if( slots[i].data != NULL && now - slots[i].started > REASSEMBLY_TIMEOUT ) {
+            if(debug)
+                printn("Reassemblage expiré (%u/%u octets).", slots[i].received_len, slots[i].total_len);
+            free_slot(&slots[i]);
+        }
+}
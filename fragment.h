@@ -0,0 +1,36 @@
+#ifndef FRAGMENT_H
+#define FRAGMENT_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Type des donnees fragmentees. Le contenu d'un tlv data de ce type est:
+ * id de la donnee (4), taille totale (4), position du fragment (4),
+ * type de la donnee complete (1) puis le fragment.
+ * (entiers dans l'ordre du reseau)
+ */
+#define DATA_TYPE_FRAGMENT 220
+
+// Taille maximale d'une donnee fragmentee.
+#define FRAGMENT_MAX_PAYLOAD (1 << 20)
+
+/*
+ * Decoupe la donnee d de type 'type' en fragments et les envoie
+ * (chacun est inonde independamment).
+ * Renvoie le nombre de fragments envoyes (0 si la donnee est trop grande).
+ */
+int send_fragmented(uint8_t type, const uint8_t* d, size_t len);
+
+/*
+ * Traite un fragment recu de l'emetteur 'sender_id'. La donnee complete
+ * est livree (deliver_data) des que tous ses fragments sont arrives.
+ */
+void receive_fragment(uint64_t sender_id, const uint8_t* fragment, size_t len);
+
+/*
+ * Abandonne les reassemblages trop anciens.
+ */
+void fragment_maintenance();
+
+#endif /* FRAGMENT_H */
@@ -0,0 +1,637 @@
+#include "history.h"
+
+#include "dataManager.h"
+#include "inputReader.h"
+#include "timerWheel.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define SEGMENT_MAGIC 0x50324853
+#define SEGMENT_VERSION 1
+#define SEGMENT_SIZE (1 << 20)
+
+// Taille du lot en memoire (ecrit d'un coup, ou plus tot s'il est plein).
+#define HISTORY_BATCH (64 * 1024)
+
+// Delai maximal (ms) entre un ajout et l'ecriture de son lot, et entre
+// deux synchronisations du segment courant sur le disque.
+#define HISTORY_COMMIT_DELAY 50
+#define HISTORY_SYNC_INTERVAL 1000
+
+static short debug = 0;
+
+struct segment_header {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t seq;
+};
+
+// Un enregistrement est suivi de son contenu, puis complete jusqu'a un
+// multiple de 8 octets. La somme de controle couvre tout le reste: la fin
+// d'un segment (zeros ou enregistrement tronque) est ainsi reconnue.
+struct record {
+    uint32_t checksum;
+    uint16_t length;
+    uint8_t type;
+    uint8_t unused;
+    uint64_t sender;
+    uint64_t received_at;       // ms depuis le 1er janvier 1970.
+    uint32_t nonce;
+    uint32_t unused2;
+};
+
+// Position 0: case vide (un enregistrement suit toujours l'entete).
+struct index_entry {
+    uint64_t sender;
+    uint32_t nonce;
+    uint32_t offset;
+};
+
+struct segment {
+    uint64_t seq;
+    uint8_t* map;               // SEGMENT_SIZE octets, en lecture seule.
+    uint32_t end;               // Fin des enregistrements (lot compris).
+    uint32_t records;
+    struct index_entry* index;
+    uint32_t index_size;        // Puissance de 2.
+};
+
+static char directory[PATH_MAX - 32];
+
+// Du plus ancien au plus recent; le dernier est le segment courant.
+static struct segment segments[HISTORY_SEGMENTS];
+static int segment_count = 0;
+
+static int fd = -1;             // Segment courant.
+static uint32_t committed = 0;  // Octets du segment courant deja ecrits.
+
+static uint8_t batch[HISTORY_BATCH];
+static size_t batch_len = 0;
+
+static struct timer* commit_timer = NULL;
+static short unsynced = 0;
+static uint64_t last_sync = 0;
+
+static unsigned long appended = 0;
+static unsigned long writes = 0;
+static unsigned long syncs = 0;
+
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/*******************/
+/*       Lock      */
+/*******************/
+
+static void lock(const char* func_name) {
+    if( pthread_mutex_lock(&mutex) != 0 ) {
+        perror(func_name);
+        exit(EXIT_FAILURE);
+    }
+}
+
+static void unlock(const char* func_name) {
+    if( pthread_mutex_unlock(&mutex) != 0 ) {
+        perror(func_name);
+        exit(EXIT_FAILURE);
+    }
+}
+
+/*********************/
+/*  Enregistrements  */
+/*********************/
+
+static uint32_t record_size(size_t length) {
+    return (sizeof(struct record) + length + 7) & ~7u;
+}
+
+// FNV-1a.
+static uint32_t checksum(const struct record* r, const uint8_t* data) {
+    uint32_t h = 2166136261u;
+    const uint8_t* b = (const uint8_t*)r + sizeof(r->checksum);
+    for(size_t i = 0; i < sizeof(struct record) - sizeof(r->checksum); i++)
+        h = (h ^ b[i]) * 16777619u;
+    for(size_t i = 0; i < r->length; i++)
+        h = (h ^ data[i]) * 16777619u;
+    return h;
+}
+
+static uint64_t now_ms() {
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    return (uint64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+// Enregistrement a la position off du segment s (dans le lot s'il n'est
+// pas encore ecrit). Verrou pris.
+static const struct record* record_at(struct segment* s, uint32_t off) {
+    if( s == &segments[segment_count-1] && off >= committed )
+        return (const struct record*)(batch + (off - committed));
+    return (const struct record*)(s->map + off);
+}
+
+/*******************/
+/*      Index      */
+/*******************/
+
+static uint32_t slot_of(uint64_t sender, uint32_t nonce, uint32_t size) {
+    uint64_t h = (sender ^ ((uint64_t)nonce << 32 | nonce)) * 0x9E3779B97F4A7C15ULL;
+    return (h >> 32) & (size - 1);
+}
+
+static void index_put(struct index_entry* index, uint32_t size, uint64_t sender, uint32_t nonce, uint32_t offset) {
+    uint32_t i = slot_of(sender, nonce, size);
+    while( index[i].offset != 0 && !(index[i].sender == sender && index[i].nonce == nonce) )
+        i = (i+1) & (size - 1);
+
+    index[i].sender = sender;
+    index[i].nonce = nonce;
+    index[i].offset = offset;
+}
+
+// L'index est agrandi pour rester a moitie vide au plus.
+static void index_insert(struct segment* s, uint64_t sender, uint32_t nonce, uint32_t offset) {
+    if( (s->records + 1) * 2 > s->index_size ) {
+        uint32_t size = s->index_size == 0 ? 256 : s->index_size * 2;
+        struct index_entry* index = calloc(size, sizeof(struct index_entry));
+        if(index == NULL) {
+            fprintf(stderr, "malloc() failed.");
+            exit(1);
+        }
+
+        for(uint32_t i = 0; i < s->index_size; i++)
+            if(s->index[i].offset != 0)
+                index_put(index, size, s->index[i].sender, s->index[i].nonce, s->index[i].offset);
+
+        free(s->index);
+        s->index = index;
+        s->index_size = size;
+    }
+
+    index_put(s->index, s->index_size, sender, nonce, offset);
+}
+
+static uint32_t index_find(struct segment* s, uint64_t sender, uint32_t nonce) {
+    if(s->index_size == 0)
+        return 0;
+
+    for(uint32_t i = slot_of(sender, nonce, s->index_size); s->index[i].offset != 0; i = (i+1) & (s->index_size - 1))
+        if( s->index[i].sender == sender && s->index[i].nonce == nonce )
+            return s->index[i].offset;
+    return 0;
+}
+
+/*******************/
+/*     Segments    */
+/*******************/
+
+static void segment_path(char path[], uint64_t seq) {
+    snprintf(path, PATH_MAX, "%s/%010llu.seg", directory, (unsigned long long)seq);
+}
+
+// Ouvre (ou cree) le segment seq et le projette en memoire. Renvoie son
+// descripteur, ou -1 en cas d'echec.
+static int map_segment(struct segment* s, uint64_t seq) {
+    char path[PATH_MAX];
+    segment_path(path, seq);
+
+    int f = open(path, O_RDWR | O_CREAT, 0600);
+    if(f < 0) {
+        perror("history: open");
+        return -1;
+    }
+
+    struct stat st;
+    if( fstat(f, &st) < 0 || (st.st_size < SEGMENT_SIZE && ftruncate(f, SEGMENT_SIZE) < 0) ) {
+        perror("history: ftruncate");
+        close(f);
+        return -1;
+    }
+
+    void* p = mmap(NULL, SEGMENT_SIZE, PROT_READ, MAP_SHARED, f, 0);
+    if(p == MAP_FAILED) {
+        perror("history: mmap");
+        close(f);
+        return -1;
+    }
+
+    memset(s, 0, sizeof(struct segment));
+    s->seq = seq;
+    s->map = p;
+    s->end = sizeof(struct segment_header);
+    return f;
+}
+
+static void unmap_segment(struct segment* s) {
+    munmap(s->map, SEGMENT_SIZE);
+    free(s->index);
+    s->map = NULL;
+    s->index = NULL;
+}
+
+// Reconstruit l'index de s a partir de ses enregistrements valides situes
+// avant la position limit.
+static void scan_segment(struct segment* s, uint32_t limit) {
+    uint32_t pos = sizeof(struct segment_header);
+
+    free(s->index);
+    s->index = NULL;
+    s->index_size = 0;
+    s->records = 0;
+
+    while( pos + sizeof(struct record) <= limit ) {
+        const struct record* r = (const struct record*)(s->map + pos);
+        if( pos + record_size(r->length) > limit
+            || r->checksum != checksum(r, (const uint8_t*)(r + 1)) )
+            break;
+
+        index_insert(s, r->sender, r->nonce, pos);
+        s->records++;
+        pos += record_size(r->length);
+    }
+
+    s->end = pos;
+}
+
+// Le lot n'a ete ecrit que sur ses done premiers octets: on oublie les
+// enregistrements incomplets, que l'index et la fin du segment designaient
+// deja. Verrou pris.
+static void rollback(size_t done) {
+    uint32_t keep = 0;
+    while(keep < batch_len) {
+        uint32_t size = record_size(((const struct record*)(batch + keep))->length);
+        if(keep + size > done)
+            break;
+        keep += size;
+    }
+
+    // Les enregistrements ecrits se relisent dans la projection du segment.
+    struct segment* s = &segments[segment_count-1];
+    uint32_t records = s->records;
+    scan_segment(s, committed + keep);
+    committed = s->end;
+    batch_len = 0;
+
+    fprintf(stderr, "Historique: %u enregistrements non écrits oubliés.\n", records - s->records);
+}
+
+// Ecrit le lot en cours a la fin du segment courant. Verrou pris.
+static void commit() {
+    size_t done = 0;
+    while(done < batch_len) {
+        ssize_t rc = pwrite(fd, batch + done, batch_len - done, committed + done);
+        if(rc < 0) {
+            if(errno == EINTR)
+                continue;
+            perror("history: pwrite");
+            break;
+        }
+        done += rc;
+    }
+
+    if(done > 0)
+        unsynced = 1;
+    writes++;
+
+    if(done < batch_len) {
+        rollback(done);
+        return;
+    }
+
+    committed += batch_len;
+    batch_len = 0;
+}
+
+static void sync_segment() {
+    if( fdatasync(fd) < 0 )
+        perror("history: fdatasync");
+    unsynced = 0;
+    last_sync = timer_now();
+    syncs++;
+}
+
+// Cree le segment seq et en fait le segment courant. Verrou pris.
+static short start_segment(uint64_t seq) {
+    struct segment* s = &segments[segment_count];
+    int f = map_segment(s, seq);
+    if(f < 0)
+        return 0;
+
+    struct segment_header header = { SEGMENT_MAGIC, SEGMENT_VERSION, seq };
+    if( pwrite(f, &header, sizeof(header), 0) != sizeof(header) ) {
+        perror("history: pwrite");
+        unmap_segment(s);
+        close(f);
+        return 0;
+    }
+
+    segment_count++;
+    fd = f;
+    committed = sizeof(header);
+    return 1;
+}
+
+// Le segment courant est plein: on passe au suivant, en supprimant le plus
+// ancien s'il le faut. Verrou pris.
+static void rotate() {
+    commit();
+    sync_segment();
+    close(fd);
+    fd = -1;
+
+    uint64_t seq = segments[segment_count-1].seq + 1;
+
+    if(segment_count == HISTORY_SEGMENTS) {
+        char path[PATH_MAX];
+        segment_path(path, segments[0].seq);
+        unmap_segment(&segments[0]);
+        unlink(path);
+        memmove(segments, segments+1, (segment_count-1) * sizeof(struct segment));
+        segment_count--;
+    }
+
+    if( !start_segment(seq) )
+        fprintf(stderr, "Historique désactivé.\n");
+
+    if(debug)
+        printn("Historique: segment %llu commencé.", (unsigned long long)seq);
+}
+
+/*******************/
+/*    Ouverture    */
+/*******************/
+
+static int compare_seqs(const void* a, const void* b) {
+    uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+static void commit_expired(void* arg) {
+    (void)arg;
+    lock("commit_expired");
+    if(fd >= 0)
+        commit();
+    unlock("commit_expired");
+}
+
+short open_history(const char* dir) {
+    snprintf(directory, sizeof(directory), "%s", dir);
+    if( mkdir(directory, 0700) < 0 && errno != EEXIST ) {
+        perror("open_history: mkdir");
+        return 0;
+    }
+
+    DIR* d = opendir(directory);
+    if(d == NULL) {
+        perror("open_history: opendir");
+        return 0;
+    }
+
+    // Les numeros des segments existants, tries.
+    uint64_t seqs[HISTORY_SEGMENTS * 4];
+    int count = 0;
+    struct dirent* e;
+    while( (e = readdir(d)) != NULL && count < HISTORY_SEGMENTS * 4 ) {
+        unsigned long long seq;
+        char end;
+        if( sscanf(e->d_name, "%llu.se%c", &seq, &end) == 2 && end == 'g' )
+            seqs[count++] = seq;
+    }
+    closedir(d);
+    qsort(seqs, count, sizeof(uint64_t), compare_seqs);
+
+    lock("open_history");
+
+    for(int i = 0; i < count; i++) {
+        char path[PATH_MAX];
+        segment_path(path, seqs[i]);
+
+        // Seuls les HISTORY_SEGMENTS plus recents sont gardes.
+        if(i < count - HISTORY_SEGMENTS) {
+            unlink(path);
+            continue;
+        }
+
+        struct segment* s = &segments[segment_count];
+        int f = map_segment(s, seqs[i]);
+        if(f < 0)
+            continue;
+
+        const struct segment_header* h = (const struct segment_header*)s->map;
+        if( h->magic != SEGMENT_MAGIC || h->version != SEGMENT_VERSION || h->seq != seqs[i] ) {
+            unmap_segment(s);
+            close(f);
+            unlink(path);
+            continue;
+        }
+
+        scan_segment(s, SEGMENT_SIZE);
+        segment_count++;
+
+        if(i == count-1) {
+            fd = f;
+            committed = s->end;
+        } else {
+            close(f);
+        }
+    }
+
+    // On ne reecrit pas un segment ancien: sans segment courant, on en
+    // commence un nouveau.
+    short ok = fd >= 0;
+    if(!ok) {
+        if(segment_count == HISTORY_SEGMENTS) {
+            char path[PATH_MAX];
+            segment_path(path, segments[0].seq);
+            unmap_segment(&segments[0]);
+            unlink(path);
+            memmove(segments, segments+1, (segment_count-1) * sizeof(struct segment));
+            segment_count--;
+        }
+        ok = start_segment(segment_count > 0 ? segments[segment_count-1].seq + 1 : 1);
+    }
+
+    unlock("open_history");
+
+    if(ok)
+        commit_timer = create_timer(commit_expired, NULL);
+    return ok;
+}
+
+/*******************/
+/*      Ajout      */
+/*******************/
+
+void history_append(uint64_t sender, uint32_t nonce, uint8_t type, struct payload* p) {
+    if(fd < 0)
+        return;
+
+    size_t length = payload_length(p);
+    uint32_t size = record_size(length);
+
+    lock("history_append");
+
+    if(fd < 0) {
+        unlock("history_append");
+        return;
+    }
+
+    if( segments[segment_count-1].end + size > SEGMENT_SIZE ) {
+        rotate();
+        if(fd < 0) {
+            unlock("history_append");
+            return;
+        }
+    }
+    if(batch_len + size > HISTORY_BATCH)
+        commit();
+
+    struct segment* s = &segments[segment_count-1];
+    struct record* r = (struct record*)(batch + batch_len);
+    memset(r, 0, size);
+    r->length = length;
+    r->type = type;
+    r->sender = sender;
+    r->received_at = now_ms();
+    r->nonce = nonce;
+    memcpy(r + 1, payload_data(p), length);
+    r->checksum = checksum(r, payload_data(p));
+
+    index_insert(s, sender, nonce, s->end);
+    s->end += size;
+    s->records++;
+    batch_len += size;
+    appended++;
+
+    short first = batch_len == size;
+
+    unlock("history_append");
+
+    // Le premier enregistrement d'un lot arme l'ecriture du lot.
+    if(first)
+        schedule_timer(commit_timer, HISTORY_COMMIT_DELAY);
+}
+
+/*******************/
+/*     Lecture     */
+/*******************/
+
+struct payload* history_lookup(uint64_t sender, uint32_t nonce, uint8_t* type) {
+    struct payload* p = NULL;
+
+    lock("history_lookup");
+    for(int i = segment_count-1; i >= 0 && p == NULL; i--) {
+        uint32_t off = index_find(&segments[i], sender, nonce);
+        if(off == 0)
+            continue;
+
+        const struct record* r = record_at(&segments[i], off);
+        p = create_payload((const uint8_t*)(r + 1), r->length);
+        *type = r->type;
+    }
+    unlock("history_lookup");
+
+    return p;
+}
+
+int replay_history(int max) {
+    lock("replay_history");
+
+    // Premier segment a relire, et nombre d'enregistrements a y sauter.
+    int first = segment_count;
+    long skip = max;
+    while(first > 0 && skip > 0)
+        skip -= segments[--first].records;
+    skip = skip < 0 ? -skip : 0;
+
+    int count = 0;
+    for(int i = first; i < segment_count; i++) {
+        struct segment* s = &segments[i];
+        for(uint32_t pos = sizeof(struct segment_header); pos < s->end; ) {
+            const struct record* r = record_at(s, pos);
+            pos += record_size(r->length);
+            if(skip > 0) {
+                skip--;
+                continue;
+            }
+
+            struct payload* p = create_payload((const uint8_t*)(r + 1), r->length);
+            uint64_t sender = r->sender;
+            uint32_t nonce = r->nonce;
+            uint8_t type = r->type;
+
+            // La livraison affiche et peut reassembler: verrou relache.
+            unlock("replay_history");
+            if( restore_received_data(sender, nonce, type, p) ) {
+                deliver_data(sender, type, payload_data(p), payload_length(p));
+                count++;
+            }
+            release_payload(p);
+            lock("replay_history");
+        }
+    }
+
+    unlock("replay_history");
+
+    if(count > 0)
+        printn("(%d messages rejoués depuis l'historique)", count);
+    return count;
+}
+
+/*******************/
+/*   Maintenance   */
+/*******************/
+
+void history_maintenance() {
+    lock("history_maintenance");
+    if( fd >= 0 && unsynced && timer_now() - last_sync >= HISTORY_SYNC_INTERVAL )
+        sync_segment();
+    unlock("history_maintenance");
+}
+
+void close_history() {
+    lock("close_history");
+
+    if(fd >= 0) {
+        commit();
+        sync_segment();
+        close(fd);
+        fd = -1;
+    }
+
+    for(int i = 0; i < segment_count; i++)
+        unmap_segment(&segments[i]);
+    segment_count = 0;
+
+    unlock("close_history");
+
+    destroy_timer(commit_timer);
+    commit_timer = NULL;
+}
+
+/*******************/
+/*   Statistiques  */
+/*******************/
+
+void print_history_stats() {
+    lock("print_history_stats");
+    unsigned long records = 0;
+    for(int i = 0; i < segment_count; i++)
+        records += segments[i].records;
+    int count = segment_count;
+    unsigned long a = appended, w = writes, s = syncs;
+    unlock("print_history_stats");
+
+    printn("Historique: %d segments, %lu enregistrements, %lu ajouts en %lu écritures, %lu synchronisations.",
+           count, records, a, w, s);
+}
@@ -0,0 +1,62 @@
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include "payload.h"
+
+#include <stdint.h>
+
+/*
+ * Journal de l'historique des donnees recues, en ajout seul, decoupe en
+ * segments de taille fixe projetes en memoire pour la lecture. Les
+ * enregistrements sont ecrits par lots (un seul write par lot), et chaque
+ * segment a un index (emetteur, nonce) -> position. Au-dela de
+ * HISTORY_SEGMENTS segments, le plus ancien est supprime.
+ */
+
+// Nombre maximal de segments gardes sur le disque.
+#define HISTORY_SEGMENTS 8
+
+/*
+ * Ouvre (ou cree) le journal dans le dossier 'dir' et reconstruit les
+ * index des segments existants. Renvoie 1 si le journal est utilisable et
+ * 0 sinon (l'historique est alors desactive).
+ */
+short open_history(const char* dir);
+
+/*
+ * Reaffiche les dernieres donnees du journal (au plus max) et les remet
+ * dans la liste des donnees recues. A appeler avant restore_snapshot().
+ * Renvoie le nombre de donnees rejouees.
+ */
+int replay_history(int max);
+
+/*
+ * Ajoute la donnee (sender,nonce) au lot en cours, ecrit dans le journal
+ * quelques dizaines de ms plus tard avec les suivantes. Sans effet si le
+ * journal est ferme.
+ */
+void history_append(uint64_t sender, uint32_t nonce, uint8_t type, struct payload* p);
+
+/*
+ * Cherche la donnee (sender,nonce) dans le journal. Renvoie son contenu
+ * (une nouvelle reference, a relacher) et stocke son type dans *type, ou
+ * renvoie NULL si elle n'y est pas.
+ */
+struct payload* history_lookup(uint64_t sender, uint32_t nonce, uint8_t* type);
+
+/*
+ * Force sur le disque ce qui a ete ecrit (au plus une fois par seconde).
+ */
+void history_maintenance();
+
+/*
+ * Ecrit le lot en cours et ferme le journal.
+ */
+void close_history();
+
+/*
+ * Affiche le nombre de segments, d'enregistrements et d'ecritures.
+ */
+void print_history_stats();
+
+#endif /* HISTORY_H */
@@ -29,3 +29,7 @@ void generate_id() {
 uint64_t get_my_id() {
     return my_id;
 }
+
+void set_my_id(uint64_t id) {
+    my_id = id;
+}
@@ -13,4 +13,9 @@ void generate_id();
  */
 uint64_t get_my_id();
 
+/*
+ * Remplace l'id stocke (restauration d'un snapshot).
+ */
+void set_my_id(uint64_t id);
+
 #endif /* IDGENERATOR_H */
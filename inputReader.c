@@ -2,11 +2,28 @@
 
 #include "neighbourManager.h"
 #include "dataManager.h"
+#include "fragment.h"
+#include "rateLimiter.h"
+#include "sendQueue.h"
+#include "socketMonitor.h"
+#include "timerWheel.h"
+#include "epoch.h"
+#include "payload.h"
+#include "history.h"
+#include "catchup.h"
+#include "reconcile.h"
+#include "pipeline.h"
+#include "spsc.h"
+#include "config.h"
+#include "congestion.h"
 
 #include <stdarg.h>
 #include <string.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
 
 #include <time.h>
 #include <ctype.h>
@@ -17,8 +34,6 @@
 #include <fcntl.h>
 #include <termios.h>
 
-#define INPUT_TIMEOUT 5
-
 #define INPUT_LEN 200
 static char input[INPUT_LEN] = {0};
 static int input_index = 0;
@@ -26,16 +41,56 @@ static int input_index = 0;
 #define NAME_LEN 16
 static char name[NAME_LEN] = {0};
 
+static struct timer* input_timer = NULL;
+
+// 1 tant que la ligne d'entree est affichee.
+static short typing = 0;
+
+// Lignes a afficher par l'etage d'affichage (produites par la boucle
+// principale seulement).
+struct line {
+    FILE* f;
+    char text[];
+};
+
+static struct spsc* lines = NULL;
+static pthread_t producer;
+// Lignes mises dans la file et lignes affichees (cf. close_inputReader).
+static unsigned long pushed = 0;
+static atomic_ulong written = 0;
+
+// Etat du terminal avant le passage en lecture caractere par caractere.
+static struct termios saved_term;
+static short term_saved = 0;
+
+// L'ecran (et la ligne d'entree qui y est reaffichee) est partage entre
+// l'etage d'affichage et les autres threads.
+static pthread_mutex_t screen = PTHREAD_MUTEX_INITIALIZER;
 
 /*******************/
-/*     General     */
+/*       Lock      */
 /*******************/
 
-static int read_char() {
+static void lock(const char* func_name) {
+    if( pthread_mutex_lock(&screen) != 0 ) {
+        perror(func_name);
+        exit(EXIT_FAILURE);
+    }
+}
 
-    int c = getchar();
-    
-    if(c == EOF) return c; 
+static void unlock(const char* func_name) {
+    if( pthread_mutex_unlock(&screen) != 0 ) {
+        perror(func_name);
+        exit(EXIT_FAILURE);
+    }
+}
+
+
+/*******************/
+/*     General     */
+/*******************/
+
+static void add_char(int c) {
     if( c == 127 ) {
         if(input[input_index] == '\0' && input_index > 0)
             input_index--;
@@ -45,6 +100,15 @@ static int read_char() {
         input[input_index++] = c;
         input[input_index] = '\0';
     }
+}
+
+// Lecture sans tampon de stdio: poll() doit voir tout ce qui reste a lire.
+static int read_char() {
+    uint8_t c;
+    if( read(STDIN_FILENO, &c, 1) != 1 )
+        return EOF;
+
+    add_char(c);
     return c;
 }
 
@@ -58,6 +122,31 @@ static void print_waiting() {
     fflush(stdout);
 }
 
+// Remet la ligne d'entree (ou le message d'attente) apres un affichage.
+static void print_status() {
+    if(typing)
+        print_input();
+    else
+        print_waiting();
+}
+
+// Sans entree depuis input_timeout s (cf. config.h), on affiche le message d'attente
+// (sauf si une ligne est en cours).
+static void input_timeout(void* arg) {
+    (void)arg;
+
+    lock("input_timeout");
+    short pending = input[0] != '\0';
+    if(!pending) {
+        typing = 0;
+        print_waiting();
+    }
+    unlock("input_timeout");
+
+    if(pending)
+        schedule_timer(input_timer, config_get(CONFIG_INPUT_TIMEOUT) * 1000);
+}
+
 /********************/
 /*  Initialisation  */
 /********************/
@@ -107,117 +196,239 @@ void init_inputReader() {
     name[NAME_LEN-1] = '\0';
     memset(start, 0, NAME_LEN);
     input_index = 0;
+
+    // Lecture caractere par caractere a partir de maintenant.
+    struct termios term;
+    if( tcgetattr(STDIN_FILENO, &term) == 0 ) {
+        saved_term = term;
+        term_saved = 1;
+        term.c_lflag &= ~ICANON;
+        term.c_cc[VMIN] = 0;
+        term.c_cc[VTIME] = 0;
+        tcsetattr(STDIN_FILENO, TCSANOW, &term);
+    }
+
+    if(input_timer == NULL)
+        input_timer = create_timer(input_timeout, NULL);
 }
 
 
 /*******************/
-/*     Lecture     */
+/*    Commandes    */
 /*******************/
 
-void read_input() {
-    int rc;
+// Envoie le contenu du fichier 'path' (fragmente si necessaire).
+static void send_file(const char* path) {
+    FILE* f = fopen(path, "r");
+    if(f == NULL) {
+        fprintn(stderr, "Impossible d'ouvrir le fichier '%s'.", path);
+        return;
+    }
 
-    print_input();
-    
-    struct termios term;
+    uint8_t* buf = malloc(FRAGMENT_MAX_PAYLOAD);
+    if(buf == NULL) {
+        fprintf(stderr, "malloc() failed.");
+        exit(1);
+    }
 
-    tcgetattr(0, &term);
-    term.c_lflag &= ~ICANON;
-    term.c_cc[VMIN] = 0;
-    term.c_cc[VTIME] = 0;
-    tcsetattr(0, TCSANOW, &term);
-    
-    int c;
-    int oto = time(NULL) + INPUT_TIMEOUT;
-    int to;
-    
- again:
+    size_t len = snprintf((char*)buf, FRAGMENT_MAX_PAYLOAD, "%s : ", name);
+    len += fread(buf+len, 1, FRAGMENT_MAX_PAYLOAD-len, f);
 
-    to = oto - time(NULL);
+    // Tampon plein: le fichier n'est trop grand que s'il reste un octet
+    // (feof n'est vrai qu'apres une lecture incomplete).
+    if( len == FRAGMENT_MAX_PAYLOAD && fgetc(f) != EOF )
+        fprintn(stderr, "Le fichier '%s' est trop grand (maximum %d octets).", path, FRAGMENT_MAX_PAYLOAD);
+    else if( ferror(f) )
+        fprintn(stderr, "Impossible de lire le fichier '%s'.", path);
+    else
+        add_my_data(buf, len);
 
-    fd_set readfds;
-    
-    FD_ZERO(&readfds);
-    FD_SET(STDIN_FILENO, &readfds);
-    struct timeval tv = {to, 0};
-    rc = select(STDIN_FILENO + 1, &readfds, NULL, NULL, &tv);
-    if(rc < 0) {
-        perror("select");
-        exit(1);
+    fclose(f);
+    free(buf);
+}
+
+// Execute la commande contenue dans line. Renvoie 0 si ce n'est pas une commande.
+static short run_command(const char* line) {
+    if( strncmp(line, "/fichier ", 9) == 0 ) {
+        send_file(line+9);
+        return 1;
     }
-    if(rc > 0) {
-        if(FD_ISSET(STDIN_FILENO, &readfds)) {
-            
-            // réponse bien reçue, on peut la gérer
 
-            c = read_char();
+    if( strcmp(line, "/stats") == 0 ) {
+        print_neighbour_stats();
+        print_rate_limit_stats();
+        print_send_queue_stats();
+        print_congestion_stats();
+        print_socket_stats();
+        print_timer_stats();
+        print_epoch_stats();
+        print_payload_stats();
+        print_history_stats();
+        print_catchup_stats();
+        print_reconcile_stats();
+        print_pipeline_stats();
+        if(lines != NULL)
+            print_spsc_stats(lines);
+        print_config();
+        return 1;
+    }
 
-            if(c != '\n') {
-                print_input();
-                goto again;
-            }
+    return 0;
+}
 
+/*******************/
+/*     Lecture     */
+/*******************/
+
+// Envoie (ou execute) la ligne entree.
+static void send_input(const char* line) {
+    if( !run_command(line) && strlen(line) > 1 ) {
+        int size = strlen(name) + 3 + strlen(line);
+        uint8_t buf[size];
+        snprintf((char*)buf, size, "%s : %s", name, line);
+        buf[size-1] = line[strlen(line)-1];
+        
+        add_my_data(buf, size);
+    }
+}
+
+short read_input() {
+    uint8_t buf[INPUT_LEN];
+
+    int rc = read(STDIN_FILENO, buf, sizeof(buf));
+    if(rc < 0 && (errno == EINTR || errno == EAGAIN))
+        return 1;
+    if(rc <= 0)
+        return 0;
+
+    for(int i = 0; i < rc; i++) {
+        char line[INPUT_LEN];
+        short complete = 0;
+
+        // La ligne est envoyee hors du verrou: elle peut afficher.
+        lock("read_input");
+        add_char(buf[i]);
+        if(buf[i] == '\n') {
             fprintf(stdout, "\033[2K\033[50D");
             fflush(stdout);
-
-            if(strlen(input) > 1) {
-                int size = strlen(name) + 3 + strlen(input);
-                uint8_t buf[size];
-                snprintf((char*)buf, size, "%s : %s", name, input);
-                buf[size-1] = input[strlen(input)-1];
-                
-                add_my_data(buf, size);
-            }
-                
-            memset(input, 0, strlen(input));
+            memcpy(line, input, INPUT_LEN);
+            memset(input, 0, INPUT_LEN);
             input_index = 0;
-            return;
-            
-        } else {
-            fprintf(stderr, "FD_ISSET : Descripteur de fichier inattendu.\n");
-            exit(1);
-        }
-    } else {
-        // timeout
-                
-        if(input[0] != '\0') {
-
-            start_hello_sender();
-            symetrics_maintenance();
-            
-            oto = time(NULL) + INPUT_TIMEOUT;
-            goto again;
+            complete = 1;
         }
+        unlock("read_input");
 
-        print_waiting();
-        
-        return;
+        if(complete)
+            send_input(line);
     }
-            
+
+    schedule_timer(input_timer, config_get(CONFIG_INPUT_TIMEOUT) * 1000);
+
+    lock("read_input");
+    typing = 1;
+    print_input();
+    unlock("read_input");
+    return 1;
 }
 
 /***************/
 /*    Print    */
 /***************/
 
-void fprintn(FILE* f, const char* format, ...) {
+// Ecrit la ligne et remet la ligne d'entree. Verrou pris.
+static void write_line(FILE* f, const char* text) {
     fprintf(f, "\033[2K\033[50D");
     fflush(f);
+    fprintf(f, "%s\n", text);
+    print_status();
+}
+
+static void* output_stage(void* arg) {
+    (void)arg;
+
+    while(1) {
+        struct line* l = spsc_pop_wait(lines, -1);
+        if(l == NULL)
+            continue;
+
+        lock("output_stage");
+        write_line(l->f, l->text);
+        unlock("output_stage");
+        free(l);
+        atomic_fetch_add(&written, 1);
+    }
+
+    return NULL;
+}
+
+void start_output() {
+    lines = create_spsc("affichage", PIPELINE_DEPTH);
+    producer = pthread_self();
+
+    pthread_t thread;
+    int rc = pthread_create(&thread, NULL, output_stage, NULL);
+    if(rc != 0) {
+        fprintf(stderr, "Error: Thread create\n");
+        exit(EXIT_FAILURE);
+    }
+
+    pthread_detach(thread);
+}
+
+// Les lignes de la boucle principale passent par l'etage d'affichage (qui
+// les garde dans l'ordre), celles des autres threads sont ecrites tout de suite.
+static void output(FILE* f, const char* format, va_list vargs) {
+    va_list copy;
+    va_copy(copy, vargs);
+    int len = vsnprintf(NULL, 0, format, copy);
+    va_end(copy);
+    if(len < 0)
+        return;
+
+    struct line* l = malloc(sizeof(struct line) + len + 1);
+    if(l == NULL) {
+        fprintf(stderr, "malloc() failed.");
+        exit(1);
+    }
+
+    l->f = f;
+    vsnprintf(l->text, len + 1, format, vargs);
+
+    if( lines != NULL && pthread_equal(pthread_self(), producer) ) {
+        spsc_push_wait(lines, l);
+        pushed++;
+        return;
+    }
+
+    lock("output");
+    write_line(l->f, l->text);
+    unlock("output");
+    free(l);
+}
+
+void close_inputReader() {
+    for(int i = 0; i < 1000 && lines != NULL && atomic_load(&written) < pushed; i++)
+        usleep(1000);
+
+    lock("close_inputReader");
+    typing = 0;
+    fprintf(stdout, "\033[2K\033[50D");
+    fflush(stdout);
+    if(term_saved)
+        tcsetattr(STDIN_FILENO, TCSANOW, &saved_term);
+    unlock("close_inputReader");
+}
+
+void fprintn(FILE* f, const char* format, ...) {
     va_list vargs;
     va_start(vargs, format);
-    vfprintf(f, format, vargs);
+    output(f, format, vargs);
     va_end(vargs);
-    fprintf(f, "\n");
-    print_waiting();
 }
 
 void printn(const char* format, ...) {
-    fprintf(stdout, "\033[2K\033[50D");
-    fflush(stdout);
     va_list vargs;
     va_start(vargs, format);
-    vfprintf(stdout, format, vargs);
+    output(stdout, format, vargs);
     va_end(vargs);
-    fprintf(stdout, "\n");
-    print_waiting();
 }
@@ -9,11 +9,24 @@
 void init_inputReader();
 
 /*
- * Lit une entree. Reste disponible pendant quelques secondes
- * et disparait temporairement si il n'y a eu aucune entree. 
- * (Pour ne pas bloquer le protocole)
+ * Demarre l'etage d'affichage: les lignes ecrites ensuite par ce thread
+ * (printn, fprintn) sont affichees par un thread dedie, dans l'ordre.
  */
-void read_input();
+void start_output();
+
+/*
+ * Attend (au plus une seconde) que les lignes en attente soient affichees,
+ * efface la ligne d'entree et remet le terminal dans son etat initial.
+ */
+void close_inputReader();
+
+/*
+ * Lit les caracteres disponibles sur l'entree standard (a appeler quand
+ * elle est lisible, ne bloque pas) et envoie les lignes terminees.
+ * La ligne d'entree disparait si il n'y a eu aucune entree depuis quelques
+ * secondes. Renvoie 0 si l'entree standard est fermee.
+ */
+short read_input();
 
 /*
  * Equivalent de fprintf mais avec un '\n' a la fin. (Et compatible avec inputReader)
@@ -0,0 +1,495 @@
+#include "message.h"
+#include "tlv.h"
+#include "dataManager.h"
+
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+
+/*
+ * Generateur de charge: un ou plusieurs pairs synthetiques (une socket
+ * chacun) se presentent a un noeud cible, deviennent ses voisins
+ * symetriques, puis lui envoient des donnees au debit et a la taille
+ * demandes. Ils acquittent tout ce que la cible leur inonde et mesurent
+ * la latence des acquittements, les pertes et le debit que la cible absorbe.
+ */
+
+#define MAX_PEERS 256
+
+// Donnees envoyees dont on attend l'acquittement, par pair.
+#define SENT_WINDOW 16384
+
+// Latences gardees pour les percentiles.
+#define MAX_SAMPLES (1 << 20)
+
+#define HELLO_INTERVAL 10
+#define HANDSHAKE_TIMEOUT 10
+#define DRAIN_TIME 2
+
+// Nombre maximal de donnees envoyees d'un coup.
+#define SEND_BURST 256
+
+#define DATAGRAM_LEN 4096
+
+struct sent {
+    uint32_t nonce;
+    short acked;
+    uint64_t at;                // Date d'envoi (us), 0 si la case est libre.
+};
+
+struct peer {
+    int sock;
+    uint64_t id;
+    uint64_t target_id;
+    short symmetric;
+    uint32_t nonce;
+    struct sent sent[SENT_WINDOW];
+};
+
+static struct peer* peers;
+static int peer_count = 1;
+static struct sockaddr_in6 target;
+
+// Parametres de la charge.
+static double rate = 100;       // Donnees par seconde,
+static double step = 0;         // augmente de step chaque seconde.
+static int min_size = 64;
+static int max_size = 64;
+static int duration = 10;
+static uint8_t data_type = 0;
+
+// Mesures.
+static unsigned long sent_count = 0;
+static unsigned long sent_bytes = 0;
+static unsigned long acked_count = 0;
+static unsigned long late_acks = 0;
+static unsigned long overwritten = 0;
+static unsigned long flooded = 0;
+static unsigned long go_aways = 0;
+
+static uint64_t* samples;
+static unsigned long sample_count = 0;
+static double latency_sum = 0;
+
+static unsigned long second_sent = 0;
+static unsigned long second_acked = 0;
+static double second_latency = 0;
+
+/*******************/
+/*      Outils     */
+/*******************/
+
+static uint64_t now_us() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+static uint64_t random64() {
+    return ((uint64_t)random() << 33) ^ ((uint64_t)random() << 11) ^ (uint64_t)random();
+}
+
+static void send_to_target(struct peer* p, struct msg* m) {
+    uint8_t buffer[DATAGRAM_LEN];
+    int len = msg_to_data(m, buffer);
+
+    if( sendto(p->sock, buffer, len, 0, (struct sockaddr*)&target, sizeof(target)) < 0
+        && errno != EAGAIN && errno != EWOULDBLOCK )
+        perror("sendto");
+}
+
+static void send_hello(struct peer* p) {
+    struct msg* m = create_msg();
+    if(p->target_id != 0)
+        add_hello_long_tlv(m, p->id, p->target_id);
+    else
+        add_hello_short_tlv(m, p->id);
+    send_to_target(p, m);
+    destroy_msg(m);
+}
+
+/*******************/
+/*     Reception   */
+/*******************/
+
+struct reception {
+    struct peer* peer;
+    struct msg* acks;
+    short has_acks;
+};
+
+static void on_ack(struct peer* p, uint32_t nonce) {
+    struct sent* s = &p->sent[nonce % SENT_WINDOW];
+    if(s->at == 0 || s->nonce != nonce || s->acked) {
+        late_acks++;
+        return;
+    }
+
+    s->acked = 1;
+    acked_count++;
+    second_acked++;
+
+    double latency = now_us() - s->at;
+    latency_sum += latency;
+    second_latency += latency;
+    if(sample_count < MAX_SAMPLES)
+        samples[sample_count++] = now_us() - s->at;
+}
+
+static void on_tlv(struct tlv* t, void* arg) {
+    struct reception* r = (struct reception*)arg;
+    struct peer* p = r->peer;
+
+    switch( get_tlv_type(t) ) {
+    case HELLO:
+        // Premier hello de la cible: on connait son id, on repond en long.
+        if(p->target_id != get_source_id(t)) {
+            p->target_id = get_source_id(t);
+            send_hello(p);
+        }
+        if(get_destination_id(t) == p->id)
+            p->symmetric = 1;
+        break;
+
+    case DATA:
+        add_ack_tlv(r->acks, get_source_id(t), get_nonce(t));
+        r->has_acks = 1;
+        if(get_source_id(t) != p->id)
+            flooded++;
+        break;
+
+    case ACK:
+        if(get_source_id(t) == p->id)
+            on_ack(p, get_nonce(t));
+        break;
+
+    case GO_AWAY:
+        // La cible nous a oublies: on se represente.
+        go_aways++;
+        p->symmetric = 0;
+        p->target_id = 0;
+        send_hello(p);
+        break;
+    }
+}
+
+static void receive(struct peer* p) {
+    uint8_t buffer[DATAGRAM_LEN];
+
+    while(1) {
+        int len = recv(p->sock, buffer, sizeof(buffer), 0);
+        if(len < 0) {
+            if(errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+                perror("recv");
+            return;
+        }
+
+        struct msg* m = data_to_msg(buffer, len);
+        if(m == NULL)
+            continue;
+
+        struct reception r = { p, create_msg(), 0 };
+        for_each_tlv(m, on_tlv, &r);
+        if(r.has_acks)
+            send_to_target(p, r.acks);
+
+        destroy_msg(r.acks);
+        destroy_msg(m);
+    }
+}
+
+static void receive_all(struct pollfd fds[], int timeout) {
+    if( poll(fds, peer_count, timeout) <= 0 )
+        return;
+
+    for(int i = 0; i < peer_count; i++)
+        if(fds[i].revents & POLLIN)
+            receive(&peers[i]);
+}
+
+/*******************/
+/*      Envoi      */
+/*******************/
+
+static void send_data(struct peer* p) {
+    int size = min_size + (max_size > min_size ? random() % (max_size - min_size + 1) : 0);
+    uint8_t content[MAX_DATA_LEN];
+    for(int i = 0; i < size; i++)
+        content[i] = 'a' + random() % 26;
+
+    uint32_t nonce = ++p->nonce;
+    struct sent* s = &p->sent[nonce % SENT_WINDOW];
+    if(s->at != 0 && !s->acked)
+        overwritten++;
+    s->nonce = nonce;
+    s->acked = 0;
+    s->at = now_us();
+
+    struct msg* m = create_msg();
+    add_data_tlv(m, p->id, nonce, data_type, content, size);
+    send_to_target(p, m);
+    destroy_msg(m);
+
+    sent_count++;
+    second_sent++;
+    sent_bytes += size;
+}
+
+/*******************/
+/*     Rapport     */
+/*******************/
+
+static int compare(const void* a, const void* b) {
+    uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+static double percentile(double q) {
+    if(sample_count == 0)
+        return 0;
+    return samples[(unsigned long)(q * (sample_count - 1))] / 1000.0;
+}
+
+static void report(double elapsed) {
+    unsigned long lost = sent_count - acked_count;
+    qsort(samples, sample_count, sizeof(uint64_t), compare);
+
+    printf("\n");
+    printf("Envoyées:    %lu données (%.1f Ko), en %.1f s.\n", sent_count, sent_bytes / 1024.0, elapsed);
+    printf("Acquittées:  %lu (%.2f %%), perdues: %lu.\n",
+           acked_count, sent_count > 0 ? 100.0 * acked_count / sent_count : 0, lost);
+    printf("Débit absorbé par la cible: %.1f données/s.\n", elapsed > 0 ? acked_count / elapsed : 0);
+    printf("Latence des acquittements (ms): moyenne %.2f, p50 %.2f, p90 %.2f, p99 %.2f, max %.2f.\n",
+           acked_count > 0 ? latency_sum / acked_count / 1000.0 : 0,
+           percentile(0.5), percentile(0.9), percentile(0.99), percentile(1));
+    printf("Inondation: %lu données des autres pairs reçues (et acquittées).\n", flooded);
+    if(late_acks > 0 || overwritten > 0)
+        printf("Acquittements en double ou tardifs: %lu, données oubliées sans acquittement: %lu.\n",
+               late_acks, overwritten);
+    printf("GoAway reçus: %lu.\n", go_aways);
+}
+
+/*******************/
+/*  Initialisation */
+/*******************/
+
+static int open_peer_socket() {
+    int s = socket(AF_INET6, SOCK_DGRAM, 0);
+    if(s < 0) {
+        perror("socket");
+        exit(1);
+    }
+
+    int zero = 0;
+    setsockopt(s, IPPROTO_IPV6, IPV6_V6ONLY, &zero, sizeof(zero));
+
+    int size = 1 << 20;
+    setsockopt(s, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+
+    if( fcntl(s, F_SETFL, fcntl(s, F_GETFL) | O_NONBLOCK) < 0 ) {
+        perror("fcntl");
+        exit(1);
+    }
+
+    return s;
+}
+
+static short parse_range(const char* arg, double* a, double* b) {
+    char* end;
+    *a = strtod(arg, &end);
+    if(end == arg)
+        return 0;
+    if(*end == '\0')
+        return 1;
+    if(*end != ':')
+        return 0;
+
+    const char* second = end + 1;
+    *b = strtod(second, &end);
+    return end != second && *end == '\0';
+}
+
+static void usage(const char* name) {
+    fprintf(stderr, "Usage: %s [-n pairs] [-r débit[:pas]] [-s taille[:max]] [-d durée] [-t type] <ip> <port>\n", name);
+}
+
+/**************/
+/*    Main    */
+/**************/
+
+int main(int argc, char* args[]) {
+    int opt;
+    double a, b;
+    while( (opt = getopt(argc, args, "n:r:s:d:t:")) != -1 ) {
+        switch(opt) {
+        case 'n':
+            peer_count = atoi(optarg);
+            if(peer_count <= 0 || peer_count > MAX_PEERS) {
+                fprintf(stderr, "Nombre de pairs invalide (1 à %d).\n", MAX_PEERS);
+                return 1;
+            }
+            break;
+        case 'r':
+            b = 0;
+            if( !parse_range(optarg, &a, &b) || a <= 0 || b < 0 ) {
+                usage(args[0]);
+                return 1;
+            }
+            rate = a;
+            step = b;
+            break;
+        case 's':
+            b = -1;
+            if( !parse_range(optarg, &a, &b) || a < 0 || a > MAX_DATA_LEN || b > MAX_DATA_LEN ) {
+                fprintf(stderr, "Taille invalide (au plus %d octets).\n", MAX_DATA_LEN);
+                return 1;
+            }
+            min_size = (int)a;
+            max_size = b < 0 ? min_size : (int)b;
+            if(max_size < min_size) {
+                usage(args[0]);
+                return 1;
+            }
+            break;
+        case 'd':
+            duration = atoi(optarg);
+            if(duration <= 0) {
+                usage(args[0]);
+                return 1;
+            }
+            break;
+        case 't':
+            data_type = atoi(optarg);
+            break;
+        default:
+            usage(args[0]);
+            return 1;
+        }
+    }
+
+    if(argc - optind != 2) {
+        usage(args[0]);
+        return 1;
+    }
+
+    memset(&target, 0, sizeof(target));
+    target.sin6_family = AF_INET6;
+    target.sin6_port = htons(atoi(args[optind+1]));
+    if( inet_pton(AF_INET6, args[optind], &target.sin6_addr) != 1 ) {
+        fprintf(stderr, "Adresse invalide : %s\n", args[optind]);
+        return 1;
+    }
+
+    peers = calloc(peer_count, sizeof(struct peer));
+    samples = malloc(MAX_SAMPLES * sizeof(uint64_t));
+    struct pollfd* fds = calloc(peer_count, sizeof(struct pollfd));
+    if(peers == NULL || samples == NULL || fds == NULL) {
+        fprintf(stderr, "malloc() failed.");
+        exit(1);
+    }
+
+    srandom(time(NULL) ^ getpid());
+    for(int i = 0; i < peer_count; i++) {
+        peers[i].sock = open_peer_socket();
+        peers[i].id = random64();
+        fds[i].fd = peers[i].sock;
+        fds[i].events = POLLIN;
+    }
+
+    // Poignee de main: hellos jusqu'a ce que tous soient symetriques.
+    uint64_t start = now_us();
+    uint64_t last_hello = 0;
+    int symmetrics = 0;
+    while(symmetrics < peer_count && now_us() - start < HANDSHAKE_TIMEOUT * 1000000ULL) {
+        if(now_us() - last_hello >= 1000000) {
+            last_hello = now_us();
+            for(int i = 0; i < peer_count; i++)
+                if(!peers[i].symmetric)
+                    send_hello(&peers[i]);
+        }
+
+        receive_all(fds, 100);
+
+        symmetrics = 0;
+        for(int i = 0; i < peer_count; i++)
+            symmetrics += peers[i].symmetric;
+    }
+
+    if(symmetrics == 0) {
+        fprintf(stderr, "La cible n'a répondu à aucun pair.\n");
+        return 1;
+    }
+
+    printf("%d/%d pairs symétriques en %.0f ms. Charge: %.0f données/s", symmetrics, peer_count,
+           (now_us() - start) / 1000.0, rate);
+    if(step > 0)
+        printf(" (+%.0f chaque seconde)", step);
+    printf(", %d à %d octets, pendant %d s.\n", min_size, max_size, duration);
+
+    // Charge: on envoie a tour de role depuis chaque pair symetrique.
+    start = now_us();
+    last_hello = start;
+    uint64_t last_tick = start;
+    uint64_t last_second = start;
+    double budget = 0;
+    int next_peer = 0;
+    int second = 0;
+
+    while(now_us() - start < (uint64_t)duration * 1000000) {
+        uint64_t now = now_us();
+        budget += (rate + step * second) * (now - last_tick) / 1e6;
+        last_tick = now;
+
+        for(int k = 0; budget >= 1 && k < SEND_BURST; k++) {
+            for(int i = 0; i < peer_count && !peers[next_peer].symmetric; i++)
+                next_peer = (next_peer + 1) % peer_count;
+            if(peers[next_peer].symmetric)
+                send_data(&peers[next_peer]);
+            next_peer = (next_peer + 1) % peer_count;
+            budget--;
+        }
+
+        if(now - last_hello >= HELLO_INTERVAL * 1000000ULL) {
+            last_hello = now;
+            for(int i = 0; i < peer_count; i++)
+                send_hello(&peers[i]);
+        }
+
+        if(now - last_second >= 1000000) {
+            last_second += 1000000;
+            second++;
+            printf("%4ds  offertes %7lu/s  acquittées %7lu/s  latence moy. %8.2f ms  en vol %lu\n",
+                   second, second_sent, second_acked,
+                   second_acked > 0 ? second_latency / second_acked / 1000.0 : 0,
+                   sent_count - acked_count);
+            fflush(stdout);
+            second_sent = 0;
+            second_acked = 0;
+            second_latency = 0;
+        }
+
+        receive_all(fds, 1);
+    }
+
+    double elapsed = (now_us() - start) / 1e6;
+
+    // Derniers acquittements.
+    uint64_t drain = now_us();
+    while(now_us() - drain < DRAIN_TIME * 1000000ULL)
+        receive_all(fds, 100);
+
+    report(elapsed);
+    return 0;
+}
@@ -3,6 +3,10 @@
 #include "info.h"
 #include "inputReader.h"
 #include "neighbourManager.h"
+#include "mpr.h"
+#include "rateLimiter.h"
+#include "sendQueue.h"
+#include "socketMonitor.h"
 
 #include <assert.h>
 #include <malloc.h>
@@ -13,7 +17,6 @@
 
 #define MAGIC 93
 #define VERSION 2
-#define MAX_RECEIVED 4096
 
 static int debug = 0;
 
@@ -78,12 +81,37 @@ struct msg* create_msg() {
     return m;
 }
 
+static void add_tlv(struct msg* m, struct tlv* t);
+
+// Renvoie 1 si un tlv de type 'type' peut avoir un corps de 'len' octets:
+// les tailles fixes sont des minimums.
+static short valid_length(uint8_t type, uint8_t len) {
+    switch(type) {
+    case 2:
+        return len == 8 || len >= 16;
+    case 3:
+        return len >= 18;
+    case 4:
+        return len >= 13;
+    case 5:
+    case 9:
+        return len >= 12;
+    case 6:
+        return len >= 1;
+    default:
+        return 1;
+    }
+}
+
 struct msg* data_to_msg(uint8_t* data, size_t len) {
     if(len < 4 || data[0] != MAGIC || data[1] != VERSION || ntohs(((uint16_t*)data)[1]) != len-4 ) {
         
         if(debug) {
             if(debug) printn("Message incorrect: ");
-            if(len < 4) printn("len < 4 (%ld)", len);
+            if(len < 4) {
+                printn("len < 4 (%ld)", len);
+                return NULL;
+            }
             if(data[0] != MAGIC) printn("data[0] != MAGIC (%d != %d)", data[0], MAGIC);
             if(data[1] != VERSION) printn("data[1] != VERSION (%d != %d)", data[1], VERSION);
             if(ntohs(((uint16_t*)data)[1]) != len-4) printn("ntohs(((uint16_t*)data)[1]) != len-4 (%d != %ld)", ((uint16_t*)data)[1], len-4);
@@ -94,10 +122,23 @@ struct msg* data_to_msg(uint8_t* data, size_t len) {
 
     struct msg* m = create_msg();
     uint8_t* ptr = data+4;
+    uint8_t* end = data+len;
+
+    uint8_t dlen, type;
+    int count;
+    uint64_t ids[MAX_IHAVE];
+    uint32_t nonces[MAX_IHAVE];
+    uint32_t stamp;
+    uint16_t hold;
+
+    while( ptr < end ) {
+        // Un tlv qui deborde du datagramme rend le message invalide.
+        if( *ptr != 0 && (end - ptr < 2 || end - ptr - 2 < ptr[1] || !valid_length(ptr[0], ptr[1])) ) {
+            if(debug) printn("[TLV] Tlv %d tronqué ou de taille invalide.", *ptr);
+            destroy_msg(m);
+            return NULL;
+        }
 
-    uint8_t dlen;
-
-    while( (ptr-data) < len) {
         switch( *ptr ) {
         case 0:
             ptr++;
@@ -152,11 +193,63 @@ struct msg* data_to_msg(uint8_t* data, size_t len) {
             add_warning_tlv(m, ptr, dlen);
             ptr += dlen;
             break;
+
+        case 8:
+        case 12:
+        case 13:
+            type = ptr[0];
+            dlen = ptr[1];
+            ptr +=2;
+            count = dlen / 12 < MAX_IHAVE ? dlen / 12 : MAX_IHAVE;
+            for(int i = 0; i < count; i++) {
+                memcpy(&ids[i], ptr + i*12, 8);
+                memcpy(&nonces[i], ptr + i*12 + 8, 4);
+            }
+            add_tlv(m, create_id_list_tlv(type, ids, nonces, count));
+            ptr += dlen;
+            break;
+
+        case 9:
+            ptr +=2;
+            add_graft_tlv(m, ((uint64_t*)ptr)[0], ((uint32_t*)ptr)[2]);
+            ptr += 12;
+            break;
+
+        case 10:
+            add_prune_tlv(m);
+            ptr += 2 + ptr[1];
+            break;
+
+        case 11:
+            add_relay_tlv(m, ptr[1] > 0 ? ptr[2] : 0);
+            ptr += 2 + ptr[1];
+            break;
+
+        case 14:
+            dlen = ptr[1];
+            count = dlen > 0 ? (dlen - 1) / SKETCH_CELL_SIZE : 0;
+            if(count > MAX_SKETCH_CELLS)
+                count = MAX_SKETCH_CELLS;
+            if(count > 0)
+                add_sketch_tlv(m, ptr[2], ptr+3, count);
+            ptr += 2 + dlen;
+            break;
+
+        case 15:
+            dlen = ptr[1];
+            if(dlen >= 7) {
+                memcpy(&stamp, ptr+3, 4);
+                memcpy(&hold, ptr+7, 2);
+                add_echo_tlv(m, ptr[2], stamp, hold);
+            }
+            ptr += 2 + dlen;
+            break;
             
         default:
-            fprintn(stderr, "[TLV] Type invalide: %d.", *ptr);
-            destroy_msg(m);
-            return NULL;
+            // Extension inconnue: on l'ignore (sa taille a ete verifiee).
+            if(debug) printn("[TLV] Type inconnu ignoré: %d.", *ptr);
+            ptr += 2 + ptr[1];
+            break;
         }
     }
 
@@ -224,6 +317,10 @@ void add_data_tlv(struct msg* m, uint64_t sender_id, uint32_t nonce, uint8_t typ
     add_tlv(m, create_data_tlv( sender_id, nonce, type, data, data_len));
 }
 
+void add_data_payload_tlv(struct msg* m, uint64_t sender_id, uint32_t nonce, uint8_t type, struct payload* p) {
+    add_tlv(m, create_data_payload_tlv(sender_id, nonce, type, p));
+}
+
 void add_ack_tlv(struct msg* m, uint64_t sender_id, uint32_t nonce) {
     add_tlv(m, create_ack_tlv(sender_id, nonce));
 }
@@ -236,150 +333,168 @@ void add_warning_tlv(struct msg* m, uint8_t* message, size_t message_len) {
     add_tlv(m, create_warning_tlv(message, message_len));
 }
 
+void add_ihave_tlv(struct msg* m, uint64_t ids[], uint32_t nonces[], int count) {
+    add_tlv(m, create_ihave_tlv(ids, nonces, count));
+}
+
+void add_summary_tlv(struct msg* m, uint64_t ids[], uint32_t nonces[], int count) {
+    add_tlv(m, create_id_list_tlv(SUMMARY, ids, nonces, count));
+}
+
+void add_request_tlv(struct msg* m, uint64_t ids[], uint32_t nonces[], int count) {
+    add_tlv(m, create_id_list_tlv(REQUEST, ids, nonces, count));
+}
+
+void add_sketch_tlv(struct msg* m, uint8_t first, const uint8_t* cells, int count) {
+    add_tlv(m, create_sketch_tlv(first, cells, count));
+}
+
+void add_echo_tlv(struct msg* m, uint8_t reply, uint32_t stamp, uint16_t hold) {
+    add_tlv(m, create_echo_tlv(reply, stamp, hold));
+}
+
+void add_graft_tlv(struct msg* m, uint64_t sender_id, uint32_t nonce) {
+    add_tlv(m, create_graft_tlv(sender_id, nonce));
+}
+
+void add_prune_tlv(struct msg* m) {
+    add_tlv(m, create_prune_tlv());
+}
+
+void add_relay_tlv(struct msg* m, uint8_t relay) {
+    add_tlv(m, create_relay_tlv(relay));
+}
 
 /***************************/
 /*           Send          */
 /***************************/
 
-short send_msg(struct msg* m, struct sockaddr *dest, size_t dest_len) {
-    
-    int req_size = m->body_length + 4;
-    uint8_t req[req_size];
-    req[0] = m->magic;
-    req[1] = m->version;
-    ((uint16_t*)req)[1] = htons(m->body_length);
+int get_msg_length(struct msg* m) {
+    return m->body_length + 4;
+}
+
+void for_each_tlv(const struct msg* m, void (*f)(struct tlv*, void*), void* arg) {
+    for(struct tlv_list* aux = m->first_tlv; aux != NULL; aux = aux->next)
+        f(aux->tlv, arg);
+}
+
+int msg_to_data(struct msg* m, uint8_t buffer[]) {
+    buffer[0] = m->magic;
+    buffer[1] = m->version;
+    ((uint16_t*)buffer)[1] = htons(m->body_length);
 
     int pos = 4;
     struct tlv_list* tlvl = m->first_tlv;
     while(tlvl != NULL) {
-        tlv_to_data(tlvl->tlv, req+pos);
+        tlv_to_data(tlvl->tlv, buffer+pos);
         pos += get_tlv_length(tlvl->tlv);
         tlvl = tlvl->next;
     }
 
-    lock("send_msg");
+    return pos;
+}
 
-    int rc;
-    int to = 5;
-    fd_set writefds;
-    int s = get_socket(); 
+// Classe d'envoi deduite des tlvs de m (cf. sendQueue.h).
+static int get_send_class(struct msg* m) {
+    int class = SEND_CONTROL;
+    for(struct tlv_list* aux = m->first_tlv; aux != NULL; aux = aux->next) {
+        uint8_t type = get_tlv_type(aux->tlv);
+        if(type == HELLO)
+            return SEND_LIVENESS;
+        if(type == DATA)
+            class = SEND_DATA;
+    }
+    return class;
+}
 
- again:
+short send_msg_class(struct msg* m, struct sockaddr *dest, size_t dest_len, int class) {
+    struct sockaddr_in6 dest6;
+    memset(&dest6, 0, sizeof(dest6));
+    memcpy(&dest6, dest, dest_len < sizeof(dest6) ? dest_len : sizeof(dest6));
 
-    FD_ZERO(&writefds);
-    FD_SET(s, &writefds);
-    struct timeval tv = {to, 0};
-    rc = select(s + 1, NULL, &writefds, NULL, &tv);
-    if(rc < 0) {
-        perror("select");
-        exit(1);
-    }
-    if(rc > 0) {
-        if(FD_ISSET(s, &writefds)) {
-            
-            // réponse bien reçue, on peut la gérer
-
-            int rc = sendto(get_socket(), req, req_size, 0, dest, dest_len);
-       
-            if( rc < 0) {
-                if(errno == EAGAIN) {
-                    goto again;
-                } else {
-                    perror("send_to");
-                    unlock("send_to");
-                    return 0;
-                }
-            }
-            
-            unlock("receive_msg");
-            return 1;
-            
-        } else {
-            fprintf(stderr, "FD_ISSET : Descripteur de fichier inattendu.\n");
-            exit(1);
-        }
-    }
-    // timeout
-    
-    unlock("send_msg");
-    return 0;
+    // Le message est ecrit directement dans le paquet mis en file.
+    struct packet* p = create_packet(m->body_length + 4, &dest6);
+    msg_to_data(m, packet_data(p));
+
+    return enqueue(p, class);
 }
 
-struct msg* receive_msg(struct sockaddr *dest, socklen_t *dest_len) {
-    
+short send_msg(struct msg* m, struct sockaddr *dest, size_t dest_len) {
+    return send_msg_class(m, dest, dest_len, get_send_class(m));
+}
+
+int send_msg_batch(struct msg* msgs[], struct sockaddr_in6 dests[], int count) {
+    int sent = 0;
+    for(int i = 0; i < count; i++)
+        sent += send_msg(msgs[i], (struct sockaddr*)&dests[i], sizeof(struct sockaddr_in6));
+
+    return sent;
+}
+
+int receive_datagram(uint8_t* data, size_t size, struct sockaddr_in6* from) {
+
     if(debug) printn("Reception d'un message...");
-    
-    uint8_t data[MAX_RECEIVED];
 
-    lock("receive_msg");
+    lock("receive_datagram");
 
-    int rc;
-    int to = 5;
-    fd_set readfds;
     int s = get_socket(); 
 
- again:
-    
-    FD_ZERO(&readfds);
-    FD_SET(s, &readfds);
-    struct timeval tv = {to, 0};
-    rc = select(s + 1, &readfds, NULL, NULL, &tv);
-    if(rc < 0) {
-        perror("select");
-        exit(1);
+    // recvmsg plutot que recvfrom, pour recuperer le compteur de
+    // pertes du noyau (SO_RXQ_OVFL).
+    struct iovec iov = { data, size };
+    uint8_t control[CMSG_SPACE(sizeof(uint32_t))];
+    struct msghdr hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.msg_name = from;
+    hdr.msg_namelen = sizeof(struct sockaddr_in6);
+    hdr.msg_iov = &iov;
+    hdr.msg_iovlen = 1;
+    hdr.msg_control = control;
+    hdr.msg_controllen = sizeof(control);
+
+    // La socket est non bloquante.
+    int rc = recvmsg(s, &hdr, 0);
+                
+    if( rc < 0) {
+        if(errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+            perror("receive_datagram");
+        unlock("receive_datagram");
+        return -1;
     }
-    if(rc > 0) {
-        if(FD_ISSET(s, &readfds)) {
-            
-            // réponse bien reçue, on peut la gérer
-
-            rc = recvfrom(s, data, MAX_RECEIVED, 0, dest, dest_len);
-                        
-            if( rc < 0) {
-                if(errno == EAGAIN) {
-                    goto again;
-                } else {
-                    perror("receive_msg");
-                    unlock("receive_msg");
-                    return NULL;
-                }
-            }
-    
-            if(debug) printn("Message reçu.");
-    
-            unlock("receive_msg");
-
-            struct msg* m = data_to_msg(data, rc);
-            // Si le message a un bon format.
-            if(m != NULL)
-                interpret_msg(m, (struct sockaddr_in6*)dest);
-            // Sinon
-            else {
-                printf("Message invalide.\n");
-                struct msg* goAway3 = create_msg();
-                char goAway_msg[] = "Invalid message";
-                add_goAway_tlv(goAway3, 3, (uint8_t*)goAway_msg, strlen(goAway_msg)-1);
-
-                send_msg(goAway3, dest, *dest_len);
-                struct sockaddr_in6* dest6 = (struct sockaddr_in6*)dest;
-                struct neighbour* n = get_neighbour(((uint128_t*)dest6->sin6_addr.s6_addr)[0], ntohs(dest6->sin6_port));
-                if( n != NULL ) {
-                    remove_from_neighbours(n);
-                    add_potential_neighbour(n);
-                }
-            }
-            
-            return m;
-            
-        } else {
-            fprintf(stderr, "FD_ISSET : Descripteur de fichier inattendu.\n");
-            exit(1);
+
+    if(debug) printn("Message reçu.");
+
+    for(struct cmsghdr* c = CMSG_FIRSTHDR(&hdr); c != NULL; c = CMSG_NXTHDR(&hdr, c))
+        if( c->cmsg_level == SOL_SOCKET && c->cmsg_type == SO_RXQ_OVFL ) {
+            uint32_t drops;
+            memcpy(&drops, CMSG_DATA(c), sizeof(drops));
+            record_rx_drops(drops);
         }
+
+    unlock("receive_datagram");
+    return rc;
+}
+
+void handle_msg(struct msg* m, struct sockaddr_in6* from) {
+    // Si le message a un bon format.
+    if(m != NULL) {
+        interpret_msg(m, from);
+        destroy_msg(m);
+        return;
+    }
+
+    // Sinon
+    printn("Message invalide.");
+    struct msg* goAway3 = create_msg();
+    char goAway_msg[] = "Invalid message";
+    add_goAway_tlv(goAway3, 3, (uint8_t*)goAway_msg, strlen(goAway_msg)-1);
+
+    send_msg(goAway3, (struct sockaddr*)from, sizeof(struct sockaddr_in6));
+    destroy_msg(goAway3);
+    struct neighbour* n = get_neighbour(((uint128_t*)from->sin6_addr.s6_addr)[0], from->sin6_port);
+    if( n != NULL ) {
+        demote_neighbour(n);
     }
-    // timeout
-    
-    unlock("receive_msg");
-    return NULL;
 }
 
 /********************/
@@ -388,8 +503,24 @@ struct msg* receive_msg(struct sockaddr *dest, socklen_t *dest_len) {
 
 
 void interpret_msg(const struct msg* m, struct sockaddr_in6* sockaddr) {
-    
-    // byte ordre pour ip ?
-    for( struct tlv_list* aux = m->first_tlv; aux != NULL; aux = aux->next )
-        interpret_tlv(aux->tlv, ((uint128_t*)sockaddr->sin6_addr.s6_addr)[0], sockaddr->sin6_port) ;
+    struct tlv_list* aux;
+    uint128_t ip = ((uint128_t*)sockaddr->sin6_addr.s6_addr)[0];
+
+    // Tout message d'un voisin montre qu'il est en vie (cf. get_phi).
+    struct neighbour* n = get_neighbour(ip, sockaddr->sin6_port);
+    if(n != NULL)
+        heard_from(n);
+
+    // Les tlvs neighbour d'un message forment la liste complete des voisins
+    // symetriques de l'emetteur: elle remplace la precedente.
+    for( aux = m->first_tlv; aux != NULL; aux = aux->next )
+        if( get_tlv_type(aux->tlv) == NEIGHBOUR ) {
+            clear_two_hop(ip, sockaddr->sin6_port);
+            break;
+        }
+
+    // Les tlvs d'un pair qui a epuise son budget sont ignores.
+    for( aux = m->first_tlv; aux != NULL; aux = aux->next )
+        if( rate_limit(ip, sockaddr->sin6_port, get_tlv_type(aux->tlv)) )
+            interpret_tlv(aux->tlv, ip, sockaddr->sin6_port);
 }
@@ -1,6 +1,8 @@
 #ifndef MESSAGE_H
 #define MESSAGE_H
 
+#include "payload.h"
+
 #include <stdint.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
@@ -8,6 +10,7 @@
 typedef unsigned __int128 uint128_t;
 
 struct msg;
+struct tlv;
 
 /*******************/
 /*  Constructeurs  */
@@ -18,6 +21,12 @@ struct msg;
  */
 struct msg* create_msg();
 
+/*
+ * Decode le datagramme data de longueur len. Renvoie le message, ou NULL
+ * si l'entete est invalide.
+ */
+struct msg* data_to_msg(uint8_t* data, size_t len);
+
 /*******************/
 /*   Destructeurs  */
 /*******************/
@@ -27,6 +36,20 @@ struct msg* create_msg();
  */
 void destroy_msg(struct msg* m);
 
+/*******************/
+/*     Getters     */
+/*******************/
+
+/*
+ * Renvoie la longueur totale (entete comprise) du message m.
+ */
+int get_msg_length(struct msg* m);
+
+/*
+ * Appelle f(t, arg) pour chaque tlv t du message m, dans l'ordre.
+ */
+void for_each_tlv(const struct msg* m, void (*f)(struct tlv*, void*), void* arg);
+
 /*******************/
 /*      Ajout      */
 /*******************/
@@ -56,6 +79,11 @@ void add_neighbour_tlv(struct msg* m, uint128_t ip, uint16_t port);
  */
 void add_data_tlv(struct msg* m, uint64_t sender_id, uint32_t nonce, uint8_t type, uint8_t* data, size_t data_len);
 
+/*
+ * Ajoute au message m un tlv data dont le contenu est p (partage, sans copie).
+ */
+void add_data_payload_tlv(struct msg* m, uint64_t sender_id, uint32_t nonce, uint8_t type, struct payload* p);
+
 /*
  * Ajoute un tlv ack au message m.
  */
@@ -71,19 +99,87 @@ void add_goAway_tlv(struct msg* m, uint8_t code, uint8_t* message, size_t messag
  */
 void add_warning_tlv(struct msg* m, uint8_t* message, size_t message_len);
 
+/*
+ * Ajoute un tlv IHave au message m.
+ */
+void add_ihave_tlv(struct msg* m, uint64_t ids[], uint32_t nonces[], int count);
+
+/*
+ * Ajoute un tlv Summary (donnees que l'on a) au message m.
+ */
+void add_summary_tlv(struct msg* m, uint64_t ids[], uint32_t nonces[], int count);
+
+/*
+ * Ajoute un tlv Request (donnees que l'on demande) au message m.
+ */
+void add_request_tlv(struct msg* m, uint64_t ids[], uint32_t nonces[], int count);
+
+/*
+ * Ajoute un tlv Sketch (cases first a first+count-1 d'une esquisse) au message m.
+ */
+void add_sketch_tlv(struct msg* m, uint8_t first, const uint8_t* cells, int count);
+
+/*
+ * Ajoute un tlv Echo (demande ou reponse, cf. create_echo_tlv) au message m.
+ */
+void add_echo_tlv(struct msg* m, uint8_t reply, uint32_t stamp, uint16_t hold);
+
+/*
+ * Ajoute un tlv Graft au message m.
+ */
+void add_graft_tlv(struct msg* m, uint64_t sender_id, uint32_t nonce);
+
+/*
+ * Ajoute un tlv Prune au message m.
+ */
+void add_prune_tlv(struct msg* m);
+
+/*
+ * Ajoute un tlv Relay au message m.
+ */
+void add_relay_tlv(struct msg* m, uint8_t relay);
+
 /********************/
 /* Envoie/Reception */
 /********************/
 
 /*
- * Envoie le message m a dest. Renvoie 0 si l'envoie du message a echoue et 1 sinon.
+ * Stocke le message m dans buffer (de taille au moins get_msg_length(m)).
+ * Renvoie la taille ecrite.
+ */
+int msg_to_data(struct msg* m, uint8_t buffer[]);
+
+/*
+ * Met le message m en file d'envoi vers dest, avec la priorite de la classe
+ * 'class' (cf. sendQueue.h). Renvoie 0 si la file est pleine et 1 sinon.
+ */
+short send_msg_class(struct msg* m, struct sockaddr *dest, size_t dest_len, int class);
+
+/*
+ * Met le message m en file d'envoi vers dest, avec la priorite deduite de
+ * ses tlvs (hello, puis controle, puis donnees). Renvoie 0 si la file est
+ * pleine et 1 sinon.
  */
 short send_msg(struct msg* m, struct sockaddr *dest, size_t dest_len);
 
 /*
- * Receptionne un message m.
+ * Met en file le message msgs[i] a destination de dests[i] pour tout
+ * i < count (ils partent par lots). Renvoie le nombre de messages en file.
+ */
+int send_msg_batch(struct msg* msgs[], struct sockaddr_in6 dests[], int count);
+
+/*
+ * Receptionne un datagramme (sans bloquer) dans data (de taille size) et
+ * stocke son emetteur dans from. Renvoie sa longueur, ou -1 si aucun
+ * datagramme n'etait en attente.
+ */
+int receive_datagram(uint8_t* data, size_t size, struct sockaddr_in6* from);
+
+/*
+ * Traite le message m recu de from (NULL si le datagramme etait invalide:
+ * l'emetteur recoit alors un GoAway), puis libere m.
  */
-struct msg* receive_msg(struct sockaddr *dest, socklen_t* dest_len);
+void handle_msg(struct msg* m, struct sockaddr_in6* from);
 
 /********************/
 /*  Interpretation  */
@@ -0,0 +1,282 @@
+#include "mpr.h"
+
+#include "message.h"
+#include "neighbourManager.h"
+#include "inputReader.h"
+#include "config.h"
+
+#include <string.h>
+#include <time.h>
+
+#define MPR_MAX_NEIGHBOURS 128
+#define MPR_MAX_TWO_HOP 64
+
+// Les voisins s'annoncent toutes les long_hello_interval secondes en mode
+// MPR: une liste plus vieille que TWO_HOP_ANNOUNCES annonces est perimee.
+#define TWO_HOP_ANNOUNCES 3
+
+static short debug = 0;
+
+static short enabled = 0;
+
+struct address {
+    uint128_t ip;
+    uint16_t port;
+};
+
+// Voisins symetriques annonces par le voisin 'from'.
+struct two_hop {
+    short used;
+    struct address from;
+    long updated;
+    int count;
+    struct address reach[MPR_MAX_TWO_HOP];
+};
+
+static struct two_hop table[MPR_MAX_NEIGHBOURS];
+
+// Voisin a deux sauts pendant le calcul des relais.
+struct two_hop_node {
+    struct address a;
+    int providers;
+    short covered;
+};
+
+static struct two_hop_node nodes[MPR_MAX_NEIGHBOURS * MPR_MAX_TWO_HOP];
+
+struct candidate {
+    struct neighbour* n;
+    struct two_hop* th; // NULL si on ne connait pas ses voisins.
+    short selected;
+};
+
+struct collect_ctx {
+    struct candidate* candidates;
+    int count;
+};
+
+static long last_update = 0;
+
+/*******************/
+/*   Activation    */
+/*******************/
+
+void enable_mpr() {
+    enabled = 1;
+}
+
+short mpr_enabled() {
+    return enabled;
+}
+
+/*******************/
+/*   Deux sauts    */
+/*******************/
+
+static short equals_address(struct address* a, uint128_t ip, uint16_t port) {
+    return a->ip == ip && a->port == port;
+}
+
+static struct two_hop* get_two_hop(uint128_t ip, uint16_t port) {
+    long now = time(NULL);
+    for(int i = 0; i < MPR_MAX_NEIGHBOURS; i++)
+        if( table[i].used && equals_address(&table[i].from, ip, port) )
+            return now - table[i].updated <= TWO_HOP_ANNOUNCES * config_get(CONFIG_LONG_HELLO_INTERVAL) ? &table[i] : NULL;
+    return NULL;
+}
+
+static short reaches(struct two_hop* th, uint128_t ip, uint16_t port) {
+    for(int i = 0; i < th->count; i++)
+        if( equals_address(&th->reach[i], ip, port) )
+            return 1;
+    return 0;
+}
+
+void clear_two_hop(uint128_t ip, uint16_t port) {
+    if(!enabled)
+        return;
+
+    struct two_hop* th = NULL;
+    for(int i = 0; i < MPR_MAX_NEIGHBOURS && th == NULL; i++)
+        if( table[i].used && equals_address(&table[i].from, ip, port) )
+            th = &table[i];
+
+    // Sinon on prend une place libre, ou la liste la plus ancienne.
+    for(int i = 0; i < MPR_MAX_NEIGHBOURS && th == NULL; i++)
+        if( !table[i].used )
+            th = &table[i];
+
+    if(th == NULL) {
+        th = &table[0];
+        for(int i = 1; i < MPR_MAX_NEIGHBOURS; i++)
+            if( table[i].updated < th->updated )
+                th = &table[i];
+    }
+
+    th->used = 1;
+    th->from.ip = ip;
+    th->from.port = port;
+    th->updated = time(NULL);
+    th->count = 0;
+}
+
+void add_two_hop(uint128_t ip, uint16_t port, uint128_t nip, uint16_t nport) {
+    if(!enabled)
+        return;
+
+    struct two_hop* th = get_two_hop(ip, port);
+    if( th == NULL || th->count >= MPR_MAX_TWO_HOP || reaches(th, nip, nport) )
+        return;
+
+    th->reach[th->count].ip = nip;
+    th->reach[th->count].port = nport;
+    th->count++;
+}
+
+/*******************/
+/*   Inondation    */
+/*******************/
+
+short mpr_should_forward(struct neighbour* from, struct neighbour* n) {
+    if( !enabled || from == NULL )
+        return 1;
+
+    // On n'est pas un de ses relais: d'autres s'en chargent.
+    if( !is_relay_selector(from) )
+        return 0;
+
+    // Inutile d'envoyer a un voisin qu'il atteint lui-meme.
+    struct two_hop* th = get_two_hop(get_ip(from), get_port(from));
+    return th == NULL || !reaches(th, get_ip(n), get_port(n));
+}
+
+/*******************/
+/*     Relais      */
+/*******************/
+
+static void collect_symmetric(struct neighbour* n, void* arg) {
+    struct collect_ctx* ctx = arg;
+    if( is_symmetric(n) && ctx->count < MPR_MAX_NEIGHBOURS ) {
+        ctx->candidates[ctx->count].n = n;
+        ctx->count++;
+    }
+}
+
+static int get_node(int node_count, struct address* a) {
+    for(int i = 0; i < node_count; i++)
+        if( equals_address(&nodes[i].a, a->ip, a->port) )
+            return i;
+    return -1;
+}
+
+static short is_candidate(struct candidate* c, int count, struct address* a) {
+    for(int i = 0; i < count; i++)
+        if( equals_address(a, get_ip(c[i].n), get_port(c[i].n)) )
+            return 1;
+    return 0;
+}
+
+// Marque les voisins a deux sauts atteints par c. Renvoie combien ne l'etaient pas.
+static int cover(struct candidate* c, int node_count, short mark) {
+    int count = 0;
+    for(int i = 0; c->th != NULL && i < c->th->count; i++) {
+        int node = get_node(node_count, &c->th->reach[i]);
+        if( node >= 0 && !nodes[node].covered ) {
+            count++;
+            if(mark)
+                nodes[node].covered = 1;
+        }
+    }
+    return count;
+}
+
+// Calcul glouton des relais (RFC 3626, 8.3.1).
+static void select_relays(struct candidate* c, int count) {
+    int node_count = 0;
+
+    for(int i = 0; i < count; i++) {
+        c[i].th = get_two_hop(get_ip(c[i].n), get_port(c[i].n));
+        // Voisins inconnus: on les garde comme relais.
+        c[i].selected = c[i].th == NULL;
+
+        for(int j = 0; c[i].th != NULL && j < c[i].th->count; j++) {
+            struct address* a = &c[i].th->reach[j];
+            if( is_candidate(c, count, a) )
+                continue;
+
+            int node = get_node(node_count, a);
+            if(node < 0) {
+                node = node_count++;
+                nodes[node].a = *a;
+                nodes[node].providers = 0;
+                nodes[node].covered = 0;
+            }
+            nodes[node].providers++;
+        }
+    }
+
+    // Les seuls voisins atteignant un voisin a deux sauts sont des relais.
+    for(int i = 0; i < count; i++)
+        for(int j = 0; c[i].th != NULL && j < c[i].th->count && !c[i].selected; j++) {
+            int node = get_node(node_count, &c[i].th->reach[j]);
+            if( node >= 0 && nodes[node].providers == 1 )
+                c[i].selected = 1;
+        }
+
+    for(int i = 0; i < count; i++)
+        if(c[i].selected)
+            cover(&c[i], node_count, 1);
+
+    // Puis on prend celui qui couvre le plus de voisins restants.
+    while(1) {
+        int best = -1, best_count = 0;
+        for(int i = 0; i < count; i++) {
+            int n = c[i].selected ? 0 : cover(&c[i], node_count, 0);
+            if(n > best_count) {
+                best = i;
+                best_count = n;
+            }
+        }
+
+        if(best < 0)
+            break;
+
+        c[best].selected = 1;
+        cover(&c[best], node_count, 1);
+    }
+}
+
+void mpr_maintenance() {
+    if( !enabled || time(NULL) == last_update )
+        return;
+
+    last_update = time(NULL);
+
+    struct candidate candidates[MPR_MAX_NEIGHBOURS];
+    struct collect_ctx ctx = { candidates, 0 };
+    for_each_neighbour(collect_symmetric, &ctx);
+
+    select_relays(candidates, ctx.count);
+
+    int relays = 0, changed = 0;
+    struct sockaddr_in6 dest;
+    for(int i = 0; i < ctx.count; i++) {
+        struct neighbour* n = candidates[i].n;
+        relays += candidates[i].selected;
+
+        if( is_relay(n) == candidates[i].selected )
+            continue;
+
+        set_relay(n, candidates[i].selected);
+        changed++;
+
+        struct msg* m = create_msg();
+        add_relay_tlv(m, candidates[i].selected);
+        get_sockaddr6(n, &dest);
+        send_msg(m, (struct sockaddr*)&dest, sizeof(dest));
+        destroy_msg(m);
+    }
+
+    if(debug && changed)
+        printn("MPR: %d relais parmi %d voisins symétriques.", relays, ctx.count);
+}
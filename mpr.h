@@ -0,0 +1,57 @@
+#ifndef MPR_H
+#define MPR_H
+
+#include "neighbour.h"
+#include "tlv.h"
+
+#include <stdint.h>
+
+/*
+ * Relais multipoints (MPR, comme dans OLSR): a partir des voisins symetriques
+ * annonces par nos voisins (tlvs neighbour), on choisit un ensemble minimal
+ * de voisins (nos relais) qui atteignent tous nos voisins a deux sauts.
+ * Une donnee recue n'est retransmise que si son emetteur nous a choisi comme
+ * relais, et jamais aux voisins que l'emetteur atteint deja lui-meme.
+ */
+
+/*
+ * Active l'inondation par relais multipoints. (Tous les pairs doivent l'activer.)
+ */
+void enable_mpr();
+
+/*
+ * Renvoie 1 si l'inondation par relais multipoints est activee et 0 sinon.
+ */
+short mpr_enabled();
+
+/*******************/
+/*   Deux sauts    */
+/*******************/
+
+/*
+ * Oublie les voisins annonces par le voisin (ip,port): il va envoyer
+ * la nouvelle liste.
+ */
+void clear_two_hop(uint128_t ip, uint16_t port);
+
+/*
+ * Enregistre que le voisin (ip,port) a pour voisin symetrique (nip,nport).
+ */
+void add_two_hop(uint128_t ip, uint16_t port, uint128_t nip, uint16_t nport);
+
+/*******************/
+/*   Inondation    */
+/*******************/
+
+/*
+ * Renvoie 1 si une donnee recue de 'from' (NULL si c'est la notre) doit
+ * etre envoyee au voisin symetrique n et 0 sinon.
+ */
+short mpr_should_forward(struct neighbour* from, struct neighbour* n);
+
+/*
+ * Recalcule nos relais et previent les voisins dont le role a change.
+ */
+void mpr_maintenance();
+
+#endif /* MPR_H */
@@ -1,5 +1,9 @@
 #include "neighbour.h"
 
+#include "config.h"
+#include "timerWheel.h"
+
+#include <math.h>
 #include <malloc.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -8,7 +12,25 @@
 
 #include <string.h>
 
-#define MAX_AGE 120
+// Poids des criteres du score (cf. neighbour_score).
+#define SCORE_SYMMETRIC 600
+#define SCORE_LONG_HELLO 5
+#define SCORE_MAX_LONG_HELLOS 60
+#define SCORE_GO_AWAY 120
+#define SCORE_PROBE 60
+
+// Detecteur de pannes (cf. get_phi): delais de reponse retenus, ecart type
+// minimal (ms, tolerance a la gigue) et delai suppose tant qu'on a moins de
+// PHI_MIN_SAMPLES mesures.
+#define PHI_SAMPLES 32
+#define PHI_MIN_SAMPLES 3
+#define PHI_MIN_STD 100
+#define PHI_DEFAULT_DELAY 1000
+
+// Cout d'un voisin (cf. neighbour_cost): ms ajoutees au RTT par pour mille
+// de pertes, et RTT suppose tant qu'il est inconnu.
+#define COST_LOSS 2
+#define COST_DEFAULT_RTT 500
 
 //static short debug = 0;
 
@@ -18,6 +40,26 @@ struct neighbour {
     uint64_t id;
     unsigned long hello_date;  // SI (current_date - hello_date < 2min) ALORS (récent)
     unsigned long long_hello_date; // SI (current_date - long_hello_date < 2min) ALORS (symétrique) SINON (non symétrique)
+    short eager; // Lien de l'arbre de diffusion (plumtree).
+    short relay; // Choisi comme relais multipoint (MPR).
+    short selector; // Nous a choisi comme relais multipoint.
+
+    // Historique, pour choisir qui garder quand les listes sont pleines.
+    short was_neighbour;         // A deja ete dans la liste de voisins.
+    unsigned int long_hellos;    // Nombre de hellos longs recus.
+    unsigned int go_aways;       // Nombre de GoAway (recus ou envoyes).
+    unsigned int probes;         // Hellos courts restes sans reponse.
+    unsigned int rtt;            // RTT lisse en ms (0 si inconnu).
+    unsigned int loss;           // Pertes lissees des Echo (pour mille).
+    uint32_t echo_stamp;         // Date du dernier Echo envoye (ms).
+    short echo_pending;          // Dernier Echo encore sans reponse.
+
+    // Detecteur de pannes.
+    uint64_t last_heard;         // Dernier message recu (ms).
+    uint64_t expect_since;       // Attente d'une reponse depuis (ms), 0 si aucune.
+    unsigned int delays[PHI_SAMPLES]; // Derniers delais de reponse (ms).
+    int delay_count;
+    int delay_next;
 };
 
 /*******************/
@@ -36,6 +78,21 @@ struct neighbour* create_neighbour(uint128_t ip, uint16_t port, uint64_t id) {
     n->id = id;
     n->hello_date = (unsigned long)time(NULL);
     n->long_hello_date = (unsigned long)time(NULL);
+    n->eager = 1;
+    n->relay = 1;
+    n->selector = 1;
+    n->was_neighbour = 0;
+    n->long_hellos = 0;
+    n->go_aways = 0;
+    n->probes = 0;
+    n->rtt = 0;
+    n->loss = 0;
+    n->echo_stamp = 0;
+    n->echo_pending = 0;
+    n->last_heard = timer_now();
+    n->expect_since = 0;
+    n->delay_count = 0;
+    n->delay_next = 0;
 
     return n;
 }
@@ -91,6 +148,14 @@ unsigned long last_longHello_age(struct neighbour* n) {
     return ((unsigned long)time(NULL)) - n->long_hello_date;
 }
 
+unsigned long get_hello_date(struct neighbour* n) {
+    return n->hello_date;
+}
+
+unsigned long get_longHello_date(struct neighbour* n) {
+    return n->long_hello_date;
+}
+
 short get_sockaddr6(struct neighbour* n, struct sockaddr_in6 *dest) {
     dest->sin6_family = AF_INET6;
     dest->sin6_port = n->port;
@@ -99,7 +164,144 @@ short get_sockaddr6(struct neighbour* n, struct sockaddr_in6 *dest) {
 }
 
 short is_symmetric(struct neighbour* n) {
-    return last_longHello_age(n) < MAX_AGE;
+    return last_longHello_age(n) < config_get(CONFIG_MAX_AGE);
+}
+
+short is_active(struct neighbour* n) {
+    return last_hello_age(n) < config_get(CONFIG_MAX_AGE);
+}
+
+short was_neighbour(struct neighbour* n) {
+    return n->was_neighbour;
+}
+
+unsigned int get_probes(struct neighbour* n) {
+    return n->probes;
+}
+
+unsigned int get_go_aways(struct neighbour* n) {
+    return n->go_aways;
+}
+
+unsigned int get_rtt(struct neighbour* n) {
+    return n->rtt;
+}
+
+unsigned int get_loss(struct neighbour* n) {
+    return n->loss;
+}
+
+unsigned int neighbour_cost(struct neighbour* n) {
+    return (n->rtt != 0 ? n->rtt : COST_DEFAULT_RTT) + COST_LOSS * n->loss;
+}
+
+long neighbour_score(struct neighbour* n) {
+    long score = -(long)last_hello_age(n);
+
+    if( is_symmetric(n) )
+        score += SCORE_SYMMETRIC;
+
+    score += SCORE_LONG_HELLO * (n->long_hellos < SCORE_MAX_LONG_HELLOS ? n->long_hellos : SCORE_MAX_LONG_HELLOS);
+    score -= SCORE_GO_AWAY * (long)n->go_aways;
+    score -= SCORE_PROBE * (long)n->probes;
+    score -= neighbour_cost(n) / 10;
+
+    return score;
+}
+
+double get_phi(struct neighbour* n) {
+    if(n->expect_since == 0)
+        return 0;
+
+    uint64_t since = n->last_heard > n->expect_since ? n->last_heard : n->expect_since;
+    double t = timer_now() - since;
+
+    double mean = PHI_DEFAULT_DELAY;
+    double var = 0;
+    if(n->delay_count >= PHI_MIN_SAMPLES) {
+        mean = 0;
+        for(int i = 0; i < n->delay_count; i++)
+            mean += n->delays[i];
+        mean /= n->delay_count;
+
+        for(int i = 0; i < n->delay_count; i++)
+            var += (n->delays[i] - mean) * (n->delays[i] - mean);
+        var /= n->delay_count;
+    }
+
+    double std = sqrt(var);
+    if(std < PHI_MIN_STD)
+        std = PHI_MIN_STD;
+
+    // Queue de la loi normale, approximation logistique (Bowling et al.).
+    double y = (t - mean) / std;
+    double e = exp(-y * (1.5976 + 0.070566 * y * y));
+    if(t > mean)
+        return e > 0 ? -log10(e / (1 + e)) : HUGE_VAL;
+    return -log10(1 - 1 / (1 + e));
+}
+
+short is_suspected(struct neighbour* n) {
+    return get_phi(n) > config_get(CONFIG_PHI_THRESHOLD);
+}
+
+short is_eager(struct neighbour* n) {
+    return n->eager;
+}
+
+short is_relay(struct neighbour* n) {
+    return n->relay;
+}
+
+short is_relay_selector(struct neighbour* n) {
+    return n->selector;
+}
+
+
+/*******************/
+/*     Setters     */
+/*******************/
+
+void set_eager(struct neighbour* n, short eager) {
+    n->eager = eager;
+}
+
+void set_relay(struct neighbour* n, short relay) {
+    n->relay = relay;
+}
+
+void set_relay_selector(struct neighbour* n, short selector) {
+    n->selector = selector;
+}
+
+void set_hello_dates(struct neighbour* n, unsigned long hello_date, unsigned long long_hello_date) {
+    n->hello_date = hello_date;
+    n->long_hello_date = long_hello_date;
+}
+
+void set_was_neighbour(struct neighbour* n) {
+    n->was_neighbour = 1;
+}
+
+void copy_history(struct neighbour* dst, struct neighbour* src) {
+    dst->long_hellos += src->long_hellos;
+    dst->go_aways += src->go_aways;
+    if(dst->rtt == 0) {
+        dst->rtt = src->rtt;
+        dst->loss = src->loss;
+    }
+
+    // Un Echo envoye a src peut encore recevoir sa reponse.
+    if(!dst->echo_pending) {
+        dst->echo_stamp = src->echo_stamp;
+        dst->echo_pending = src->echo_pending;
+    }
+
+    if(dst->delay_count == 0) {
+        memcpy(dst->delays, src->delays, sizeof(dst->delays));
+        dst->delay_count = src->delay_count;
+        dst->delay_next = src->delay_next;
+    }
 }
 
 
@@ -113,4 +315,68 @@ void update_hello_date(struct neighbour* n) {
 
 void update_longHello_date(struct neighbour* n) {
     n->long_hello_date = ((unsigned long)time(NULL));
+    n->long_hellos++;
+    n->probes = 0;
+}
+
+void update_rtt(struct neighbour* n, unsigned int rtt) {
+    // Moyenne glissante comme pour le SRTT de TCP.
+    n->rtt = n->rtt == 0 ? rtt : (7 * n->rtt + rtt) / 8;
+    if(n->rtt == 0)
+        n->rtt = 1;
+}
+
+// Moyenne glissante (1/8) des pertes, en pour mille.
+static void update_loss(struct neighbour* n, short lost) {
+    n->loss = (7 * n->loss + (lost ? 1000 : 0)) / 8;
+}
+
+void start_echo(struct neighbour* n, uint32_t stamp) {
+    if(n->echo_pending)
+        update_loss(n, 1);
+
+    n->echo_stamp = stamp;
+    n->echo_pending = 1;
+}
+
+short echo_answered(struct neighbour* n, uint32_t stamp, uint16_t hold) {
+    // Reponse a un Echo plus ancien (deja compte comme perdu) ou en double.
+    if(!n->echo_pending || stamp != n->echo_stamp)
+        return 0;
+
+    uint32_t elapsed = (uint32_t)timer_now() - stamp;
+    n->echo_pending = 0;
+    update_rtt(n, elapsed > hold ? elapsed - hold : 1);
+    update_loss(n, 0);
+    return 1;
+}
+
+void heard_from(struct neighbour* n) {
+    uint64_t now = timer_now();
+
+    // On ne mesure que le delai des reponses attendues: un voisin inactif
+    // qui n'a rien a dire n'est pas en panne.
+    if(n->expect_since != 0) {
+        uint64_t since = n->last_heard > n->expect_since ? n->last_heard : n->expect_since;
+        n->delays[n->delay_next] = now - since;
+        n->delay_next = (n->delay_next + 1) % PHI_SAMPLES;
+        if(n->delay_count < PHI_SAMPLES)
+            n->delay_count++;
+    }
+
+    n->last_heard = now;
+    n->expect_since = 0;
+}
+
+void expect_reply(struct neighbour* n) {
+    if(n->expect_since == 0)
+        n->expect_since = timer_now();
+}
+
+void count_go_away(struct neighbour* n) {
+    n->go_aways++;
+}
+
+void count_probe(struct neighbour* n) {
+    n->probes++;
 }
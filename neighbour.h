@@ -71,16 +71,102 @@ unsigned long last_hello_age(struct neighbour* n);
  */
 unsigned long last_longHello_age(struct neighbour* n);
 
+/*
+ * Renvoie la date (en secondes depuis l'epoch) de la derniere reception d'un hello venant de n.
+ */
+unsigned long get_hello_date(struct neighbour* n);
+
+/*
+ * Renvoie la date (en secondes depuis l'epoch) de la derniere reception d'un hello long venant de n.
+ */
+unsigned long get_longHello_date(struct neighbour* n);
+
 /*
  * Renvoie la sockaddr6 de n (la stocke dans *dest).
  */
 short get_sockaddr6(struct neighbour* n, struct sockaddr_in6 *dest);
 
 /*
- * Renvoie 1 si n est symetrique et 0 sinon.
+ * Renvoie 1 si n est symetrique (son dernier hello long date de moins de
+ * max_age secondes, cf. config.h) et 0 sinon.
  */
 short is_symmetric(struct neighbour* n);
 
+/*
+ * Renvoie 1 si on a recu un hello de n il y a moins de max_age secondes
+ * et 0 sinon.
+ */
+short is_active(struct neighbour* n);
+
+/*
+ * Renvoie 1 si n a deja ete dans la liste de voisins et 0 sinon.
+ */
+short was_neighbour(struct neighbour* n);
+
+/*
+ * Renvoie le nombre de hellos courts envoyes a n restes sans reponse.
+ */
+unsigned int get_probes(struct neighbour* n);
+
+/*
+ * Renvoie le nombre de GoAway recus de n ou envoyes a n.
+ */
+unsigned int get_go_aways(struct neighbour* n);
+
+/*
+ * Renvoie le RTT lisse (en ms) mesure vers n, et 0 si il est inconnu.
+ */
+unsigned int get_rtt(struct neighbour* n);
+
+/*
+ * Renvoie le taux de pertes lisse (en pour mille) des Echo envoyes a n.
+ */
+unsigned int get_loss(struct neighbour* n);
+
+/*
+ * Renvoie le cout de n (en ms): son RTT (une valeur par defaut si il est
+ * inconnu) majore selon ses pertes. Plus il est bas, meilleur est n.
+ */
+unsigned int neighbour_cost(struct neighbour* n);
+
+/*
+ * Renvoie le niveau de suspicion (phi) de n: -log10 de la probabilite que n
+ * soit encore en vie et tarde seulement a repondre, d'apres les delais de
+ * ses reponses precedentes. Il vaut 0 tant qu'on n'attend rien de n.
+ */
+double get_phi(struct neighbour* n);
+
+/*
+ * Renvoie 1 si n est suspect (phi au-dela de phi_threshold, cf. config.h)
+ * et 0 sinon.
+ */
+short is_suspected(struct neighbour* n);
+
+/*
+ * Renvoie le score de n: plus il est haut, plus n merite de rester dans nos
+ * listes. Il baisse avec l'anciennete du dernier hello, le nombre de GoAway,
+ * de hellos courts sans reponse et le cout (cf. neighbour_cost), et monte si n est symetrique et
+ * avec le nombre de hellos longs recus.
+ */
+long neighbour_score(struct neighbour* n);
+
+/*
+ * Renvoie 1 si les donnees sont poussees vers n (lien de l'arbre de
+ * diffusion) et 0 si on ne lui envoie que leurs identifiants.
+ */
+short is_eager(struct neighbour* n);
+
+/*
+ * Renvoie 1 si on a choisi n comme relais multipoint et 0 sinon.
+ */
+short is_relay(struct neighbour* n);
+
+/*
+ * Renvoie 1 si n nous a choisi comme relais multipoint (ou ne nous a
+ * encore rien dit) et 0 sinon.
+ */
+short is_relay_selector(struct neighbour* n);
+
 /*******************/
 /*     Setters     */
 /*******************/
@@ -90,6 +176,37 @@ short is_symmetric(struct neighbour* n);
  */
 void change_id(struct neighbour* n);
 
+/*
+ * Change le mode de diffusion vers n (cf. is_eager).
+ */
+void set_eager(struct neighbour* n, short eager);
+
+/*
+ * Change notre choix de n comme relais multipoint (cf. is_relay).
+ */
+void set_relay(struct neighbour* n, short relay);
+
+/*
+ * Enregistre si n nous a choisi comme relais multipoint (cf. is_relay_selector).
+ */
+void set_relay_selector(struct neighbour* n, short selector);
+
+/*
+ * Remplace les dates de reception des hellos de n (restauration d'un snapshot).
+ */
+void set_hello_dates(struct neighbour* n, unsigned long hello_date, unsigned long long_hello_date);
+
+/*
+ * Marque n comme ayant ete dans la liste de voisins (cf. was_neighbour).
+ */
+void set_was_neighbour(struct neighbour* n);
+
+/*
+ * Ajoute l'historique de src (hellos longs, GoAway, RTT et pertes, delais de
+ * reponse, Echo en attente) a dst, qui designe le meme pair.
+ */
+void copy_history(struct neighbour* dst, struct neighbour* src);
+
 /*******************/
 /*       MAJ       */
 /*******************/
@@ -104,4 +221,42 @@ void update_hello_date(struct neighbour* n);
  */
 void update_longHello_date(struct neighbour* n);
 
+/*
+ * Ajoute une mesure de RTT (en ms) vers n.
+ */
+void update_rtt(struct neighbour* n, unsigned int rtt);
+
+/*
+ * Note l'envoi a n d'un Echo de date 'stamp' (cf. timer_now). Si le
+ * precedent est reste sans reponse, il compte comme perdu.
+ */
+void start_echo(struct neighbour* n, uint32_t stamp);
+
+/*
+ * Note la reponse de n a l'Echo de date 'stamp', retenue 'hold' ms avant
+ * de partir: mesure le RTT et compte une reponse. Renvoie 0 si ce n'est
+ * pas la reponse attendue.
+ */
+short echo_answered(struct neighbour* n, uint32_t stamp, uint16_t hold);
+
+/*
+ * Note la reception d'un message (quel qu'il soit) venant de n.
+ */
+void heard_from(struct neighbour* n);
+
+/*
+ * Note qu'on attend une reponse de n (on vient de lui envoyer une donnee).
+ */
+void expect_reply(struct neighbour* n);
+
+/*
+ * Compte un GoAway recu de n ou envoye a n.
+ */
+void count_go_away(struct neighbour* n);
+
+/*
+ * Compte un hello court envoye a n.
+ */
+void count_probe(struct neighbour* n);
+
 #endif /* NEIGHBOUR_H */
@@ -4,10 +4,18 @@
 #include "idGenerator.h"
 #include "dataManager.h"
 #include "inputReader.h"
+#include "plumtree.h"
+#include "mpr.h"
+#include "timerWheel.h"
+#include "epoch.h"
+#include "catchup.h"
+#include "config.h"
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <time.h>
+#include <stdatomic.h>
 
 #include <sys/types.h>
 #include <unistd.h>
@@ -15,23 +23,79 @@
 
 #include <arpa/inet.h>
 
-#define MIN_SYM 8
-#define LONG_HELLO_INTERVAL 20
+// Taille maximale des listes (la liste de voisins borne aussi l'inondation).
+#define MAX_NEIGHBOURS 64
+#define MAX_POTENTIALS 256
+
+// Un voisin potentiel est oublie s'il n'a pas ete annonce depuis
+// POTENTIAL_MAX_AGE secondes ou n'a pas repondu a MAX_PROBES hellos courts.
+#define POTENTIAL_MAX_AGE 600
+#define MAX_PROBES 5
+
+// Nombre maximal de hellos courts envoyes a chaque maintenance.
+#define PROBE_BATCH 16
+
+// Toutes les SWAP_INTERVAL secondes, si on a assez de voisins symetriques,
+// on sonde SWAP_PROBES voisins potentiels et on renvoie le voisin le plus
+// couteux (cf. neighbour_cost) si il coute plus de SWAP_RATIO fois la
+// moyenne des autres, plus SWAP_MIN_GAIN ms.
+#define SWAP_INTERVAL 60
+#define SWAP_PROBES 1
+#define SWAP_RATIO 2
+#define SWAP_MIN_GAIN 50
+
+// Cases de la table de hachage des voisins publies (au moins le double de
+// MAX_NEIGHBOURS, pour que le sondage lineaire reste court).
+#define TABLE_BITS 7
+#define TABLE_SLOTS (1 << TABLE_BITS)
+#define TABLE_MASK (TABLE_SLOTS - 1)
 
 static short debug = 0;
 
+// Echo joint aux hellos (cf. enable_echo).
+static short echo_enabled = 0;
+
 // Envoie un Hello court si pas assez de voisins symétriques (par exple moins de 8)
 // A la reception d'un TLV Neighbour, ajoute le pair dans la liste de voisins potentiels
 struct neighbour_cell {
     struct neighbour* neighbour;
     struct neighbour_cell* next;
+
+    // Voisins seulement: echeances du dernier hello et du dernier hello long.
+    struct timer* active_timer;
+    struct timer* symmetric_timer;
+    short symmetric;
+};
+
+// Copie immuable de la liste de voisins, lue sans verrou. Les ecrivains
+// (verrou nei_mutex pris) en publient une nouvelle a chaque changement et
+// confient l'ancienne a la liberation differee (cf. epoch.h).
+struct table_entry {
+    struct neighbour* neighbour;
+    short symmetric;
+};
+
+struct neighbour_table {
+    int count;
+    int sym_count;
+    struct table_entry entries[MAX_NEIGHBOURS];
+    uint8_t slots[TABLE_SLOTS];    // Indice dans entries + 1 (0: case vide).
 };
 
 static struct neighbour_cell* potential_nl_head = NULL;
 static struct neighbour_cell* nl_head = NULL;
 
-static long last_hello_sending = 0;
-static long last_neighbour_sending = 0;
+static int potential_count = 0;
+static int nl_count = 0;
+
+static struct neighbour_table empty_table;
+static _Atomic(struct neighbour_table*) table = &empty_table;
+
+static struct timer* hello_timer = NULL;
+static struct timer* neighbours_timer = NULL;
+static struct timer* cleaning_timer = NULL;
+static struct timer* probing_timer = NULL;
+static struct timer* swap_timer = NULL;
 
 static pthread_mutex_t nei_mutex = PTHREAD_MUTEX_INITIALIZER;
 static pthread_mutex_t pnei_mutex = PTHREAD_MUTEX_INITIALIZER;
@@ -49,6 +113,9 @@ static struct neighbour_cell* create_neighbour_cell(struct neighbour* n) {
 
     nl->neighbour = n;
     nl->next = NULL;
+    nl->active_timer = NULL;
+    nl->symmetric_timer = NULL;
+    nl->symmetric = 0;
     return nl;
 }
 
@@ -57,8 +124,11 @@ static struct neighbour_cell* create_neighbour_cell(struct neighbour* n) {
 /*******************/
 
 static void destroy_neighbour_cell(struct neighbour_cell* nc) {
-    if(nc != NULL)
+    if(nc != NULL) {
+        destroy_timer(nc->active_timer);
+        destroy_timer(nc->symmetric_timer);
         free(nc);
+    }
 }
 
 /*******************/
@@ -79,107 +149,364 @@ static void unlock(pthread_mutex_t* mutex, const char* func_name) {
     }
 }
 
+/*******************/
+/*      Table      */
+/*******************/
+
+static int hash(uint128_t ip, uint16_t port) {
+    uint64_t h = (uint64_t)ip ^ (uint64_t)(ip >> 64) ^ port;
+    return (h * 0x9E3779B97F4A7C15ULL) >> (64 - TABLE_BITS);
+}
+
+static struct table_entry* lookup(struct neighbour_table* t, uint128_t ip, uint16_t port) {
+    // La table n'est jamais pleine: on finit sur une case vide.
+    for(int i = hash(ip, port); t->slots[i] != 0; i = (i+1) & TABLE_MASK) {
+        struct table_entry* e = &t->entries[t->slots[i] - 1];
+        if( get_ip(e->neighbour) == ip && get_port(e->neighbour) == port )
+            return e;
+    }
+    return NULL;
+}
+
+// Publie une copie de la liste de voisins. Verrou nei_mutex pris.
+static void publish() {
+    struct neighbour_table* t = calloc(1, sizeof(struct neighbour_table));
+    if(t == NULL) {
+        fprintf(stderr, "malloc() failed.");
+        exit(1);
+    }
+
+    for(struct neighbour_cell* aux = nl_head; aux != NULL; aux = aux->next) {
+        struct table_entry* e = &t->entries[t->count++];
+        e->neighbour = aux->neighbour;
+        e->symmetric = aux->symmetric;
+        if(aux->symmetric)
+            t->sym_count++;
+
+        int i = hash(get_ip(aux->neighbour), get_port(aux->neighbour));
+        while(t->slots[i] != 0)
+            i = (i+1) & TABLE_MASK;
+        t->slots[i] = t->count;
+    }
+
+    struct neighbour_table* old = atomic_exchange(&table, t);
+    if(old != &empty_table)
+        retire(old, free);
+}
+
 /*******************/
 /*     Getters     */
 /*******************/
 
 struct neighbour* get_neighbour(uint128_t ip, uint16_t port) {
-    lock(&nei_mutex, "get_neighbour");
-    struct neighbour_cell* aux;
-    for(aux = nl_head; aux != NULL; aux = aux->next) {
-        if( get_ip(aux->neighbour) == ip && get_port(aux->neighbour) == port ) {
-            unlock(&nei_mutex, "get_neighbour");
-            return aux->neighbour;
-        }
-    }
+    epoch_enter();
+    struct table_entry* e = lookup(atomic_load(&table), ip, port);
+    struct neighbour* n = e != NULL ? e->neighbour : NULL;
+    epoch_exit();
+    return n;
+}
 
-    unlock(&nei_mutex, "get_neighbour");
-    return NULL;
+int count_symmetrics() {
+    epoch_enter();
+    int count = atomic_load(&table)->sym_count;
+    epoch_exit();
+    return count;
 }
 
 short is_neighbour(struct neighbour* n) {
-    lock(&nei_mutex, "is_neighbour");
-    struct neighbour_cell* aux;
-    for(aux = nl_head; aux != NULL; aux = aux->next) {
-        if( equals_neighbours(aux->neighbour, n) ) {
-            unlock(&nei_mutex, "is_neighbour");
-            return 1;
-        }
-    }
+    return get_neighbour(get_ip(n), get_port(n)) != NULL;
+}
 
-    unlock(&nei_mutex, "is_neighbour");
-    return 0;
+void for_each_neighbour(void (*f)(struct neighbour*, void*), void* arg) {
+    epoch_enter();
+    struct neighbour_table* t = atomic_load(&table);
+    for(int i = 0; i < t->count; i++)
+        f(t->entries[i].neighbour, arg);
+    epoch_exit();
+}
+
+void for_each_potential_neighbour(void (*f)(struct neighbour*, void*), void* arg) {
+    lock(&pnei_mutex, "for_each_potential_neighbour");
+    for(struct neighbour_cell* aux = potential_nl_head; aux != NULL; aux = aux->next)
+        f(aux->neighbour, arg);
+    unlock(&pnei_mutex, "for_each_potential_neighbour");
 }
 
 /*******************/
 /*      Ajouts     */
 /*******************/
 
-// return la tete de la liste
-static struct neighbour_cell* add_to_list(struct neighbour_cell* head, struct neighbour* n) {
-    
-    // Si la liste est vide, on l'ajoute en tête.
-    if(head == NULL)
-        return  create_neighbour_cell(n);
-    
-    struct neighbour_cell* aux;
-    for(aux = head; aux != NULL; aux = aux->next ) {
-        // Si il est déjà dans la liste, on s'arrette.
+static struct neighbour_cell* find_in_list(struct neighbour_cell* head, struct neighbour* n) {
+    for(struct neighbour_cell* aux = head; aux != NULL; aux = aux->next)
         if( equals_neighbours(aux->neighbour, n) )
-            return head;
+            return aux;
+    return NULL;
+}
+
+// Renvoie la cellule du pair ayant le plus petit score.
+static struct neighbour_cell* find_worst(struct neighbour_cell* head) {
+    struct neighbour_cell* worst = head;
+    for(struct neighbour_cell* aux = head; aux != NULL; aux = aux->next)
+        if( neighbour_score(aux->neighbour) < neighbour_score(worst->neighbour) )
+            worst = aux;
+    return worst;
+}
+
+static void destroy_retired(void* n) {
+    destroy_neighbour((struct neighbour*)n);
+}
+
+// Libere un pair qui n'est plus dans aucune liste, quand plus aucun
+// lecteur ne peut le voir.
+static void release(struct neighbour* n) {
+    retire(n, destroy_retired);
+}
+
+// Renvoie 1 si l'objet n lui-meme est dans la liste head.
+static short holds(struct neighbour_cell* head, struct neighbour* n) {
+    for(struct neighbour_cell* aux = head; aux != NULL; aux = aux->next)
+        if(aux->neighbour == n)
+            return 1;
+    return 0;
+}
+
+short add_potential_neighbour(struct neighbour* n);
+
+// Range n (qui n'est plus voisin) parmi les voisins potentiels, ou le
+// libere si il n'y a pas sa place.
+static void to_potentials(struct neighbour* n) {
+    if( add_potential_neighbour(n) )
+        return;
+
+    lock(&pnei_mutex, "to_potentials");
+    short kept = holds(potential_nl_head, n);
+    unlock(&pnei_mutex, "to_potentials");
+
+    if(!kept)
+        release(n);
+}
+
+static struct neighbour_cell* remove_from_list(struct neighbour* n, struct neighbour_cell* head);
+
+/*******************/
+/*    Echeances    */
+/*******************/
+
+// Delai (ms) avant que 'date' (en s) ait max_age secondes (cf. config.h).
+static long expiry_delay(unsigned long date) {
+    long remaining = (long)(date + config_get(CONFIG_MAX_AGE)) - (long)time(NULL);
+    return remaining > 0 ? remaining * 1000 : 0;
+}
+
+// Le voisin n'a plus envoye de hello long depuis max_age secondes.
+static void symmetric_expired(void* arg) {
+    struct neighbour_cell* nc = (struct neighbour_cell*)arg;
+
+    lock(&nei_mutex, "symmetric_expired");
+
+    // Les dates sont a la seconde pres: on peut etre un peu en avance.
+    if( is_symmetric(nc->neighbour) ) {
+        schedule_timer(nc->symmetric_timer, expiry_delay(get_longHello_date(nc->neighbour)));
+    } else if(nc->symmetric) {
+        nc->symmetric = 0;
+        publish();
     }
-    
-    // Si le pair n'est pas dans la liste, on met l'ajoute en tête.
-    struct neighbour_cell* nc = create_neighbour_cell(n);
-    nc->next = head;
 
-    return nc; 
+    unlock(&nei_mutex, "symmetric_expired");
+}
+
+// Le voisin n'a plus envoye de hello depuis max_age secondes: il redevient
+// voisin potentiel (ce qui detruit nc et ses temporisateurs).
+static void active_expired(void* arg) {
+    struct neighbour_cell* nc = (struct neighbour_cell*)arg;
+
+    lock(&nei_mutex, "active_expired");
+    struct neighbour* n = nc->neighbour;
+    if( is_active(n) ) {
+        schedule_timer(nc->active_timer, expiry_delay(get_hello_date(n)));
+        unlock(&nei_mutex, "active_expired");
+        return;
+    }
+    unlock(&nei_mutex, "active_expired");
+
+    if(debug) printn("Voisin muet depuis %d s.", config_get(CONFIG_MAX_AGE));
+
+    demote_neighbour(n);
+}
+
+// Arme les echeances du nouveau voisin nc. Verrou nei_mutex pris.
+static void watch(struct neighbour_cell* nc) {
+    nc->active_timer = create_timer(active_expired, nc);
+    nc->symmetric_timer = create_timer(symmetric_expired, nc);
+
+    schedule_timer(nc->active_timer, expiry_delay(get_hello_date(nc->neighbour)));
+    if( is_symmetric(nc->neighbour) ) {
+        nc->symmetric = 1;
+        schedule_timer(nc->symmetric_timer, expiry_delay(get_longHello_date(nc->neighbour)));
+    }
+}
+
+// Retire n de la liste de voisins. Verrou nei_mutex pris.
+static void unlink_neighbour(struct neighbour* n) {
+    struct neighbour_cell* nc = find_in_list(nl_head, n);
+    if(nc == NULL)
+        return;
+
+    nl_head = remove_from_list(n, nl_head);
+    nl_count--;
+    publish();
+}
+
+void hello_received(struct neighbour* n, short long_hello) {
+    update_hello_date(n);
+    if(!long_hello)
+        return;
+    update_longHello_date(n);
+
+    // Les echeances se rearment d'elles-memes tant que le voisin est frais:
+    // seul le passage a symetrique demande le verrou.
+    epoch_enter();
+    struct table_entry* e = lookup(atomic_load(&table), get_ip(n), get_port(n));
+    short becomes_symmetric = e != NULL && !e->symmetric;
+    epoch_exit();
+
+    if(!becomes_symmetric)
+        return;
+
+    lock(&nei_mutex, "hello_received");
+    struct neighbour_cell* nc = find_in_list(nl_head, n);
+    becomes_symmetric = nc != NULL && !nc->symmetric;
+    if(becomes_symmetric) {
+        nc->symmetric = 1;
+        schedule_timer(nc->symmetric_timer, expiry_delay(get_longHello_date(n)));
+        publish();
+    }
+    unlock(&nei_mutex, "hello_received");
+
+    // On compare ce que chacun a recu pendant que le lien etait coupe.
+    if( becomes_symmetric && catchup_enabled() )
+        start_catchup(n);
 }
 
 short add_neighbour(struct neighbour* n) {
+    struct neighbour* evicted = NULL;
+
+    // Cas courant (hello d'un voisin connu): pas besoin du verrou.
+    if( is_neighbour(n) )
+        return 0;
+
     lock(&nei_mutex, "add_neighbour");
-    
-    nl_head = add_to_list(nl_head, n);
+
+    if( find_in_list(nl_head, n) != NULL ) {
+        unlock(&nei_mutex, "add_neighbour");
+        return 0;
+    }
+
+    // Liste pleine: n prend la place du moins bon voisin, s'il est meilleur.
+    if(nl_count >= MAX_NEIGHBOURS) {
+        struct neighbour_cell* worst = find_worst(nl_head);
+        if( neighbour_score(worst->neighbour) >= neighbour_score(n) ) {
+            unlock(&nei_mutex, "add_neighbour");
+            if(debug) printn("Liste de voisins pleine, voisin refusé.");
+            return 0;
+        }
+
+        evicted = worst->neighbour;
+        unlink_neighbour(evicted);
+    }
+
+    struct neighbour_cell* nc = create_neighbour_cell(n);
+    nc->next = nl_head;
+    nl_head = nc;
+    nl_count++;
+    set_was_neighbour(n);
+    watch(nc);
+    publish();
+    short symmetric = nc->symmetric;
 
     unlock(&nei_mutex, "add_neighbour");
-    
-    if(debug && n == nl_head->neighbour) {
+
+    // Un nouveau voisin est d'emblee symetrique (cf. create_neighbour):
+    // le rattrapage commence tout de suite.
+    if( symmetric && catchup_enabled() )
+        start_catchup(n);
+
+    // Le voisin evince reste joignable plus tard.
+    if(evicted != NULL)
+        to_potentials(evicted);
+
+    if(debug) {
             uint128_t nip = get_ip(n);
             char str[INET6_ADDRSTRLEN];
             inet_ntop( AF_INET6, &nip, str, INET6_ADDRSTRLEN );
             printn("Ajout du voisin %s, %d)", str, ntohs(get_port(n)) );
     }
     
-    return n == nl_head->neighbour;
+    return 1;
 }
 
 short add_potential_neighbour(struct neighbour* n) {
-    
-    lock(&pnei_mutex, "add_neighbour");
+    struct neighbour* evicted = NULL;
 
-    potential_nl_head = add_to_list(potential_nl_head, n);
+    lock(&pnei_mutex, "add_potential_neighbour");
+
+    // Deja connu: il vient d'etre annonce de nouveau.
+    struct neighbour_cell* nc = find_in_list(potential_nl_head, n);
+    if(nc != NULL) {
+        if( !was_neighbour(nc->neighbour) )
+            update_hello_date(nc->neighbour);
+        unlock(&pnei_mutex, "add_potential_neighbour");
+        return 0;
+    }
+
+    if(potential_count >= MAX_POTENTIALS) {
+        struct neighbour_cell* worst = find_worst(potential_nl_head);
+        if( neighbour_score(worst->neighbour) >= neighbour_score(n) ) {
+            unlock(&pnei_mutex, "add_potential_neighbour");
+            return 0;
+        }
+
+        evicted = worst->neighbour;
+        potential_nl_head = remove_from_list(evicted, potential_nl_head);
+        potential_count--;
+    }
+
+    nc = create_neighbour_cell(n);
+    nc->next = potential_nl_head;
+    potential_nl_head = nc;
+    potential_count++;
 
     unlock(&pnei_mutex, "add_potential_neighbour");
+
+    if(evicted != NULL)
+        release(evicted);
     
-    if(debug && n == potential_nl_head->neighbour) {
+    if(debug) {
         uint128_t nip = get_ip(n);
         char str[INET6_ADDRSTRLEN];
         inet_ntop( AF_INET6, &nip, str, INET6_ADDRSTRLEN );
         printn("Ajout du voisin potentiel %s, %d)", str, ntohs(get_port(n)) );
     }
         
-    return n == potential_nl_head->neighbour;    
+    return 1;
 }
 
-void init_symeterics(struct received_data* rd) {
-    lock(&nei_mutex, "init_symetrics");
-    
-    struct neighbour_cell* aux;
-    for(aux = nl_head; aux != NULL; aux = aux->next)
-        if( is_symmetric(aux->neighbour) )
-            add_symmetric( rd, aux->neighbour );
+void init_symeterics(struct received_data* rd, struct neighbour* from) {
+    epoch_enter();
+
+    // On ne renvoie pas la donnee a celui qui nous l'a envoyee, ni aux
+    // voisins hors de l'arbre de diffusion (ils recoivent un IHave), ni a
+    // ceux dont un relais multipoint se charge.
+    struct neighbour_table* t = atomic_load(&table);
+    for(int i = 0; i < t->count; i++) {
+        struct neighbour* n = t->entries[i].neighbour;
+        if( t->entries[i].symmetric && n != from
+            && (!plumtree_enabled() || is_eager(n))
+            && mpr_should_forward(from, n) )
+            add_symmetric(rd, n);
+    }
 
-    unlock(&nei_mutex, "init_symetrics");
+    epoch_exit();
 }
 
 /*******************/
@@ -216,9 +543,20 @@ static struct neighbour_cell* remove_from_list(struct neighbour* n, struct neigh
 void remove_from_potentials(struct neighbour* n) {
     lock(&pnei_mutex, "remove_potentials");
 
-    potential_nl_head = remove_from_list(n, potential_nl_head);
+    struct neighbour_cell* nc = find_in_list(potential_nl_head, n);
+    struct neighbour* old = nc != NULL ? nc->neighbour : NULL;
+    if(old != NULL) {
+        potential_nl_head = remove_from_list(n, potential_nl_head);
+        potential_count--;
+    }
 
     unlock(&pnei_mutex, "remove_potentials");
+
+    // On garde l'historique du pair dans sa nouvelle entree.
+    if( old != NULL && old != n ) {
+        copy_history(n, old);
+        release(old);
+    }
     
     if(debug) {
         uint128_t nip = get_ip(n);
@@ -230,9 +568,7 @@ void remove_from_potentials(struct neighbour* n) {
 
 void remove_from_neighbours(struct neighbour* n) {
     lock(&nei_mutex, "remove_neighbour");
-
-    nl_head = remove_from_list(n, nl_head);
- 
+    unlink_neighbour(n);
     unlock(&nei_mutex, "remove_neighbour");
 
     if(debug) {
@@ -243,102 +579,345 @@ void remove_from_neighbours(struct neighbour* n) {
     }
 }
 
+void demote_neighbour(struct neighbour* n) {
+    remove_from_neighbours(n);
+    to_potentials(n);
+}
+
 /*******************/
 /*      Autres     */
 /*******************/
 
-void symetrics_maintenance(int socket, uint64_t my_id) {
+// Oublie les voisins potentiels perimes (les voisins muets ont leur propre
+// echeance, cf. active_expired).
+static void clean_lists() {
+    struct neighbour* stale[MAX_POTENTIALS];
+    int count = 0;
+    struct neighbour_cell* aux;
 
-    if( time(NULL) - last_hello_sending >= LONG_HELLO_INTERVAL/2 ) {
+    lock(&pnei_mutex, "clean_lists");
+    for(aux = potential_nl_head; aux != NULL && count < MAX_POTENTIALS; aux = aux->next)
+        if( last_hello_age(aux->neighbour) > POTENTIAL_MAX_AGE || get_probes(aux->neighbour) > MAX_PROBES )
+            stale[count++] = aux->neighbour;
 
-        struct neighbour_cell* n;
-        int symetrics_count = 0;
-        // On compte le nombre de voisins symetriques.
-        for( n = nl_head; n != NULL; n = n->next )
-            if( is_symmetric(n->neighbour) )
-                symetrics_count++;
-        
-        // Si on a moins de MIN_SYM voisins symetriques, on envoie des hello court
-        // aux voisins potentiels jusqu'à atteindre MIN_SYM ou la fin de la liste.
-        if( symetrics_count < MIN_SYM ) {
-            struct sockaddr_in6 dest;
-            struct msg* hello = create_msg();
-            
-            add_hello_short_tlv(hello, get_my_id());
-            
-            if(debug) printn("Commence l'envoie de HELLO COURT à tous les voisins potentiels");
-            
-            for( n = potential_nl_head; n != NULL; n = n->next ) {
-                get_sockaddr6(n->neighbour, &dest);
-                send_msg(hello, (struct sockaddr*)&dest, sizeof(dest));
-            }
-            
-            if(debug) printn("Envoie de HELLO COURT terminé.");
-            
-        }
+    for(int i = 0; i < count; i++) {
+        potential_nl_head = remove_from_list(stale[i], potential_nl_head);
+        potential_count--;
+    }
+    unlock(&pnei_mutex, "clean_lists");
+
+    for(int i = 0; i < count; i++)
+        release(stale[i]);
+
+    if(debug && count > 0)
+        printn("%d voisins potentiels oubliés.", count);
+}
+
+// Choisit (au plus max <= PROBE_BATCH) les meilleurs voisins potentiels a
+// qui envoyer un hello court (et un Echo de date stamp) et stocke leurs
+// adresses dans dests.
+static int select_probes(struct sockaddr_in6 dests[], int max, uint32_t stamp) {
+    struct neighbour* best[PROBE_BATCH];
+    int count = 0;
+
+    lock(&pnei_mutex, "select_probes");
+    for(struct neighbour_cell* aux = potential_nl_head; aux != NULL; aux = aux->next) {
+        long score = neighbour_score(aux->neighbour);
+
+        // Tri par insertion des meilleurs scores.
+        if(count < max)
+            count++;
+        else if( score <= neighbour_score(best[max-1]) )
+            continue;
+
+        int i = count-1;
+        for(; i > 0 && neighbour_score(best[i-1]) < score; i--)
+            best[i] = best[i-1];
+        best[i] = aux->neighbour;
     }
+
+    for(int i = 0; i < count; i++) {
+        count_probe(best[i]);
+        if(echo_enabled)
+            start_echo(best[i], stamp);
+        get_sockaddr6(best[i], &dests[i]);
+    }
+    unlock(&pnei_mutex, "select_probes");
+
+    return count;
+}
+
+// Envoie un hello court (et un Echo) aux (au plus max) meilleurs voisins
+// potentiels.
+static void send_probes(int max) {
+    struct sockaddr_in6 dests[PROBE_BATCH];
+    struct msg* msgs[PROBE_BATCH];
+    struct msg* hello = create_msg();
+    uint32_t stamp = (uint32_t)timer_now();
+
+    add_hello_short_tlv(hello, get_my_id());
+    if(echo_enabled)
+        add_echo_tlv(hello, 0, stamp, 0);
+
+    int count = select_probes(dests, max, stamp);
+    for(int i = 0; i < count; i++)
+        msgs[i] = hello;
+    send_msg_batch(msgs, dests, count);
+
+    destroy_msg(hello);
+}
+
+static void cleaning(void* arg) {
+    (void)arg;
+    clean_lists();
+    schedule_timer(cleaning_timer, config_get(CONFIG_LONG_HELLO_INTERVAL)/2 * 1000);
 }
 
-static void send_neighbours() {
-    if( time(NULL) - last_hello_sending >= LONG_HELLO_INTERVAL*4 ) {
+static void probing(void* arg) {
+    (void)arg;
 
-        if(debug) printn("Commence l'envoie de NEIGHBOUR à tous les voisins");
+    // Si on a moins de min_sym voisins symetriques, on envoie des hello court
+    // aux meilleurs voisins potentiels (PROBE_BATCH au plus).
+    if( count_symmetrics() < config_get(CONFIG_MIN_SYM) ) {
+        if(debug) printn("Commence l'envoie de HELLO COURT aux voisins potentiels");
+        
+        send_probes(PROBE_BATCH);
         
-        last_hello_sending = time(NULL);
+        if(debug) printn("Envoie de HELLO COURT terminé.");
+    }
+
+    schedule_timer(probing_timer, config_get(CONFIG_LONG_HELLO_INTERVAL)/2 * 1000);
+}
 
-        struct msg* hello_nei;
+// Renvoie le voisin symetrique le plus couteux si il coute nettement plus
+// que les autres (cf. SWAP_RATIO), et NULL sinon. Seuls les voisins dont le
+// RTT est connu sont compares. Un voisin revenu apres un GoAway a besoin de
+// nous: on le garde, sans quoi il reviendrait a chaque fois.
+static struct neighbour* find_slowest() {
+    struct neighbour* slowest = NULL;
+    unsigned long total = 0;
+    int count = 0;
+
+    epoch_enter();
+    struct neighbour_table* t = atomic_load(&table);
+    for(int i = 0; i < t->count; i++) {
+        struct neighbour* n = t->entries[i].neighbour;
+        if( !t->entries[i].symmetric || get_rtt(n) == 0 )
+            continue;
+
+        total += neighbour_cost(n);
+        count++;
+        if( get_go_aways(n) == 0 && (slowest == NULL || neighbour_cost(n) > neighbour_cost(slowest)) )
+            slowest = n;
+    }
+    epoch_exit();
+
+    if(slowest == NULL || count < 2)
+        return NULL;
+
+    unsigned long mean = (total - neighbour_cost(slowest)) / (count - 1);
+    if( neighbour_cost(slowest) <= SWAP_RATIO * mean + SWAP_MIN_GAIN )
+        return NULL;
+
+    return slowest;
+}
+
+static void swapping(void* arg) {
+    (void)arg;
+    int min_sym = config_get(CONFIG_MIN_SYM);
+
+    // Assez de voisins (sinon probing s'en charge): on en essaie un de plus.
+    if( count_symmetrics() >= min_sym )
+        send_probes(SWAP_PROBES);
+
+    // Au-dela de min_sym, le voisin trop lent cede sa place.
+    struct neighbour* slowest = count_symmetrics() > min_sym ? find_slowest() : NULL;
+    if(slowest != NULL) {
         struct sockaddr_in6 dest;
-        struct neighbour_cell *n, *n2;
-    
+        const char* reason = "Replaced by a closer neighbour.";
+        struct msg* goAway = create_msg();
+
+        add_goAway_tlv(goAway, 0, (uint8_t*)reason, strlen(reason));
+        get_sockaddr6(slowest, &dest);
+        send_msg(goAway, (struct sockaddr*)&dest, sizeof(dest));
+        destroy_msg(goAway);
+
+        if(debug) {
+            uint128_t nip = get_ip(slowest);
+            char str[INET6_ADDRSTRLEN];
+            inet_ntop( AF_INET6, &nip, str, INET6_ADDRSTRLEN );
+            printn("Voisin %s, %d remplacé (coût %u ms).", str, ntohs(get_port(slowest)), neighbour_cost(slowest));
+        }
+
+        forget_floods_to(get_ip(slowest), get_port(slowest));
+        count_go_away(slowest);
+        demote_neighbour(slowest);
+    }
+
+    schedule_timer(swap_timer, SWAP_INTERVAL * 1000);
+}
 
-        // Pour tous les voisins, on envoie nos autres voisins symétriques
-        for(n = nl_head; n != NULL; n = n->next) {
-            hello_nei = create_msg();
-            add_hello_long_tlv(hello_nei, get_my_id(), get_id(n->neighbour));
-
-            // On remplit le message avec nos voisins symétriques
-            for(n2 = nl_head; n2 != NULL; n2 = n2->next) {
-                if( n != n2 && is_symmetric(n2->neighbour) ) {
-                    add_neighbour_tlv(hello_nei,
-                                      get_ip(n2->neighbour),
-                                      get_port(n2->neighbour));
-                }
+static void send_neighbours(void* arg) {
+    (void)arg;
+
+    if(debug) printn("Commence l'envoie de NEIGHBOUR à tous les voisins");
+
+    struct msg* hello_nei;
+    struct sockaddr_in6 dest;
+
+    epoch_enter();
+    struct neighbour_table* t = atomic_load(&table);
+
+    // Pour tous les voisins, on envoie nos autres voisins symétriques
+    for(int i = 0; i < t->count; i++) {
+        hello_nei = create_msg();
+        add_hello_long_tlv(hello_nei, get_my_id(), get_id(t->entries[i].neighbour));
+
+        // On remplit le message avec nos voisins symétriques
+        for(int j = 0; j < t->count; j++) {
+            if( i != j && t->entries[j].symmetric ) {
+                add_neighbour_tlv(hello_nei,
+                                  get_ip(t->entries[j].neighbour),
+                                  get_port(t->entries[j].neighbour));
             }
-            // On envoie le tlv.
-            get_sockaddr6(n->neighbour, &dest);
-            send_msg(hello_nei, (struct sockaddr*)&dest, sizeof(dest));
-            destroy_msg(hello_nei);
-            hello_nei = NULL;
         }
+        // On envoie le tlv.
+        get_sockaddr6(t->entries[i].neighbour, &dest);
+        send_msg(hello_nei, (struct sockaddr*)&dest, sizeof(dest));
+        destroy_msg(hello_nei);
+        hello_nei = NULL;
+    }
+
+    epoch_exit();
+
+    if(debug) printn("Envoie de NEIGHBOUR terminé.");
+
+    // Les relais multipoints ont besoin de listes a jour.
+    schedule_timer(neighbours_timer, config_get(CONFIG_LONG_HELLO_INTERVAL) * (mpr_enabled() ? 1 : 4) * 1000);
+}
+
+static void send_hellos(void* arg) {
+    (void)arg;
+
+    if(debug) printn("Commence l'envoie de HELLO LONG à tous les voisins");
+
+    struct msg* hello;
+    struct sockaddr_in6 dest;
+
+    epoch_enter();
+    struct neighbour_table* t = atomic_load(&table);
+
+    uint32_t stamp = (uint32_t)timer_now();
+
+    for(int i = 0; i < t->count; i++) {
+        struct neighbour* n = t->entries[i].neighbour;
+        hello = create_msg();
+        add_hello_long_tlv(hello, get_my_id(), get_id(n));
+        if( mpr_enabled() )
+            add_relay_tlv(hello, is_relay(n));
+
+        // Mesure du RTT et des pertes (cf. echo_received).
+        if(echo_enabled) {
+            add_echo_tlv(hello, 0, stamp, 0);
+            start_echo(n, stamp);
+        }
+
+        get_sockaddr6(n, &dest);
+        send_msg(hello, (struct sockaddr*)&dest, sizeof(dest));
+        destroy_msg(hello);
+        hello = NULL;
+    }
 
-        if(debug) printn("Envoie de NEIGHBOUR terminé.");
+    epoch_exit();
+
+    if(debug) printn("Envoie de HELLO LONG terminé.");
+
+    schedule_timer(hello_timer, config_get(CONFIG_LONG_HELLO_INTERVAL) * 1000);
+}
+
+int send_go_away_to_all(uint8_t code, const char* reason) {
+    epoch_enter();
+
+    struct neighbour_table* t = atomic_load(&table);
+    int count = t->count;
+    struct msg* goAway = create_msg();
+    add_goAway_tlv(goAway, code, (uint8_t*)reason, strlen(reason));
+
+    struct msg** msgs = malloc(count * sizeof(struct msg*));
+    struct sockaddr_in6* dests = calloc(count, sizeof(struct sockaddr_in6));
+    if(count > 0 && (msgs == NULL || dests == NULL)) {
+        fprintf(stderr, "malloc() failed.");
+        exit(1);
+    }
+
+    for(int i = 0; i < count; i++) {
+        msgs[i] = goAway;
+        get_sockaddr6(t->entries[i].neighbour, &dests[i]);
     }
 
+    epoch_exit();
+
+    int sent = send_msg_batch(msgs, dests, count);
+
+    free(msgs);
+    free(dests);
+    destroy_msg(goAway);
+    return sent;
 }
 
-void start_hello_sender() {
+void start_neighbour_timers() {
+    hello_timer = create_timer(send_hellos, NULL);
+    neighbours_timer = create_timer(send_neighbours, NULL);
+    cleaning_timer = create_timer(cleaning, NULL);
+    probing_timer = create_timer(probing, NULL);
+    swap_timer = create_timer(swapping, NULL);
+
+    schedule_timer(hello_timer, 0);
+    schedule_timer(neighbours_timer, 0);
+    schedule_timer(cleaning_timer, 0);
+    schedule_timer(probing_timer, 0);
+    schedule_timer(swap_timer, SWAP_INTERVAL * 1000);
+}
 
-    if( time(NULL) - last_neighbour_sending >= LONG_HELLO_INTERVAL ) {
+void enable_echo() {
+    echo_enabled = 1;
+}
 
-        if(debug) printn("Commence l'envoie de HELLO LONG à tous les voisins");
-        
-        last_neighbour_sending = time(NULL);
+void echo_received(uint128_t ip, uint16_t port, uint32_t stamp, uint16_t hold) {
+    struct neighbour* n = get_neighbour(ip, port);
+    if(n != NULL) {
+        echo_answered(n, stamp, hold);
+        return;
+    }
 
-        struct msg* hello;
-        struct sockaddr_in6 dest;
-        struct neighbour_cell* n;
-    
-        for(n = nl_head; n != NULL; n = n->next) {
-            hello = create_msg();
-            add_hello_long_tlv(hello, get_my_id(), get_id(n->neighbour));
-            get_sockaddr6(n->neighbour, &dest);
-            send_msg(hello, (struct sockaddr*)&dest, sizeof(dest));
-            destroy_msg(hello);
-            hello = NULL;
+    // Reponse d'un voisin potentiel sonde.
+    lock(&pnei_mutex, "echo_received");
+    for(struct neighbour_cell* aux = potential_nl_head; aux != NULL; aux = aux->next)
+        if( get_ip(aux->neighbour) == ip && get_port(aux->neighbour) == port ) {
+            echo_answered(aux->neighbour, stamp, hold);
+            break;
         }
+    unlock(&pnei_mutex, "echo_received");
+}
 
-        if(debug) printn("Envoie de HELLO LONG terminé.");
+/*******************/
+/*   Statistiques  */
+/*******************/
+
+void print_neighbour_stats() {
+    epoch_enter();
+
+    struct neighbour_table* t = atomic_load(&table);
+    printn("Voisins: %d (%d symétriques).", t->count, t->sym_count);
+    for(int i = 0; i < t->count; i++) {
+        struct neighbour* n = t->entries[i].neighbour;
+        uint128_t nip = get_ip(n);
+        char str[INET6_ADDRSTRLEN];
+        inet_ntop( AF_INET6, &nip, str, INET6_ADDRSTRLEN );
+        printn("  %s %d: %s, RTT %u ms, pertes %.1f%%, suspicion %.1f%s", str, ntohs(get_port(n)),
+               t->entries[i].symmetric ? "symétrique" : "non symétrique",
+               get_rtt(n), get_loss(n) / 10.0, get_phi(n), is_suspected(n) ? " (suspect)" : "");
     }
 
-    send_neighbours();
+    epoch_exit();
 }
@@ -11,7 +11,8 @@
 /***************/
 
 /*
- * Ajoute un voisin.
+ * Ajoute un voisin. Il redevient voisin potentiel des que son dernier
+ * hello date de max_age secondes (cf. config.h).
  * Renvoie 1 si ajoute et 0 si il est déjà dans la liste.
  */
 short add_neighbour(struct neighbour* n);
@@ -28,6 +29,12 @@ short add_potential_neighbour(struct neighbour* n);
 /*   Getters   */
 /***************/
 
+/*
+ * Les lectures de la liste de voisins ne prennent pas de verrou: elles
+ * parcourent la derniere copie publiee de la liste. Un voisin renvoye reste
+ * valide jusqu'a la fin de la section de lecture de l'appelant (cf. epoch.h).
+ */
+
 /*
  * Recupere le voisin (ip,port) dans la liste de voisins (renvoie NULL
  * si il n'y est pas.
@@ -39,14 +46,30 @@ struct neighbour* get_neighbour(uint128_t ip, uint16_t port);
  */
 short is_neighbour(struct neighbour* n);
 
+/*
+ * Renvoie le nombre de voisins symetriques. Sans verrou.
+ */
+int count_symmetrics();
+
+/*
+ * Appelle f(n, arg) pour chaque voisin n. Sans verrou.
+ */
+void for_each_neighbour(void (*f)(struct neighbour*, void*), void* arg);
+
+/*
+ * Appelle f(n, arg) pour chaque voisin potentiel n. Thread-safe.
+ */
+void for_each_potential_neighbour(void (*f)(struct neighbour*, void*), void* arg);
+
 /***************/
 /*    Init.    */
 /***************/
 
 /*
- * Initialise la liste de voisins symetriques de la donnee recement recu.
+ * Initialise la liste de voisins symetriques de la donnee recement recu
+ * (sauf 'from', le voisin qui nous l'a envoyee, qui peut etre NULL).
  */
-void init_symeterics(struct received_data* rd);
+void init_symeterics(struct received_data* rd, struct neighbour* from);
 
 
 /***************/
@@ -64,22 +87,61 @@ void remove_from_potentials(struct neighbour* n);
  */
 void remove_from_neighbours(struct neighbour* n);
 
+/*
+ * Fait redevenir n voisin potentiel (il est libere, de maniere differee,
+ * si la liste de voisins potentiels n'a pas de place pour lui). Thread-safe.
+ */
+void demote_neighbour(struct neighbour* n);
+
 
 /**************/
 /*  Protocol  */
 /**************/
 
 /*
- * Met a jour la liste de voisins en fonction des datte de hellos reçus.
- * Envoie des hellos court aux voisins potentiels si le nombre de voisins
- * symetriques est insufisant. (avec un interval minimum)
+ * Enregistre la reception d'un hello (long si long_hello vaut 1) venant de
+ * n. Ne prend le verrou que si n, voisin, devient symetrique. Thread-safe.
+ */
+void hello_received(struct neighbour* n, short long_hello);
+
+/*
+ * Arme les temporisateurs du protocole de voisinage:
+ * - hellos longs (avec un Echo si active) a tous les voisins (toutes les
+ *   long_hello_interval s),
+ * - tlvs neighbour de temps en temps,
+ * - oubli des voisins potentiels perimes,
+ * - hellos courts aux voisins potentiels si le nombre de voisins
+ *   symetriques est insufisant,
+ * - remplacement du voisin le plus lent par un voisin potentiel.
+ */
+void start_neighbour_timers();
+
+/*
+ * Envoie en un seul lot un GoAway (code, reason) a chaque voisin. Renvoie le
+ * nombre de messages mis en file.
  */
-void symetrics_maintenance();
+int send_go_away_to_all(uint8_t code, const char* reason);
+
+/*
+ * Joint un Echo aux hellos longs et aux hellos courts des sondages, pour
+ * mesurer le RTT et les pertes. (Tous les pairs doivent l'activer: les
+ * anciennes versions rejettent les messages qui en contiennent.)
+ */
+void enable_echo();
+
+/*
+ * Enregistre la reponse de (ip,port), voisin ou voisin potentiel, a notre
+ * Echo de date 'stamp' (cf. echo_answered).
+ */
+void echo_received(uint128_t ip, uint16_t port, uint32_t stamp, uint16_t hold);
+
+/*******************/
+/*   Statistiques  */
+/*******************/
 
 /*
- * Envoie des hellos long a tous les voisins. (avec interval minimum)
- * Envoie des tlvs neighbour avec de temps en temps.
+ * Affiche chaque voisin: symetrie, RTT, pertes et niveau de suspicion.
  */
-void start_hello_sender();
+void print_neighbour_stats();
 
 #endif /* NEIGHBOUR_MANAGER */
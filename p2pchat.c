@@ -2,11 +2,27 @@
 #include "info.h"
 #include "idGenerator.h"
 #include "neighbourManager.h"
+#include "dataManager.h"
+#include "tlv.h"
 #include "inputReader.h"
+#include "snapshot.h"
+#include "fragment.h"
+#include "compression.h"
+#include "plumtree.h"
+#include "mpr.h"
+#include "rateLimiter.h"
+#include "sendQueue.h"
+#include "socketMonitor.h"
+#include "timerWheel.h"
+#include "epoch.h"
+#include "history.h"
+#include "reconcile.h"
+#include "catchup.h"
+#include "pipeline.h"
+#include "config.h"
 
 #include <sys/types.h>
 #include <sys/socket.h>
-#include <sys/ioctl.h>
 
 #include <netinet/in.h>
 #include <arpa/inet.h>
@@ -21,7 +37,34 @@
 #include <string.h>
 
 #include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <pthread.h>
 
+#define DEFAULT_SNAPSHOT ".p2pchat.snapshot"
+#define MAX_BOOTSTRAP 64
+
+// Nombre maximal de messages traites avant de regarder l'entree et les
+// temporisateurs.
+#define RECEIVE_BATCH 64
+
+// Periode (ms) des maintenances sans echeance propre.
+#define MAINTENANCE_INTERVAL 100
+
+// Nombre de messages de l'historique reaffiches au demarrage.
+#define HISTORY_REPLAY 32
+
+// Arret propre: delai (ms) laisse aux innondations en cours, puis a la file
+// d'envoi pour faire partir les GoAway. Pendant l'arret, la boucle se
+// reveille au moins toutes les SHUTDOWN_TICK ms.
+#define SHUTDOWN_DEADLINE 2000
+#define SHUTDOWN_FLUSH 1000
+#define SHUTDOWN_TICK 50
+
+static struct timer* maintenance_timer = NULL;
+
+static volatile sig_atomic_t stop_requested = 0;
 
 static int create_socket() {
     int s = socket(AF_INET6, SOCK_DGRAM, 0);
@@ -48,19 +91,162 @@ static void set_options(int socket) {
     }
 }
 
-static void init_first_neighbour(struct sockaddr_in6 *server, const char* ip, uint16_t port) {
-    server->sin6_family = AF_INET6;
-    server->sin6_port = htons(1212);
-    int rc = inet_pton(AF_INET6, ip, &server->sin6_addr );
-    if(rc == 0) {
-        perror("inet_pton(bad address format)");
-        exit(1);
+// Remplit 'peer' avec l'adresse (ip,port). Les adresses IPv4 sont
+// converties en adresses IPv6 mappees. Renvoie 1 si l'adresse est valide.
+static short init_peer(struct sockaddr_in6 *peer, const char* ip, const char* port_str) {
+    char* end = NULL;
+    long port = strtol(port_str, &end, 10);
+
+    if(*port_str == '\0' || *end != '\0') {
+        fprintf(stderr, "Le port donné n'est pas un nombre (%s).\n", port_str);
+        return 0;
     }
-    if(rc < 0) {
-        perror("inet_pton");
+
+    if(port < 0 || port > USHRT_MAX) {
+        fprintf(stderr, "Le port donné n'est pas compris entre %d et %d (%ld).\n", 0, USHRT_MAX, port);
+        return 0;
+    }
+
+    memset(peer, 0, sizeof(struct sockaddr_in6));
+    peer->sin6_family = AF_INET6;
+    peer->sin6_port = htons(port);
+
+    if( inet_pton(AF_INET6, ip, &peer->sin6_addr) == 1 )
+        return 1;
+
+    struct in_addr ip4;
+    if( inet_pton(AF_INET, ip, &ip4) == 1 ) {
+        peer->sin6_addr.s6_addr[10] = 0xff;
+        peer->sin6_addr.s6_addr[11] = 0xff;
+        memcpy(peer->sin6_addr.s6_addr+12, &ip4, 4);
+        return 1;
+    }
+
+    fprintf(stderr, "Adresse invalide: %s.\n", ip);
+    return 0;
+}
+
+// Pairs donnes au-dela de MAX_BOOTSTRAP (ignores).
+static int dropped_peers = 0;
+
+// Lit les pairs (une ligne "<ip> <port>" par pair, '#' pour les commentaires)
+// du fichier 'path' a la suite des 'count' pairs de 'peers'.
+// Renvoie le nouveau nombre de pairs.
+static int read_peers_file(const char* path, struct sockaddr_in6 peers[], int count) {
+    FILE* f = fopen(path, "r");
+    if(f == NULL) {
+        perror(path);
         exit(1);
     }
 
+    char line[256];
+    char ip[INET6_ADDRSTRLEN];
+    char port[8];
+
+    while( fgets(line, sizeof(line), f) != NULL ) {
+        char* comment = strchr(line, '#');
+        if(comment != NULL)
+            *comment = '\0';
+
+        int rc = sscanf(line, "%45s %7s", ip, port);
+        if(rc == EOF || rc == 0)
+            continue;
+
+        if(count == MAX_BOOTSTRAP) {
+            dropped_peers++;
+            continue;
+        }
+
+        if( rc != 2 || !init_peer(&peers[count], ip, port) ) {
+            fprintf(stderr, "%s: ligne ignorée: %s", path, line);
+            continue;
+        }
+        count++;
+    }
+
+    fclose(f);
+    return count;
+}
+
+// Ajoute les pairs aux voisins potentiels et leur envoie un hello court,
+// a tous en un seul lot. Renvoie le nombre de hellos envoyes.
+static int bootstrap(struct sockaddr_in6 peers[], int count) {
+    struct msg* hello = create_msg();
+    add_hello_short_tlv(hello, get_my_id());
+
+    struct msg* msgs[MAX_BOOTSTRAP];
+    for(int i = 0; i < count; i++) {
+        msgs[i] = hello;
+
+        struct neighbour* n = create_neighbour(((uint128_t*)peers[i].sin6_addr.s6_addr)[0], peers[i].sin6_port, 0);
+        if( !add_potential_neighbour(n) )
+            destroy_neighbour(n);
+    }
+
+    int sent = send_msg_batch(msgs, peers, count);
+    destroy_msg(hello);
+
+    return sent;
+}
+
+static long elapsed_ms(struct timespec* start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1000 + (now.tv_nsec - start->tv_nsec) / 1000000;
+}
+
+static void maintenance(void* arg) {
+    (void)arg;
+
+    snapshot_maintenance();
+    fragment_maintenance();
+    plumtree_maintenance();
+    mpr_maintenance();
+    socket_maintenance();
+    history_maintenance();
+    config_maintenance();
+
+    schedule_timer(maintenance_timer, MAINTENANCE_INTERVAL);
+}
+
+// Premier SIGINT/SIGTERM: arret propre. Le second arrete tout de suite.
+static void on_stop(int sig) {
+    (void)sig;
+    if(stop_requested)
+        _exit(1);
+    stop_requested = 1;
+}
+
+static void watch_stop() {
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_stop;
+    sigemptyset(&sa.sa_mask);
+    // Seule la boucle principale recoit ces signaux (cf. mask_signals): son
+    // poll() est interrompu malgre SA_RESTART et voit la demande d'arret.
+    sa.sa_flags = SA_RESTART;
+
+    if( sigaction(SIGINT, &sa, NULL) < 0 || sigaction(SIGTERM, &sa, NULL) < 0 )
+        perror("watch_stop");
+}
+
+// Bloque (how = SIG_BLOCK) ou debloque (SIG_UNBLOCK) les signaux traites
+// par la boucle principale. Les threads heritent du masque de leur createur:
+// lances signaux bloques, ils ne les recoivent jamais a sa place.
+static void mask_signals(int how) {
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGINT);
+    sigaddset(&set, SIGTERM);
+    sigaddset(&set, SIGHUP);
+
+    int rc = pthread_sigmask(how, &set, NULL);
+    if(rc != 0)
+        fprintf(stderr, "pthread_sigmask: %s\n", strerror(rc));
+}
+
+static void usage(const char* name) {
+    fprintf(stderr, "Usage: %s [-z] [-p] [-m] [-w] [-a] [-e] [-r] [-b octets] [-s snapshot] [-l historique] [-c configuration] [-o nom=valeur]... [-f fichier_de_pairs] [<ip> <port>]...\n", name);
 }
 
 /**************/
@@ -71,71 +257,197 @@ int main(int argc, char* args[]) {
 
     // Controle d'entrees.
 
-    if( argc < 3 ) {
-        fprintf(stderr, "Argument manuquant : Adresse ip du premier voisin et le port utilisé sont demandés.\n");
-        return 1;
+    const char* snapshot_path = DEFAULT_SNAPSHOT;
+    const char* history_dir = NULL;
+    struct sockaddr_in6 peers[MAX_BOOTSTRAP];
+    int peer_count = 0;
+    int buffer_size = 0;
+
+    init_config();
+
+    int opt;
+    while( (opt = getopt(argc, args, "s:f:b:l:c:o:zpmwaer")) != -1 ) {
+        switch(opt) {
+        case 's':
+            snapshot_path = optarg;
+            break;
+        case 'l':
+            history_dir = optarg;
+            break;
+        case 'c':
+            if( !set_config_file(optarg) )
+                return 1;
+            break;
+        case 'o':
+            if( !add_config_override(optarg) ) {
+                usage(args[0]);
+                return 1;
+            }
+            break;
+        case 'f':
+            peer_count = read_peers_file(optarg, peers, peer_count);
+            break;
+        case 'b':
+            buffer_size = atoi(optarg);
+            if(buffer_size <= 0) {
+                fprintf(stderr, "Taille de tampon invalide : %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'z':
+            enable_compression();
+            break;
+        case 'p':
+            enable_plumtree();
+            break;
+        case 'm':
+            enable_mpr();
+            break;
+        case 'w':
+            enable_rate_limit_replies();
+            break;
+        case 'a':
+            enable_reconcile();
+            break;
+        case 'e':
+            enable_echo();
+            break;
+        case 'r':
+            enable_catchup();
+            break;
+        default:
+            usage(args[0]);
+            return 1;
+        }
     }
 
-    char* end = NULL;
-    long port = strtol(args[2], &end, 10);
-
-    if(*end != '\0') {
-        fprintf(stderr, "Le port donné n'est pas un nombre.\n");
+    if( (argc - optind) % 2 != 0 ) {
+        fprintf(stderr, "Argument manquant : chaque adresse ip doit être suivie d'un port.\n");
+        usage(args[0]);
         return 1;
     }
 
-    if(port < 0 || port > USHRT_MAX) {
-        fprintf(stderr, "Le port donné n'est pas compris entre %d et %d.\n", 0, USHRT_MAX);
-        return 1;
+    for(int i = optind; i < argc; i += 2) {
+        if(peer_count == MAX_BOOTSTRAP) {
+            dropped_peers++;
+            continue;
+        }
+        if( !init_peer(&peers[peer_count], args[i], args[i+1]) )
+            return 1;
+        peer_count++;
     }
 
+    if(dropped_peers > 0)
+        fprintf(stderr, "Attention: %d pairs au-delà des %d premiers ignorés.\n", dropped_peers, MAX_BOOTSTRAP);
+
     // initialisations
 
     init_inputReader();
+    watch_config();
+    watch_stop();
 
     srandom(time(NULL));
     generate_id();
 
     int s = create_socket();
     set_options(s);
+    init_socket_monitor(s, buffer_size);
 
     init_info(s);
+    mask_signals(SIG_BLOCK);
+    start_send_queue();
+    start_pipeline(s);
+    start_output();
+    mask_signals(SIG_UNBLOCK);
+
+    struct timespec join_start;
+    clock_gettime(CLOCK_MONOTONIC, &join_start);
+    short joined = 0;
+
+    // Redemarrage a chaud: on reprend notre identite et on contacte
+    // tous les pairs connus.
+    // L'historique passe avant le snapshot, qui ne connait que les
+    // identifiants des donnees.
+    if( history_dir != NULL && open_history(history_dir) )
+        replay_history(HISTORY_REPLAY);
+
+    int contacted = 0;
+    if( open_snapshot(snapshot_path) )
+        contacted = restore_snapshot();
+
+    // Puis tous les pairs donnes en argument.
+    contacted += bootstrap(peers, peer_count);
+
+    // Si personne n'a pu etre contacte on quitte.
+    if( contacted == 0 ) {
+        fprintf(stderr, "Aucun pair n'a pu être contacté (ni snapshot, ni pair donné).\n");
+        usage(args[0]);
+        return 1;
+    }
 
-    struct sockaddr_in6 peer;
-    socklen_t len = sizeof(peer);
-    init_first_neighbour(&peer, args[1], port);
+    start_neighbour_timers();
 
-    // premier message
+    maintenance_timer = create_timer(maintenance, NULL);
+    schedule_timer(maintenance_timer, 0);
 
-    struct msg* m = create_msg();
-    add_hello_short_tlv(m, get_my_id());
-    // Si l'envoie echoue on quitte.
-    if( !send_msg(m, (struct sockaddr*)&peer, sizeof(peer)) )
-        return 1;
+    // Les messages decodes, l'entree standard et les temporisateurs sont
+    // surveilles ensemble: rien ne bloque la boucle.
+    struct pollfd fds[2] = { {pipeline_fd(), POLLIN, 0}, {STDIN_FILENO, POLLIN, 0} };
+    short more = 0;
+
+    // Apres un signal, on continue jusqu'a ce que les innondations en
+    // cours soient acquittees, ou au plus SHUTDOWN_DEADLINE ms.
+    uint64_t deadline = 0;
+
+    while( deadline == 0 || (timer_now() < deadline && floods_pending() > 0) ) {
+        if( stop_requested && deadline == 0 ) {
+            deadline = timer_now() + SHUTDOWN_DEADLINE;
+            fds[1].fd = -1;
+            printn("Arrêt: envoi des dernières données (au plus %d ms)...", SHUTDOWN_DEADLINE);
+            hasten_floods();
+        }
+
+        // Messages laisses au tour precedent: on n'attend pas.
+        int timeout = more ? 0 : next_timer_delay();
+        if( deadline != 0 && (timeout < 0 || timeout > SHUTDOWN_TICK) )
+            timeout = SHUTDOWN_TICK;
 
+        int rc = poll(fds, 2, timeout);
+        if(rc < 0 && errno != EINTR) {
+            perror("poll");
+            exit(1);
+        }
 
-    time_t last_overload = 0;
-    int count;
+        // Les voisins retires pendant ce tour ne sont liberes qu'apres.
+        epoch_enter();
 
-    while(1) {
-        m = receive_msg( (struct sockaddr*)&peer, &len);
-        destroy_msg(m);
-        m = NULL;
+        if( more || (rc > 0 && (fds[0].revents & POLLIN)) ) {
+            more = process_received(RECEIVE_BATCH);
 
-        // Filtre de survie anti-flood:
-        // Si la socket est trop chargée on ne propose pas
-        // d'entrée utilisateur tant que le flux n'est pas plus
-        // calme.
-        ioctl(s, FIONREAD, &count);
-        if(count < 4 && time(NULL) - last_overload > 3)
-            read_input();
-        else if(count > 3)
-            last_overload = time(NULL);
+            if( !joined && count_symmetrics() > 0 ) {
+                joined = 1;
+                printn("Premier voisin symétrique après %ld ms.", elapsed_ms(&join_start));
+            }
+        }
 
-        start_hello_sender();
-        symetrics_maintenance();
+        // Entree fermee: on ne la surveille plus.
+        if( rc > 0 && (fds[1].revents & (POLLIN | POLLHUP)) && !read_input() )
+            fds[1].fd = -1;
+
+        run_timers();
+
+        epoch_exit();
+        epoch_reclaim();
     }
 
+    // Les voisins nous oublient tout de suite au lieu d'attendre max_age.
+    int notified = send_go_away_to_all(GO_AWAY_LEAVING, "Leaving.");
+    flush_send_queue(SHUTDOWN_FLUSH);
+    printn("Arrêt: %d voisin%s prévenu%s.", notified, notified > 1 ? "s" : "", notified > 1 ? "s" : "");
+
+    close_snapshot();
+    close_history();
+    close_inputReader();
     close(s);
     return 0;
 }
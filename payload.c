@@ -0,0 +1,77 @@
+#include "payload.h"
+
+#include "inputReader.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+
+struct payload {
+    atomic_int refs;
+    size_t len;
+    uint8_t data[];
+};
+
+static atomic_long live = 0;
+static atomic_long live_bytes = 0;
+
+/*******************/
+/*   Constructeur  */
+/*******************/
+
+struct payload* create_payload(const uint8_t* data, size_t len) {
+    struct payload* p = malloc(sizeof(struct payload) + len);
+    if(p == NULL) {
+        fprintf(stderr, "malloc() failed.");
+        exit(1);
+    }
+
+    atomic_init(&p->refs, 1);
+    p->len = len;
+    if(len > 0)
+        memcpy(p->data, data, len);
+
+    atomic_fetch_add(&live, 1);
+    atomic_fetch_add(&live_bytes, len);
+    return p;
+}
+
+/*******************/
+/*    References   */
+/*******************/
+
+struct payload* hold_payload(struct payload* p) {
+    atomic_fetch_add(&p->refs, 1);
+    return p;
+}
+
+void release_payload(struct payload* p) {
+    if(p == NULL || atomic_fetch_sub(&p->refs, 1) > 1)
+        return;
+
+    atomic_fetch_sub(&live, 1);
+    atomic_fetch_sub(&live_bytes, p->len);
+    free(p);
+}
+
+/*******************/
+/*     Getters     */
+/*******************/
+
+const uint8_t* payload_data(struct payload* p) {
+    return p->data;
+}
+
+size_t payload_length(struct payload* p) {
+    return p->len;
+}
+
+/*******************/
+/*   Statistiques  */
+/*******************/
+
+void print_payload_stats() {
+    printn("Contenus partagés: %ld en mémoire (%ld octets).",
+           atomic_load(&live), atomic_load(&live_bytes));
+}
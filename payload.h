@@ -0,0 +1,47 @@
+#ifndef PAYLOAD_H
+#define PAYLOAD_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Contenu immuable d'une donnee, partage (par compteur de references) entre
+ * le tlv data recu, la liste des donnees recues, l'inondation et
+ * l'affichage. Il est copie une seule fois, depuis le tampon de reception
+ * (ou la saisie), et libere quand le dernier utilisateur le relache.
+ */
+
+struct payload;
+
+/*
+ * Cree un contenu (avec une reference) en copiant les len octets de data.
+ */
+struct payload* create_payload(const uint8_t* data, size_t len);
+
+/*
+ * Prend une reference sur p et renvoie p. Thread-safe.
+ */
+struct payload* hold_payload(struct payload* p);
+
+/*
+ * Relache une reference sur p, libere a la derniere (sans effet si p est
+ * NULL). Thread-safe.
+ */
+void release_payload(struct payload* p);
+
+/*
+ * Renvoie les octets de p (a ne pas modifier).
+ */
+const uint8_t* payload_data(struct payload* p);
+
+/*
+ * Renvoie le nombre d'octets de p.
+ */
+size_t payload_length(struct payload* p);
+
+/*
+ * Affiche le nombre de contenus vivants et leur taille totale.
+ */
+void print_payload_stats();
+
+#endif /* PAYLOAD_H */
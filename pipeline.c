@@ -0,0 +1,184 @@
+#include "pipeline.h"
+
+#include "message.h"
+#include "inputReader.h"
+#include "spsc.h"
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#include <sys/eventfd.h>
+
+static short debug = 0;
+
+struct datagram {
+    struct sockaddr_in6 from;
+    int len;
+    uint8_t data[];
+};
+
+struct decoded {
+    struct sockaddr_in6 from;
+    struct msg* m;              // NULL: datagramme invalide.
+};
+
+static int sock = -1;
+
+// Entree/sortie -> decodage.
+static struct spsc* datagrams = NULL;
+// Decodage -> protocole.
+static struct spsc* messages = NULL;
+
+// Reveil de la boucle principale: un seul ecrit par vague de messages.
+static int notify_fd = -1;
+static atomic_int notified = 0;
+
+/*******************/
+/*     Etages      */
+/*******************/
+
+static void* io_stage(void* arg) {
+    (void)arg;
+    uint8_t* buffer = NULL;
+    int size = 0;
+    struct pollfd fd = { sock, POLLIN, 0 };
+
+    while(1) {
+        if( poll(&fd, 1, -1) < 0 && errno != EINTR ) {
+            perror("io_stage");
+            exit(1);
+        }
+
+        // Taille reglable a chaud (cf. config.h).
+        if( size != config_get(CONFIG_RECEIVE_BUFFER) ) {
+            size = config_get(CONFIG_RECEIVE_BUFFER);
+            buffer = realloc(buffer, size);
+            if(buffer == NULL) {
+                fprintf(stderr, "malloc() failed.");
+                exit(1);
+            }
+        }
+
+        // On vide la socket; si le decodage ne suit pas, on attend.
+        while(1) {
+            struct sockaddr_in6 from;
+            int len = receive_datagram(buffer, size, &from);
+            if(len < 0)
+                break;
+
+            struct datagram* d = malloc(sizeof(struct datagram) + len);
+            if(d == NULL) {
+                fprintf(stderr, "malloc() failed.");
+                exit(1);
+            }
+
+            d->from = from;
+            d->len = len;
+            memcpy(d->data, buffer, len);
+            spsc_push_wait(datagrams, d);
+        }
+    }
+
+    return NULL;
+}
+
+static void* decode_stage(void* arg) {
+    (void)arg;
+
+    while(1) {
+        struct datagram* d = spsc_pop_wait(datagrams, -1);
+        if(d == NULL)
+            continue;
+
+        struct decoded* dm = malloc(sizeof(struct decoded));
+        if(dm == NULL) {
+            fprintf(stderr, "malloc() failed.");
+            exit(1);
+        }
+
+        dm->from = d->from;
+        dm->m = data_to_msg(d->data, d->len);
+        free(d);
+
+        if(debug && dm->m == NULL)
+            printn("Pipeline: datagramme invalide.");
+
+        spsc_push_wait(messages, dm);
+
+        if( !atomic_exchange(&notified, 1) ) {
+            uint64_t one = 1;
+            if( write(notify_fd, &one, sizeof(one)) < 0 && errno != EAGAIN )
+                perror("decode_stage");
+        }
+    }
+
+    return NULL;
+}
+
+static void start_stage(void* (*stage)(void*)) {
+    pthread_t thread;
+
+    int rc = pthread_create(&thread, NULL, stage, NULL);
+    if(rc != 0) {
+        fprintf(stderr, "Error: Thread create\n");
+        exit(EXIT_FAILURE);
+    }
+
+    pthread_detach(thread);
+}
+
+void start_pipeline(int s) {
+    sock = s;
+    datagrams = create_spsc("réception", PIPELINE_DEPTH);
+    messages = create_spsc("décodage", PIPELINE_DEPTH);
+
+    notify_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if(notify_fd < 0) {
+        perror("start_pipeline");
+        exit(EXIT_FAILURE);
+    }
+
+    start_stage(decode_stage);
+    start_stage(io_stage);
+}
+
+int pipeline_fd() {
+    return notify_fd;
+}
+
+short process_received(int max) {
+    // Le reveil est consomme avant de vider la file: un message decode
+    // ensuite en provoquera un autre.
+    uint64_t count;
+    if( read(notify_fd, &count, sizeof(count)) < 0 && errno != EAGAIN )
+        perror("process_received");
+    atomic_store(&notified, 0);
+
+    for(int i = 0; i < max; i++) {
+        struct decoded* dm = spsc_pop(messages);
+        if(dm == NULL)
+            return 0;
+
+        handle_msg(dm->m, &dm->from);
+        free(dm);
+    }
+
+    return spsc_depth(messages) > 0;
+}
+
+/*******************/
+/*   Statistiques  */
+/*******************/
+
+void print_pipeline_stats() {
+    printn("Pipeline de réception:");
+    print_spsc_stats(datagrams);
+    print_spsc_stats(messages);
+}
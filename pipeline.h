@@ -0,0 +1,41 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+/*
+ * Pipeline de reception, en etages relies par des files bornees sans verrou
+ * (spsc.h):
+ *  - entree/sortie (thread dedie): vide la socket, datagramme par datagramme;
+ *  - decodage (thread dedie): verifie et decode les datagrammes (data_to_msg);
+ *  - protocole (boucle principale): interprete les messages decodes, avec les
+ *    temporisateurs et l'entree standard (tout l'etat du protocole y reste);
+ *  - affichage (thread dedie, cf. inputReader.h): ecrit les lignes.
+ * Quand une file est pleine, l'etage qui l'alimente attend: au bout de la
+ * chaine, c'est le tampon de la socket qui absorbe (puis perd) le surplus.
+ */
+
+// Nombre de places de chaque file.
+#define PIPELINE_DEPTH 1024
+
+/*
+ * Demarre les etages d'entree/sortie et de decodage sur la socket s.
+ */
+void start_pipeline(int s);
+
+/*
+ * Renvoie le descripteur, a surveiller par la boucle principale, qui devient
+ * lisible quand des messages decodes attendent.
+ */
+int pipeline_fd();
+
+/*
+ * Etage protocole: interprete au plus max messages decodes. Renvoie 1 s'il
+ * en reste (le descripteur n'est alors pas forcement lisible) et 0 sinon.
+ */
+short process_received(int max);
+
+/*
+ * Affiche la profondeur et le debit de chaque file.
+ */
+void print_pipeline_stats();
+
+#endif /* PIPELINE_H */
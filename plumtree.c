@@ -0,0 +1,249 @@
+#include "plumtree.h"
+
+#include "message.h"
+#include "neighbourManager.h"
+#include "inputReader.h"
+#include "history.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define MISSING_MAX 256
+#define MAX_ANNOUNCERS 3
+#define GRAFT_TIMEOUT_MS 1000
+
+static short debug = 0;
+
+static short enabled = 0;
+
+// Donnee annoncee par des voisins lazy mais pas encore recue.
+struct missing {
+    short used;
+    uint64_t id;
+    uint32_t nonce;
+    long deadline;
+    int announcer_count;
+    struct sockaddr_in6 announcers[MAX_ANNOUNCERS];
+};
+
+static struct missing missings[MISSING_MAX];
+
+struct announce_ctx {
+    struct msg* ihave;
+    struct neighbour* from;
+};
+
+static long now_ms() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+/*******************/
+/*   Activation    */
+/*******************/
+
+void enable_plumtree() {
+    enabled = 1;
+}
+
+short plumtree_enabled() {
+    return enabled;
+}
+
+/*******************/
+/*    Annonces     */
+/*******************/
+
+static void announce_to(struct neighbour* n, void* arg) {
+    struct announce_ctx* ctx = arg;
+    struct sockaddr_in6 dest;
+
+    if( n == ctx->from || is_eager(n) || !is_symmetric(n) )
+        return;
+
+    get_sockaddr6(n, &dest);
+    send_msg(ctx->ihave, (struct sockaddr*)&dest, sizeof(dest));
+}
+
+void plumtree_announce(struct received_data* rd, struct neighbour* from) {
+    if(!enabled)
+        return;
+
+    uint64_t id = get_data_id(rd);
+    uint32_t nonce = get_data_nonce(rd);
+
+    struct announce_ctx ctx;
+    ctx.ihave = create_msg();
+    ctx.from = from;
+    add_ihave_tlv(ctx.ihave, &id, &nonce, 1);
+
+    for_each_neighbour(announce_to, &ctx);
+
+    destroy_msg(ctx.ihave);
+}
+
+/*******************/
+/*   Manquantes    */
+/*******************/
+
+static struct missing* get_missing(uint64_t id, uint32_t nonce) {
+    for(int i = 0; i < MISSING_MAX; i++)
+        if( missings[i].used && missings[i].id == id && missings[i].nonce == nonce )
+            return &missings[i];
+    return NULL;
+}
+
+static void add_announcer(struct missing* m, struct neighbour* n) {
+    struct sockaddr_in6 sa;
+    get_sockaddr6(n, &sa);
+
+    for(int i = 0; i < m->announcer_count; i++)
+        if( memcmp(&m->announcers[i].sin6_addr, &sa.sin6_addr, sizeof(sa.sin6_addr)) == 0
+            && m->announcers[i].sin6_port == sa.sin6_port )
+            return;
+
+    if(m->announcer_count < MAX_ANNOUNCERS)
+        m->announcers[m->announcer_count++] = sa;
+}
+
+/*******************/
+/*    Reception    */
+/*******************/
+
+void plumtree_on_data(struct received_data* rd, struct neighbour* from, short is_new) {
+    struct missing* m = get_missing(get_data_id(rd), get_data_nonce(rd));
+    if(m != NULL)
+        m->used = 0;
+
+    if(!enabled || from == NULL)
+        return;
+
+    if(is_new) {
+        // Lien utile: il fait (de nouveau) partie de l'arbre.
+        set_eager(from, 1);
+        return;
+    }
+
+    // Doublon venant d'un autre chemin: on elague ce lien.
+    if( !is_received_from(rd, from) && is_eager(from) ) {
+        if(debug)
+            printn("Plumtree: Prune d'un lien redondant.");
+
+        set_eager(from, 0);
+
+        struct sockaddr_in6 dest;
+        struct msg* prune = create_msg();
+        add_prune_tlv(prune);
+        get_sockaddr6(from, &dest);
+        send_msg(prune, (struct sockaddr*)&dest, sizeof(dest));
+        destroy_msg(prune);
+    }
+}
+
+void plumtree_on_ihave(struct tlv* t, struct neighbour* from) {
+    if(from == NULL)
+        return;
+
+    uint64_t id;
+    uint32_t nonce;
+    int count = get_id_list_count(t);
+
+    for(int i = 0; i < count; i++) {
+        get_id_list_item(t, i, &id, &nonce);
+
+        if( get_received_data(id, nonce) != NULL )
+            continue;
+
+        struct missing* m = get_missing(id, nonce);
+        if(m == NULL) {
+            for(int j = 0; j < MISSING_MAX && m == NULL; j++)
+                if( !missings[j].used )
+                    m = &missings[j];
+
+            if(m == NULL) {
+                if(debug)
+                    printn("Plumtree: trop de données manquantes, IHave ignoré.");
+                return;
+            }
+
+            m->used = 1;
+            m->id = id;
+            m->nonce = nonce;
+            m->announcer_count = 0;
+            m->deadline = now_ms() + GRAFT_TIMEOUT_MS;
+        }
+
+        add_announcer(m, from);
+    }
+}
+
+void plumtree_on_graft(uint64_t id, uint32_t nonce, struct neighbour* from) {
+    if(from == NULL)
+        return;
+
+    set_eager(from, 1);
+
+    struct received_data* rd = get_received_data(id, nonce);
+    if( rd != NULL && resend_data(rd, from) )
+        return;
+
+    // Sortie de la liste des donnees recues: le journal l'a peut-etre.
+    uint8_t type;
+    struct payload* p = history_lookup(id, nonce, &type);
+    if(p == NULL)
+        return;
+
+    struct sockaddr_in6 dest;
+    struct msg* m = create_msg();
+    add_data_payload_tlv(m, id, nonce, type, p);
+    get_sockaddr6(from, &dest);
+    send_msg(m, (struct sockaddr*)&dest, sizeof(dest));
+    destroy_msg(m);
+    release_payload(p);
+}
+
+void plumtree_on_prune(struct neighbour* from) {
+    if(from != NULL)
+        set_eager(from, 0);
+}
+
+/*******************/
+/*   Maintenance   */
+/*******************/
+
+void plumtree_maintenance() {
+    long now = now_ms();
+
+    for(int i = 0; i < MISSING_MAX; i++) {
+        struct missing* m = &missings[i];
+        if( !m->used || m->deadline > now )
+            continue;
+
+        // Plus personne a qui la demander.
+        if(m->announcer_count == 0) {
+            m->used = 0;
+            continue;
+        }
+
+        // L'arbre est casse: on demande la donnee au premier annonceur et
+        // son lien repasse dans l'arbre.
+        struct sockaddr_in6 dest = m->announcers[0];
+        m->announcer_count--;
+        memmove(m->announcers, m->announcers+1, m->announcer_count * sizeof(struct sockaddr_in6));
+        m->deadline = now + GRAFT_TIMEOUT_MS;
+
+        struct neighbour* n = get_neighbour(((uint128_t*)dest.sin6_addr.s6_addr)[0], dest.sin6_port);
+        if(n != NULL)
+            set_eager(n, 1);
+
+        struct msg* graft = create_msg();
+        add_graft_tlv(graft, m->id, m->nonce);
+        send_msg(graft, (struct sockaddr*)&dest, sizeof(dest));
+        destroy_msg(graft);
+
+        if(debug)
+            printn("Plumtree: Graft envoyé.");
+    }
+}
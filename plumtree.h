@@ -0,0 +1,58 @@
+#ifndef PLUMTREE_H
+#define PLUMTREE_H
+
+#include "neighbour.h"
+#include "dataManager.h"
+#include "tlv.h"
+
+#include <stdint.h>
+
+/*
+ * Diffusion par arbre epidemique (Plumtree): les donnees ne sont poussees
+ * qu'aux voisins "eager" (arbre couvrant), les autres ("lazy") ne recoivent
+ * que leurs identifiants (IHave) et les demandent (Graft) si l'arbre est
+ * casse. Un doublon recu fait elaguer (Prune) le lien qui l'a apporte.
+ */
+
+/*
+ * Active la diffusion par arbre. (Tous les pairs doivent l'activer.)
+ */
+void enable_plumtree();
+
+/*
+ * Renvoie 1 si la diffusion par arbre est activee et 0 sinon.
+ */
+short plumtree_enabled();
+
+/*
+ * Annonce rd (IHave) a tous les voisins symetriques lazy sauf 'from'.
+ */
+void plumtree_announce(struct received_data* rd, struct neighbour* from);
+
+/*
+ * A appeler a la reception de la donnee rd envoyee par 'from' (qui peut etre
+ * NULL). 'is_new' vaut 1 si c'est la premiere fois qu'on la recoit.
+ */
+void plumtree_on_data(struct received_data* rd, struct neighbour* from, short is_new);
+
+/*
+ * Traite un tlv IHave envoye par 'from'.
+ */
+void plumtree_on_ihave(struct tlv* t, struct neighbour* from);
+
+/*
+ * Traite une demande (Graft) de la donnee (id,nonce) par 'from'.
+ */
+void plumtree_on_graft(uint64_t id, uint32_t nonce, struct neighbour* from);
+
+/*
+ * Traite un tlv Prune envoye par 'from'.
+ */
+void plumtree_on_prune(struct neighbour* from);
+
+/*
+ * Demande (Graft) les donnees annoncees qui ne sont pas arrivees a temps.
+ */
+void plumtree_maintenance();
+
+#endif /* PLUMTREE_H */
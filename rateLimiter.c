@@ -0,0 +1,253 @@
+#include "rateLimiter.h"
+
+#include "message.h"
+#include "neighbourManager.h"
+#include "inputReader.h"
+#include "config.h"
+
+#include <string.h>
+#include <time.h>
+
+#include <netinet/in.h>
+
+#define RL_SOURCES_BITS 10
+#define RL_SOURCES (1 << RL_SOURCES_BITS)
+#define RL_PROBES 8
+
+// Les compteurs de tlvs ignores sont remis a zero toutes les RL_WINDOW ms.
+// Un pair qui en depasse RL_GOAWAY_DROPS dans la fenetre recoit un GoAway.
+#define RL_WINDOW 10000
+#define RL_GOAWAY_DROPS 1000
+
+// Les jetons sont comptes en milliemes.
+#define TOKEN 1000
+
+enum rl_class {RL_HELLO, RL_NEIGHBOUR, RL_DATA, RL_CONTROL, RL_CLASSES};
+
+static const char* class_names[RL_CLASSES] = {"hello", "neighbour", "data", "contrôle"};
+
+// Debit (jetons par seconde) et taille de chaque seau. Ceux des donnees
+// (data, IHave, Graft, Summary, Request, Sketch) sont reglables (cf.
+// config.h) et multiplies pour un voisin symetrique, qui relaie
+// l'inondation, les fragments, le rattrapage et les reparations.
+static const struct {
+    uint32_t rate;
+    uint32_t burst;
+} budgets[RL_CLASSES] = {
+    {   2,   10 },  // hello
+    { 100,  300 },  // neighbour
+    {   0,    0 },  // donnees, cf. config.h
+    { 500, 1000 },  // ack, GoAway, warning, ...
+};
+
+static short debug = 0;
+
+static short replies = 0;
+
+struct source {
+    short used;
+    uint128_t ip;
+    uint16_t port;
+    long last;                      // Dernier remplissage (ms).
+    uint64_t tokens[RL_CLASSES];
+    uint32_t drops;                 // Tlvs ignores dans la fenetre.
+    long window_start;
+    long last_warning;
+    short gone;                     // GoAway envoye dans la fenetre.
+};
+
+static struct source sources[RL_SOURCES];
+
+static unsigned long accepted[RL_CLASSES];
+static unsigned long dropped[RL_CLASSES];
+static unsigned long warnings = 0;
+static unsigned long go_aways = 0;
+
+static long now_ms() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+/*******************/
+/*   Activation    */
+/*******************/
+
+void enable_rate_limit_replies() {
+    replies = 1;
+}
+
+/*******************/
+/*      Pairs      */
+/*******************/
+
+static unsigned int hash(uint128_t ip, uint16_t port) {
+    uint64_t h = (uint64_t)ip ^ (uint64_t)(ip >> 64) ^ port;
+    h *= 0x9E3779B97F4A7C15ULL;
+    return h >> (64 - RL_SOURCES_BITS);
+}
+
+static uint64_t rate_of(int c, short symmetric) {
+    if(c != RL_DATA)
+        return budgets[c].rate;
+    return (uint64_t)config_get(CONFIG_RL_DATA_RATE) * (symmetric ? config_get(CONFIG_RL_SYMMETRIC_FACTOR) : 1);
+}
+
+static uint64_t burst_of(int c, short symmetric) {
+    if(c != RL_DATA)
+        return budgets[c].burst;
+    return (uint64_t)config_get(CONFIG_RL_DATA_BURST) * (symmetric ? config_get(CONFIG_RL_SYMMETRIC_FACTOR) : 1);
+}
+
+// Renvoie l'entree de (ip,port), en la creant (au besoin a la place de la
+// plus ancienne de son voisinage) si elle n'existe pas.
+static struct source* get_source(uint128_t ip, uint16_t port, long now) {
+    unsigned int h = hash(ip, port);
+    struct source* victim = NULL;
+
+    for(int i = 0; i < RL_PROBES; i++) {
+        struct source* s = &sources[(h + i) & (RL_SOURCES - 1)];
+        if( s->used && s->ip == ip && s->port == port )
+            return s;
+
+        if( victim == NULL || !s->used || (victim->used && s->last < victim->last) )
+            victim = s;
+    }
+
+    memset(victim, 0, sizeof(struct source));
+    victim->used = 1;
+    victim->ip = ip;
+    victim->port = port;
+    victim->last = now;
+    victim->window_start = now;
+    victim->last_warning = now - RL_WINDOW;
+    for(int c = 0; c < RL_CLASSES; c++)
+        victim->tokens[c] = burst_of(c, 0) * TOKEN;
+
+    return victim;
+}
+
+static void refill(struct source* s, long now, short symmetric) {
+    uint64_t elapsed = now - s->last;
+    s->last = now;
+
+    for(int c = 0; c < RL_CLASSES; c++) {
+        uint64_t tokens = s->tokens[c] + elapsed * rate_of(c, symmetric);
+        uint64_t max = burst_of(c, symmetric) * TOKEN;
+        s->tokens[c] = tokens < max ? tokens : max;
+    }
+}
+
+static int tlv_class(uint8_t type) {
+    switch(type) {
+    case HELLO:
+        return RL_HELLO;
+    case NEIGHBOUR:
+        return RL_NEIGHBOUR;
+    case DATA:
+    case IHAVE:
+    case GRAFT:
+    case SUMMARY:
+    case REQUEST:
+    case SKETCH:
+        return RL_DATA;
+    default:
+        return RL_CONTROL;
+    }
+}
+
+/*******************/
+/*   Sanctions     */
+/*******************/
+
+static void punish(struct source* s, long now) {
+    struct sockaddr_in6 dest;
+    memset(&dest, 0, sizeof(dest));
+    dest.sin6_family = AF_INET6;
+    dest.sin6_port = s->port;
+    memcpy(&dest.sin6_addr, &s->ip, sizeof(s->ip));
+
+    if( s->drops >= RL_GOAWAY_DROPS && !s->gone ) {
+        s->gone = 1;
+        go_aways++;
+
+        char* reason = "Too many messages.";
+        struct msg* m = create_msg();
+        add_goAway_tlv(m, 3, (uint8_t*)reason, strlen(reason));
+        send_msg(m, (struct sockaddr*)&dest, sizeof(dest));
+        destroy_msg(m);
+
+        struct neighbour* n = get_neighbour(s->ip, s->port);
+        if(n != NULL) {
+            count_go_away(n);
+            demote_neighbour(n);
+        }
+
+        if(debug)
+            printn("Limitation: GoAway envoyé à un pair trop bavard.");
+
+    } else if( now - s->last_warning >= RL_WINDOW ) {
+        s->last_warning = now;
+        warnings++;
+
+        char* warning = "Trop de messages, certains sont ignorés.";
+        struct msg* m = create_msg();
+        add_warning_tlv(m, (uint8_t*)warning, strlen(warning));
+        send_msg(m, (struct sockaddr*)&dest, sizeof(dest));
+        destroy_msg(m);
+    }
+}
+
+/*******************/
+/*   Limitation    */
+/*******************/
+
+short rate_limit(uint128_t ip, uint16_t port, uint8_t type) {
+    long now = now_ms();
+    struct source* s = get_source(ip, port, now);
+    int c = tlv_class(type);
+
+    struct neighbour* n = get_neighbour(ip, port);
+    refill(s, now, n != NULL && is_symmetric(n));
+
+    if(s->tokens[c] >= TOKEN) {
+        s->tokens[c] -= TOKEN;
+        accepted[c]++;
+        return 1;
+    }
+
+    if(now - s->window_start >= RL_WINDOW) {
+        s->window_start = now;
+        s->drops = 0;
+        s->gone = 0;
+    }
+
+    s->drops++;
+    dropped[c]++;
+
+    if(replies)
+        punish(s, now);
+
+    return 0;
+}
+
+/*******************/
+/*   Statistiques  */
+/*******************/
+
+void print_rate_limit_stats() {
+    int tracked = 0, offenders = 0;
+    long now = now_ms();
+
+    for(int i = 0; i < RL_SOURCES; i++)
+        if(sources[i].used) {
+            tracked++;
+            if( sources[i].drops > 0 && now - sources[i].window_start < RL_WINDOW )
+                offenders++;
+        }
+
+    printn("Limitation du débit entrant: %d pairs suivis, %d trop bavards.", tracked, offenders);
+    for(int c = 0; c < RL_CLASSES; c++)
+        printn("  %-10s %lu acceptés, %lu ignorés.", class_names[c], accepted[c], dropped[c]);
+    printn("  %lu warnings et %lu GoAway envoyés.", warnings, go_aways);
+}
@@ -0,0 +1,31 @@
+#ifndef RATE_LIMITER_H
+#define RATE_LIMITER_H
+
+#include "tlv.h"
+
+#include <stdint.h>
+
+/*
+ * Limitation du debit entrant: chaque pair (ip,port) a un seau a jetons par
+ * classe de tlv (hello, neighbour, data et controle). Un tlv arrivant quand
+ * le seau de sa classe est vide est ignore.
+ */
+
+/*
+ * Previent les pairs trop bavards (Warning), puis leur envoie un GoAway
+ * s'ils continuent.
+ */
+void enable_rate_limit_replies();
+
+/*
+ * Renvoie 1 si le tlv de type 'type' venant de (ip,port) peut etre traite
+ * et 0 s'il doit etre ignore.
+ */
+short rate_limit(uint128_t ip, uint16_t port, uint8_t type);
+
+/*
+ * Affiche les compteurs (tlvs acceptes et ignores par classe, pairs suivis).
+ */
+void print_rate_limit_stats();
+
+#endif /* RATE_LIMITER_H */
@@ -0,0 +1,353 @@
+#include "reconcile.h"
+
+#include "message.h"
+#include "dataManager.h"
+#include "neighbourManager.h"
+#include "catchup.h"
+#include "inputReader.h"
+#include "sendQueue.h"
+#include "timerWheel.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+// Chaque identifiant est compte dans une case de chacune des SKETCH_HASHES
+// sous-tables.
+#define SKETCH_HASHES 3
+#define SUBTABLE (SKETCH_CELLS / SKETCH_HASHES)
+
+// Nombre maximal de donnees mises dans une esquisse.
+#define RECONCILE_MAX 4096
+
+// Nombre maximal de differences extraites d'une esquisse.
+#define MAX_DIFFERENCES (2 * SKETCH_CELLS)
+
+static short debug = 0;
+static short enabled = 0;
+
+struct cell {
+    uint16_t count;             // Modulo 2^16: seule la difference compte.
+    uint64_t id_sum;            // Ou exclusif des identifiants,
+    uint32_t nonce_sum;         // des nonces,
+    uint32_t hash_sum;          // et de leurs empreintes (cf. check()).
+};
+
+// Esquisse en cours de reception (elle arrive en plusieurs tlvs).
+struct incoming {
+    uint128_t ip;
+    uint16_t port;
+    struct cell cells[SKETCH_CELLS];
+    uint8_t seen[SKETCH_CELLS];
+    int seen_count;
+};
+
+static struct incoming incoming;
+static struct timer* exchange_timer = NULL;
+
+// Identifiants de la fenetre, pour construire notre esquisse.
+static uint64_t window_ids[RECONCILE_MAX];
+static uint32_t window_nonces[RECONCILE_MAX];
+
+static unsigned long sketches_sent = 0;
+static unsigned long sketches_received = 0;
+static unsigned long decoded = 0;
+static unsigned long failed = 0;
+static unsigned long differences = 0;
+
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/*******************/
+/*       Lock      */
+/*******************/
+
+static void lock(const char* func_name) {
+    if( pthread_mutex_lock(&mutex) != 0 ) {
+        perror(func_name);
+        exit(EXIT_FAILURE);
+    }
+}
+
+static void unlock(const char* func_name) {
+    if( pthread_mutex_unlock(&mutex) != 0 ) {
+        perror(func_name);
+        exit(EXIT_FAILURE);
+    }
+}
+
+/*******************/
+/*     Esquisse    */
+/*******************/
+
+static uint64_t mix(uint64_t x) {
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    x ^= x >> 33;
+    return x;
+}
+
+static uint64_t key_hash(uint64_t id, uint32_t nonce) {
+    return mix(id ^ mix(nonce));
+}
+
+// Empreinte de (id,nonce): une case ne contenant qu'un identifiant a pour
+// hash_sum l'empreinte de son id_sum et de son nonce_sum.
+static uint32_t check(uint64_t id, uint32_t nonce) {
+    return (uint32_t)(mix(key_hash(id, nonce) + 1) >> 32);
+}
+
+// Ajoute (sign = 1) ou retire (sign = -1) (id,nonce) de l'esquisse.
+static void toggle(struct cell cells[], uint64_t id, uint32_t nonce, int sign) {
+    uint64_t h = key_hash(id, nonce);
+    uint32_t c = check(id, nonce);
+
+    for(int k = 0; k < SKETCH_HASHES; k++) {
+        struct cell* cell = &cells[k * SUBTABLE + ((h >> (k * 21)) & 0x1FFFFF) % SUBTABLE];
+        cell->count += sign;
+        cell->id_sum ^= id;
+        cell->nonce_sum ^= nonce;
+        cell->hash_sum ^= c;
+    }
+}
+
+// Construit l'esquisse des donnees de la fenetre. Verrou pris.
+static void build_sketch(struct cell cells[]) {
+    memset(cells, 0, SKETCH_CELLS * sizeof(struct cell));
+
+    uint64_t now = timer_now();
+    if(now < RECONCILE_SETTLE)
+        return;
+
+    // Les donnees restaurees (date 0) ne sont jamais comparees.
+    uint64_t from = now > RECONCILE_AGE ? now - RECONCILE_AGE : 1;
+    int count = get_received_ids_between(window_ids, window_nonces, RECONCILE_MAX,
+                                         from, now - RECONCILE_SETTLE);
+    for(int i = 0; i < count; i++)
+        toggle(cells, window_ids[i], window_nonces[i], 1);
+}
+
+// Extrait les identifiants d'une difference d'esquisses (modifiee au
+// passage): signs[i] vaut 1 s'il n'est que dans la premiere et -1 s'il n'est
+// que dans la seconde. Renvoie leur nombre, ou -1 si la difference est trop
+// grande pour etre extraite.
+static int peel(struct cell cells[], uint64_t ids[], uint32_t nonces[], short signs[]) {
+    int count = 0;
+    short progress = 1;
+
+    while(progress) {
+        progress = 0;
+        for(int i = 0; i < SKETCH_CELLS; i++) {
+            struct cell* c = &cells[i];
+            if( (c->count != 1 && c->count != (uint16_t)-1)
+                || c->hash_sum != check(c->id_sum, c->nonce_sum) )
+                continue;
+
+            if(count == MAX_DIFFERENCES)
+                return -1;
+
+            ids[count] = c->id_sum;
+            nonces[count] = c->nonce_sum;
+            signs[count] = c->count == 1 ? 1 : -1;
+            toggle(cells, ids[count], nonces[count], -signs[count]);
+            count++;
+            progress = 1;
+        }
+    }
+
+    for(int i = 0; i < SKETCH_CELLS; i++)
+        if(cells[i].count != 0 || cells[i].id_sum != 0 || cells[i].nonce_sum != 0 || cells[i].hash_sum != 0)
+            return -1;
+
+    return count;
+}
+
+static void encode_cell(struct cell* c, uint8_t* buffer) {
+    memcpy(buffer, &c->count, 2);
+    memcpy(buffer + 2, &c->id_sum, 8);
+    memcpy(buffer + 10, &c->nonce_sum, 4);
+    memcpy(buffer + 14, &c->hash_sum, 4);
+}
+
+static void decode_cell(const uint8_t* buffer, struct cell* c) {
+    memcpy(&c->count, buffer, 2);
+    memcpy(&c->id_sum, buffer + 2, 8);
+    memcpy(&c->nonce_sum, buffer + 10, 4);
+    memcpy(&c->hash_sum, buffer + 14, 4);
+}
+
+/*******************/
+/*     Echanges    */
+/*******************/
+
+struct choice {
+    struct sockaddr_in6 dest;
+    int seen;
+};
+
+// Tirage uniforme d'un voisin symetrique, en un seul parcours.
+static void pick(struct neighbour* n, void* arg) {
+    struct choice* choice = (struct choice*)arg;
+    if( !is_symmetric(n) )
+        return;
+
+    choice->seen++;
+    if( random() % choice->seen == 0 )
+        get_sockaddr6(n, &choice->dest);
+}
+
+static void send_sketch(void* arg) {
+    (void)arg;
+    schedule_timer(exchange_timer, RECONCILE_INTERVAL);
+
+    struct choice choice;
+    choice.seen = 0;
+    for_each_neighbour(pick, &choice);
+    if(choice.seen == 0)
+        return;
+
+    struct cell cells[SKETCH_CELLS];
+    uint8_t buffer[SKETCH_CELLS * SKETCH_CELL_SIZE];
+
+    lock("send_sketch");
+    build_sketch(cells);
+    sketches_sent++;
+    unlock("send_sketch");
+
+    for(int i = 0; i < SKETCH_CELLS; i++)
+        encode_cell(&cells[i], buffer + i * SKETCH_CELL_SIZE);
+
+    struct msg* m = create_msg();
+    for(int i = 0; i < SKETCH_CELLS; i += MAX_SKETCH_CELLS) {
+        int k = SKETCH_CELLS - i < MAX_SKETCH_CELLS ? SKETCH_CELLS - i : MAX_SKETCH_CELLS;
+        add_sketch_tlv(m, i, buffer + i * SKETCH_CELL_SIZE, k);
+    }
+    send_msg_class(m, (struct sockaddr*)&choice.dest, sizeof(choice.dest), SEND_CONTROL);
+    destroy_msg(m);
+}
+
+void enable_reconcile() {
+    enabled = 1;
+
+    if(exchange_timer == NULL)
+        exchange_timer = create_timer(send_sketch, NULL);
+    schedule_timer(exchange_timer, RECONCILE_INTERVAL);
+}
+
+short reconcile_enabled() {
+    return enabled;
+}
+
+void reconcile_on_sketch(struct tlv* t, struct neighbour* from) {
+    if(!enabled || from == NULL)
+        return;
+
+    uint8_t first;
+    const uint8_t* buffer;
+    int count = get_sketch_cells(t, &first, &buffer);
+    if(count == 0 || first + count > SKETCH_CELLS)
+        return;
+
+    struct cell diff[SKETCH_CELLS];
+    uint64_t ids[MAX_DIFFERENCES];
+    uint32_t nonces[MAX_DIFFERENCES];
+    short signs[MAX_DIFFERENCES];
+
+    lock("reconcile_on_sketch");
+
+    // Une autre esquisse commence: la precedente ne sera pas completee.
+    if(incoming.ip != get_ip(from) || incoming.port != get_port(from)) {
+        incoming.ip = get_ip(from);
+        incoming.port = get_port(from);
+        memset(incoming.seen, 0, sizeof(incoming.seen));
+        incoming.seen_count = 0;
+    }
+
+    for(int i = 0; i < count; i++) {
+        decode_cell(buffer + i * SKETCH_CELL_SIZE, &incoming.cells[first + i]);
+        if( !incoming.seen[first + i] ) {
+            incoming.seen[first + i] = 1;
+            incoming.seen_count++;
+        }
+    }
+
+    if(incoming.seen_count < SKETCH_CELLS) {
+        unlock("reconcile_on_sketch");
+        return;
+    }
+
+    memset(incoming.seen, 0, sizeof(incoming.seen));
+    incoming.seen_count = 0;
+    sketches_received++;
+
+    // Difference: la sienne moins la notre.
+    build_sketch(diff);
+    for(int i = 0; i < SKETCH_CELLS; i++) {
+        diff[i].count = incoming.cells[i].count - diff[i].count;
+        diff[i].id_sum ^= incoming.cells[i].id_sum;
+        diff[i].nonce_sum ^= incoming.cells[i].nonce_sum;
+        diff[i].hash_sum ^= incoming.cells[i].hash_sum;
+    }
+
+    int found = peel(diff, ids, nonces, signs);
+    if(found < 0) {
+        failed++;
+    } else {
+        decoded++;
+        differences += found;
+    }
+
+    unlock("reconcile_on_sketch");
+
+    if(found < 0) {
+        if(debug)
+            printn("Anti-entropie: différence trop grande, rattrapage.");
+        start_catchup(from);
+        return;
+    }
+
+    if(found == 0)
+        return;
+
+    // Ce qui nous manque est demande, le reste lui est propose (il
+    // l'a peut-etre recu entre-temps).
+    uint64_t want_ids[MAX_DIFFERENCES], offer_ids[MAX_DIFFERENCES];
+    uint32_t want_nonces[MAX_DIFFERENCES], offer_nonces[MAX_DIFFERENCES];
+    int want = 0, offer = 0;
+
+    for(int i = 0; i < found; i++) {
+        if(signs[i] > 0) {
+            want_ids[want] = ids[i];
+            want_nonces[want++] = nonces[i];
+        } else {
+            offer_ids[offer] = ids[i];
+            offer_nonces[offer++] = nonces[i];
+        }
+    }
+
+    if(debug)
+        printn("Anti-entropie: %d données manquantes, %d proposées.", want, offer);
+
+    if(want > 0)
+        catchup_request(from, want_ids, want_nonces, want);
+    if(offer > 0)
+        catchup_offer(from, offer_ids, offer_nonces, offer);
+}
+
+/*******************/
+/*   Statistiques  */
+/*******************/
+
+void print_reconcile_stats() {
+    if(!enabled)
+        return;
+
+    lock("print_reconcile_stats");
+    unsigned long ss = sketches_sent, sr = sketches_received, dc = decoded, fl = failed, df = differences;
+    unlock("print_reconcile_stats");
+
+    printn("Anti-entropie: %lu esquisses envoyées, %lu reçues, %lu comparées (%lu différences), %lu trop différentes.",
+           ss, sr, dc, df, fl);
+}
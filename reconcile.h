@@ -0,0 +1,55 @@
+#ifndef RECONCILE_H
+#define RECONCILE_H
+
+#include "neighbour.h"
+#include "tlv.h"
+
+/*
+ * Anti-entropie par reconciliation d'ensembles: toutes les
+ * RECONCILE_INTERVAL ms, on envoie a un voisin symetrique tire au hasard une
+ * esquisse (table de Bloom inversible, IBLT) des identifiants (emetteur,
+ * nonce) des donnees recues il y a entre RECONCILE_SETTLE et RECONCILE_AGE
+ * ms. Le voisin en soustrait la sienne: il reste la difference symetrique
+ * des deux ensembles, que l'on sait extraire tant qu'elle ne depasse pas
+ * quelques dizaines de donnees, quelle que soit la taille des ensembles.
+ * Il demande (Request) celles qui lui manquent et nous propose (Summary)
+ * celles qui nous manquent; si la difference est trop grande, il se rabat
+ * sur le rattrapage. L'esquisse tient dans un seul datagramme.
+ *
+ * Avec l'anti-entropie, l'innondation renvoie moins souvent une donnee non
+ * acquittee et les acquittements sont regroupes plus longtemps.
+ */
+
+// Periode (ms) des echanges d'esquisses.
+#define RECONCILE_INTERVAL 2000
+
+// Fenetre (ms) des donnees comparees: ni trop anciennes, ni encore en route.
+#define RECONCILE_AGE 60000
+#define RECONCILE_SETTLE 1000
+
+// Nombre de cases d'une esquisse (3 sous-tables de 20).
+#define SKETCH_CELLS 60
+
+/*
+ * Active l'anti-entropie. (Tous les pairs devraient l'activer.)
+ */
+void enable_reconcile();
+
+/*
+ * Renvoie 1 si l'anti-entropie est activee et 0 sinon.
+ */
+short reconcile_enabled();
+
+/*
+ * Traite un tlv Sketch envoye par 'from' (ignore si ce n'est pas un voisin).
+ * L'esquisse est comparee quand toutes ses cases sont arrivees.
+ */
+void reconcile_on_sketch(struct tlv* t, struct neighbour* from);
+
+/*
+ * Affiche le nombre d'esquisses echangees, comparees ou non, et la taille
+ * des differences trouvees.
+ */
+void print_reconcile_stats();
+
+#endif /* RECONCILE_H */
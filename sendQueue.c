@@ -0,0 +1,277 @@
+#define _GNU_SOURCE
+
+#include "sendQueue.h"
+
+#include "info.h"
+#include "inputReader.h"
+#include "socketMonitor.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <time.h>
+
+#include <sys/socket.h>
+
+// Nombre maximal de paquets envoyes par appel a sendmmsg.
+#define SEND_BATCH 32
+
+static short debug = 0;
+
+struct packet {
+    struct packet* next;
+    struct sockaddr_in6 dest;
+    size_t len;
+    uint8_t data[];
+};
+
+struct queue {
+    struct packet* head;
+    struct packet* tail;
+    int length;
+};
+
+// Taille maximale de chaque file.
+static const int capacities[SEND_CLASSES] = {1024, 4096, 4096, 4096};
+
+static const char* class_names[SEND_CLASSES] = {"hello", "contrôle", "données", "retransmissions"};
+
+static struct queue queues[SEND_CLASSES];
+static int pending = 0;
+// Paquets en cours d'envoi (sortis de la file).
+static int sending = 0;
+
+// Nouvelles donnees envoyees depuis la derniere retransmission.
+static int data_turns = 0;
+
+static unsigned long sent[SEND_CLASSES];
+static unsigned long dropped[SEND_CLASSES];
+
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t not_empty = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t drained = PTHREAD_COND_INITIALIZER;
+
+/*******************/
+/*       Lock      */
+/*******************/
+
+static void lock(const char* func_name) {
+    if( pthread_mutex_lock(&mutex) != 0 ) {
+        perror(func_name);
+        exit(EXIT_FAILURE);
+    }
+}
+
+static void unlock(const char* func_name) {
+    if( pthread_mutex_unlock(&mutex) != 0 ) {
+        perror(func_name);
+        exit(EXIT_FAILURE);
+    }
+}
+
+/*******************/
+/*      Files      */
+/*******************/
+
+struct packet* create_packet(size_t len, const struct sockaddr_in6* dest) {
+    struct packet* p = malloc(sizeof(struct packet) + len);
+    if(p == NULL) {
+        fprintf(stderr, "malloc() failed.");
+        exit(1);
+    }
+
+    p->next = NULL;
+    p->dest = *dest;
+    p->len = len;
+    return p;
+}
+
+uint8_t* packet_data(struct packet* p) {
+    return p->data;
+}
+
+short enqueue(struct packet* p, int class) {
+    lock("enqueue");
+
+    struct queue* q = &queues[class];
+    if(q->length >= capacities[class]) {
+        dropped[class]++;
+        unlock("enqueue");
+        free(p);
+        return 0;
+    }
+
+    if(q->tail == NULL)
+        q->head = p;
+    else
+        q->tail->next = p;
+    q->tail = p;
+    q->length++;
+    pending++;
+
+    pthread_cond_signal(&not_empty);
+    unlock("enqueue");
+
+    return 1;
+}
+
+static struct packet* pop(int class) {
+    struct queue* q = &queues[class];
+    struct packet* p = q->head;
+
+    q->head = p->next;
+    if(q->head == NULL)
+        q->tail = NULL;
+    q->length--;
+    pending--;
+    sent[class]++;
+
+    return p;
+}
+
+// Choisit le prochain paquet a envoyer (verrou pris, au moins un paquet en attente).
+static struct packet* next_packet() {
+    if(queues[SEND_LIVENESS].length > 0)
+        return pop(SEND_LIVENESS);
+
+    if(queues[SEND_CONTROL].length > 0)
+        return pop(SEND_CONTROL);
+
+    // Les retransmissions ont leur tour tous les SEND_DATA_WEIGHT envois
+    // de nouvelles donnees, pour ne jamais etre affamees.
+    if( queues[SEND_RETRANSMIT].length > 0
+        && (queues[SEND_DATA].length == 0 || data_turns >= SEND_DATA_WEIGHT) ) {
+        data_turns = 0;
+        return pop(SEND_RETRANSMIT);
+    }
+
+    data_turns++;
+    return pop(SEND_DATA);
+}
+
+/*******************/
+/*      Envoi      */
+/*******************/
+
+// Envoie les count paquets, en attendant que la socket se libere si besoin.
+static void send_batch(struct packet* batch[], int count) {
+    struct mmsghdr hdrs[SEND_BATCH];
+    struct iovec iovs[SEND_BATCH];
+    memset(hdrs, 0, sizeof(hdrs));
+
+    for(int i = 0; i < count; i++) {
+        iovs[i].iov_base = batch[i]->data;
+        iovs[i].iov_len = batch[i]->len;
+
+        hdrs[i].msg_hdr.msg_name = &batch[i]->dest;
+        hdrs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in6);
+        hdrs[i].msg_hdr.msg_iov = &iovs[i];
+        hdrs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    int s = get_socket();
+    int done = 0;
+
+    while(done < count) {
+        int rc = sendmmsg(s, hdrs+done, count-done, 0);
+
+        if(rc < 0) {
+            // Interrompu par un signal: rien n'est parti.
+            if(errno == EINTR)
+                continue;
+
+            if(errno == EAGAIN || errno == EWOULDBLOCK) {
+                // La socket est pleine, on attend qu'elle se libere.
+                record_send_blocked();
+                struct pollfd pfd = { s, POLLOUT, 0 };
+                poll(&pfd, 1, 1000);
+                continue;
+            }
+
+            // Destination injoignable: on passe au paquet suivant.
+            if(debug)
+                perror("sendmmsg");
+            done++;
+            continue;
+        }
+
+        done += rc;
+    }
+}
+
+static void* sender_t(void* arg) {
+    (void)arg;
+    struct packet* batch[SEND_BATCH];
+
+    while(1) {
+        lock("sender_t");
+        while(pending == 0)
+            pthread_cond_wait(&not_empty, &mutex);
+
+        int count = 0;
+        while(pending > 0 && count < SEND_BATCH)
+            batch[count++] = next_packet();
+        sending = count;
+        unlock("sender_t");
+
+        send_batch(batch, count);
+
+        for(int i = 0; i < count; i++)
+            free(batch[i]);
+
+        lock("sender_t");
+        sending = 0;
+        if(pending == 0)
+            pthread_cond_broadcast(&drained);
+        unlock("sender_t");
+    }
+
+    return NULL;
+}
+
+short flush_send_queue(int timeout) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += timeout / 1000;
+    deadline.tv_nsec += (timeout % 1000) * 1000000L;
+    if(deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+
+    lock("flush_send_queue");
+    int rc = 0;
+    while( (pending > 0 || sending > 0) && rc != ETIMEDOUT )
+        rc = pthread_cond_timedwait(&drained, &mutex, &deadline);
+    short empty = pending == 0 && sending == 0;
+    unlock("flush_send_queue");
+
+    return empty;
+}
+
+void start_send_queue() {
+    pthread_t thread;
+
+    int rc = pthread_create(&thread, NULL, sender_t, NULL);
+    if(rc != 0) {
+        fprintf(stderr, "Error: Thread create\n");
+        exit(EXIT_FAILURE);
+    }
+
+    pthread_detach(thread);
+}
+
+/*******************/
+/*   Statistiques  */
+/*******************/
+
+void print_send_queue_stats() {
+    lock("print_send_queue_stats");
+    printn("File d'envoi:");
+    for(int c = 0; c < SEND_CLASSES; c++)
+        printn("  %-16s %lu envoyés, %lu perdus, %d en attente.", class_names[c], sent[c], dropped[c], queues[c].length);
+    unlock("print_send_queue_stats");
+}
@@ -0,0 +1,59 @@
+#ifndef SEND_QUEUE_H
+#define SEND_QUEUE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <netinet/in.h>
+
+/*
+ * File d'envoi: les messages sont envoyes par un thread dedie, par lots
+ * (sendmmsg), dans l'ordre de priorite de leur classe. Les hellos et les
+ * acquittements passent toujours avant les donnees; les nouvelles donnees
+ * et les retransmissions se partagent le reste (SEND_DATA_WEIGHT pour 1).
+ */
+
+/*
+ * Classes d'envoi, de la plus prioritaire a la moins prioritaire.
+ */
+enum send_class {SEND_LIVENESS, SEND_CONTROL, SEND_DATA, SEND_RETRANSMIT, SEND_CLASSES};
+
+// Nombre de nouvelles donnees envoyees pour une retransmission.
+#define SEND_DATA_WEIGHT 3
+
+/*
+ * Demarre le thread d'envoi (sur la socket de info.h).
+ */
+void start_send_queue();
+
+struct packet;
+
+/*
+ * Cree un paquet (non initialise) de len octets a destination de dest, a
+ * remplir via packet_data() puis a mettre en file par enqueue().
+ */
+struct packet* create_packet(size_t len, const struct sockaddr_in6* dest);
+
+/*
+ * Renvoie le contenu du paquet p.
+ */
+uint8_t* packet_data(struct packet* p);
+
+/*
+ * Met le paquet p en file (la file en devient proprietaire).
+ * Renvoie 0 si la file de sa classe est pleine (le paquet est perdu) et 1 sinon.
+ */
+short enqueue(struct packet* p, int class);
+
+/*
+ * Attend (au plus timeout ms) que tous les paquets en file soient partis.
+ * Renvoie 1 si la file est vide et 0 sinon.
+ */
+short flush_send_queue(int timeout);
+
+/*
+ * Affiche les compteurs de la file (envoyes, perdus, en attente par classe).
+ */
+void print_send_queue_stats();
+
+#endif /* SEND_QUEUE_H */
@@ -0,0 +1,265 @@
+#include "snapshot.h"
+
+#include "info.h"
+#include "idGenerator.h"
+#include "message.h"
+#include "neighbour.h"
+#include "neighbourManager.h"
+#include "dataManager.h"
+#include "inputReader.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+
+#include <arpa/inet.h>
+
+#define SNAPSHOT_MAGIC 0x50325053
+#define SNAPSHOT_VERSION 1
+#define SNAPSHOT_MAX_PEERS 256
+#define SNAPSHOT_MAX_DATA 64
+#define SNAPSHOT_INTERVAL 10
+
+// Ecart ajoute au nonce restaure: les donnees envoyees apres la derniere
+// sauvegarde ne doivent pas etre prises pour des doublons.
+#define NONCE_RESTORE_GAP 4096
+
+static short debug = 0;
+
+struct snapshot_peer {
+    uint128_t ip;
+    uint64_t id;
+    uint64_t hello_date;
+    uint64_t long_hello_date;
+    uint16_t port;
+    uint8_t is_neighbour;
+};
+
+struct snapshot_data {
+    uint64_t id;
+    uint32_t nonce;
+};
+
+// Image du fichier. 'magic' est ecrit en dernier: un snapshot
+// interrompu en cours d'ecriture est ignore au chargement.
+struct snapshot {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t local_port;
+    uint64_t my_id;
+    uint64_t saved_at;
+    uint32_t nonce;
+    uint16_t peer_count;
+    uint16_t data_count;
+    struct snapshot_peer peers[SNAPSHOT_MAX_PEERS];
+    struct snapshot_data data[SNAPSHOT_MAX_DATA];
+};
+
+static struct snapshot* snap = NULL;
+
+// Garde le verrou sur le fichier tant que le snapshot est ouvert.
+static int snap_fd = -1;
+static long last_snapshot = 0;
+
+/*******************/
+/*    Ouverture    */
+/*******************/
+
+short open_snapshot(const char* path) {
+    int fd = open(path, O_RDWR | O_CREAT, 0600);
+    if(fd < 0) {
+        perror("open_snapshot: open");
+        return 0;
+    }
+
+    // Deux pairs qui partageraient un snapshot prendraient le meme id.
+    if( flock(fd, LOCK_EX | LOCK_NB) < 0 ) {
+        if(errno == EWOULDBLOCK)
+            fprintf(stderr, "Snapshot %s déjà utilisé par un autre pair: ignoré.\n", path);
+        else
+            perror("open_snapshot: flock");
+        close(fd);
+        return 0;
+    }
+
+    if( ftruncate(fd, sizeof(struct snapshot)) < 0 ) {
+        perror("open_snapshot: ftruncate");
+        close(fd);
+        return 0;
+    }
+
+    void* p = mmap(NULL, sizeof(struct snapshot), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+    if(p == MAP_FAILED) {
+        perror("open_snapshot: mmap");
+        close(fd);
+        return 0;
+    }
+
+    snap = p;
+    snap_fd = fd;
+    return 1;
+}
+
+/*******************/
+/*   Restauration  */
+/*******************/
+
+static short is_valid() {
+    return snap != NULL
+        && snap->magic == SNAPSHOT_MAGIC
+        && snap->version == SNAPSHOT_VERSION
+        && snap->peer_count <= SNAPSHOT_MAX_PEERS
+        && snap->data_count <= SNAPSHOT_MAX_DATA;
+}
+
+int restore_snapshot() {
+    if( !is_valid() )
+        return 0;
+
+    // On reprend notre identite pour que nos voisins nous reconnaissent.
+    set_my_id(snap->my_id);
+    set_my_nonce(snap->nonce + NONCE_RESTORE_GAP);
+
+    // Et si possible notre port, pour que leurs entrees restent valides.
+    if(snap->local_port != 0) {
+        struct sockaddr_in6 local;
+        memset(&local, 0, sizeof(local));
+        local.sin6_family = AF_INET6;
+        local.sin6_port = snap->local_port;
+        local.sin6_addr = in6addr_any;
+        if( bind(get_socket(), (struct sockaddr*)&local, sizeof(local)) < 0 && debug )
+            perror("restore_snapshot: bind");
+    }
+
+    // Les donnees sont ajoutees de la plus ancienne a la plus recente.
+    for(int i = snap->data_count-1; i >= 0; i--)
+        add_received_id(snap->data[i].id, snap->data[i].nonce);
+
+    struct msg* msgs[SNAPSHOT_MAX_PEERS];
+    struct sockaddr_in6 dests[SNAPSHOT_MAX_PEERS];
+    int count = 0;
+
+    struct msg* hello_short = create_msg();
+    add_hello_short_tlv(hello_short, get_my_id());
+
+    for(int i = 0; i < snap->peer_count; i++) {
+        struct snapshot_peer* p = &snap->peers[i];
+        struct neighbour* n = create_neighbour(p->ip, p->port, p->id);
+
+        if(p->is_neighbour) {
+            // Pas symetrique tant qu'il ne nous a pas renvoye de hello long.
+            set_hello_dates(n, p->hello_date, 0);
+            if( !add_neighbour(n) ) {
+                destroy_neighbour(n);
+                continue;
+            }
+            msgs[count] = create_msg();
+            add_hello_long_tlv(msgs[count], get_my_id(), p->id);
+        } else {
+            set_hello_dates(n, p->hello_date, p->long_hello_date);
+            if( !add_potential_neighbour(n) ) {
+                destroy_neighbour(n);
+                continue;
+            }
+            msgs[count] = hello_short;
+        }
+
+        get_sockaddr6(n, &dests[count]);
+        count++;
+    }
+
+    int sent = send_msg_batch(msgs, dests, count);
+
+    for(int i = 0; i < count; i++)
+        if(msgs[i] != hello_short)
+            destroy_msg(msgs[i]);
+    destroy_msg(hello_short);
+
+    if(debug)
+        printn("Snapshot restaure: %d pairs, %d donnees, %d hellos envoyes.", count, snap->data_count, sent);
+
+    return sent;
+}
+
+/*******************/
+/*   Sauvegarde    */
+/*******************/
+
+static short neighbour_flag = 1;
+static short potential_flag = 0;
+
+static void save_peer(struct neighbour* n, void* flag) {
+    if(snap->peer_count >= SNAPSHOT_MAX_PEERS)
+        return;
+
+    struct snapshot_peer* p = &snap->peers[snap->peer_count++];
+    p->ip = get_ip(n);
+    p->port = get_port(n);
+    p->id = get_id(n);
+    p->hello_date = get_hello_date(n);
+    p->long_hello_date = get_longHello_date(n);
+    p->is_neighbour = *(short*)flag;
+}
+
+void save_snapshot() {
+    if(snap == NULL)
+        return;
+
+    snap->magic = 0;
+    snap->version = SNAPSHOT_VERSION;
+    snap->my_id = get_my_id();
+    snap->nonce = get_my_nonce();
+    snap->saved_at = time(NULL);
+
+    struct sockaddr_in6 local;
+    socklen_t len = sizeof(local);
+    if( getsockname(get_socket(), (struct sockaddr*)&local, &len) == 0 )
+        snap->local_port = local.sin6_port;
+
+    // Les voisins passent avant les voisins potentiels si la place manque.
+    snap->peer_count = 0;
+    for_each_neighbour(save_peer, &neighbour_flag);
+    for_each_potential_neighbour(save_peer, &potential_flag);
+
+    uint64_t ids[SNAPSHOT_MAX_DATA];
+    uint32_t nonces[SNAPSHOT_MAX_DATA];
+    snap->data_count = get_received_ids(ids, nonces, SNAPSHOT_MAX_DATA);
+    for(int i = 0; i < snap->data_count; i++) {
+        snap->data[i].id = ids[i];
+        snap->data[i].nonce = nonces[i];
+    }
+
+    snap->magic = SNAPSHOT_MAGIC;
+    msync(snap, sizeof(struct snapshot), MS_ASYNC);
+}
+
+void snapshot_maintenance() {
+    if( time(NULL) - last_snapshot >= SNAPSHOT_INTERVAL ) {
+        last_snapshot = time(NULL);
+        save_snapshot();
+    }
+}
+
+/*******************/
+/*    Fermeture    */
+/*******************/
+
+void close_snapshot() {
+    if(snap == NULL)
+        return;
+
+    save_snapshot();
+    msync(snap, sizeof(struct snapshot), MS_SYNC);
+    munmap(snap, sizeof(struct snapshot));
+    snap = NULL;
+    close(snap_fd);
+    snap_fd = -1;
+}
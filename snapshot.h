@@ -0,0 +1,36 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+/*
+ * Ouvre (ou cree) le fichier de snapshot 'path', le verrouille et le
+ * projette en memoire.
+ * Renvoie 1 si le fichier est utilisable et 0 sinon (en particulier s'il est
+ * deja verrouille par un autre pair).
+ */
+short open_snapshot(const char* path);
+
+/*
+ * Restaure l'etat sauvegarde dans le snapshot (id, nonce, port local,
+ * voisins, voisins potentiels et ids des donnees recues) puis envoie
+ * un hello a tous les pairs connus en un seul lot.
+ * A appeler avant tout autre envoie sur la socket.
+ * Renvoie le nombre de pairs contactes.
+ */
+int restore_snapshot();
+
+/*
+ * Ecrit l'etat courant dans le snapshot.
+ */
+void save_snapshot();
+
+/*
+ * Ecrit l'etat courant dans le snapshot. (avec un interval minimum)
+ */
+void snapshot_maintenance();
+
+/*
+ * Ecrit une derniere fois le snapshot et ferme le fichier.
+ */
+void close_snapshot();
+
+#endif /* SNAPSHOT_H */
@@ -0,0 +1,158 @@
+#include "socketMonitor.h"
+
+#include "inputReader.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
+
+#include <sys/socket.h>
+
+// Les tampons sont agrandis au plus une fois par seconde.
+#define GROWTH_INTERVAL 1
+
+static short debug = 0;
+
+static int sock = -1;
+
+struct buffer {
+    const char* name;
+    int option;
+    int force_option;
+    int size;                // Taille effective (en octets).
+    short capped;            // Le noyau refuse d'aller plus haut.
+    int growths;
+    unsigned long events;    // Pertes ou attentes depuis le debut.
+    unsigned long pending;   // ... depuis le dernier agrandissement.
+};
+
+static struct buffer rcv = { "de réception", SO_RCVBUF, SO_RCVBUFFORCE, 0, 0, 0, 0, 0 };
+static struct buffer snd = { "d'envoi", SO_SNDBUF, SO_SNDBUFFORCE, 0, 0, 0, 0, 0 };
+
+static uint32_t last_counter = 0;
+static long last_maintenance = 0;
+
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/*******************/
+/*       Lock      */
+/*******************/
+
+static void lock(const char* func_name) {
+    if( pthread_mutex_lock(&mutex) != 0 ) {
+        perror(func_name);
+        exit(EXIT_FAILURE);
+    }
+}
+
+static void unlock(const char* func_name) {
+    if( pthread_mutex_unlock(&mutex) != 0 ) {
+        perror(func_name);
+        exit(EXIT_FAILURE);
+    }
+}
+
+/*******************/
+/*     Tampons     */
+/*******************/
+
+// Demande 'size' octets pour b et enregistre la taille obtenue.
+static void set_buffer(struct buffer* b, int size) {
+    // La version "force" depasse net.core.[rw]mem_max si on en a le droit.
+    if( setsockopt(sock, SOL_SOCKET, b->force_option, &size, sizeof(size)) < 0 )
+        setsockopt(sock, SOL_SOCKET, b->option, &size, sizeof(size));
+
+    int actual = 0;
+    socklen_t len = sizeof(actual);
+    if( getsockopt(sock, SOL_SOCKET, b->option, &actual, &len) < 0 ) {
+        perror("getsockopt");
+        return;
+    }
+
+    // Linux double la taille demandee (pour ses propres structures).
+    actual /= 2;
+    b->capped = actual <= b->size || actual < size;
+    b->size = actual;
+}
+
+static void grow(struct buffer* b) {
+    if( b->pending == 0 || b->capped || b->size >= SOCKET_BUFFER_MAX )
+        return;
+
+    int old = b->size;
+    int size = b->size * 2 < SOCKET_BUFFER_MAX ? b->size * 2 : SOCKET_BUFFER_MAX;
+    set_buffer(b, size);
+    b->pending = 0;
+
+    if(b->size > old)
+        b->growths++;
+
+    if(debug || b->capped)
+        printn("Tampon %s: %d -> %d octets%s.", b->name, old, b->size,
+               b->capped ? " (limite du noyau atteinte, cf. net.core.rmem_max/wmem_max)" : "");
+}
+
+void init_socket_monitor(int s, int size) {
+    sock = s;
+
+    int on = 1;
+    if( setsockopt(sock, SOL_SOCKET, SO_RXQ_OVFL, &on, sizeof(on)) < 0 )
+        perror("setsockopt(SO_RXQ_OVFL)");
+
+    if(size <= 0)
+        size = SOCKET_BUFFER_DEFAULT;
+
+    set_buffer(&rcv, size);
+    set_buffer(&snd, size);
+    rcv.capped = snd.capped = 0;
+
+    if(debug)
+        printn("Tampons: réception %d octets, envoi %d octets.", rcv.size, snd.size);
+}
+
+/*******************/
+/*    Mesures      */
+/*******************/
+
+void record_rx_drops(uint32_t drops) {
+    lock("record_rx_drops");
+    uint32_t lost = drops - last_counter;
+    last_counter = drops;
+    rcv.events += lost;
+    rcv.pending += lost;
+    unlock("record_rx_drops");
+}
+
+void record_send_blocked() {
+    lock("record_send_blocked");
+    snd.events++;
+    snd.pending++;
+    unlock("record_send_blocked");
+}
+
+void socket_maintenance() {
+    if( sock < 0 || time(NULL) - last_maintenance < GROWTH_INTERVAL )
+        return;
+
+    last_maintenance = time(NULL);
+
+    lock("socket_maintenance");
+    grow(&rcv);
+    grow(&snd);
+    unlock("socket_maintenance");
+}
+
+/*******************/
+/*   Statistiques  */
+/*******************/
+
+void print_socket_stats() {
+    lock("print_socket_stats");
+    printn("Socket:");
+    printn("  réception: %d octets (%d agrandissements), %lu datagrammes jetés par le noyau.",
+           rcv.size, rcv.growths, rcv.events);
+    printn("  envoi:     %d octets (%d agrandissements), %lu attentes de place.",
+           snd.size, snd.growths, snd.events);
+    unlock("print_socket_stats");
+}
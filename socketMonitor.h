@@ -0,0 +1,46 @@
+#ifndef SOCKET_MONITOR_H
+#define SOCKET_MONITOR_H
+
+#include <stdint.h>
+
+/*
+ * Surveillance de la socket: le noyau nous donne le nombre de datagrammes
+ * qu'il a jetes faute de place (SO_RXQ_OVFL). Les tampons de reception et
+ * d'envoi grossissent quand des pertes ou des attentes apparaissent.
+ */
+
+// Taille initiale des tampons (en octets) si aucune n'est donnee.
+#define SOCKET_BUFFER_DEFAULT (256 * 1024)
+
+// Taille maximale des tampons apres agrandissement.
+#define SOCKET_BUFFER_MAX (16 * 1024 * 1024)
+
+/*
+ * Active le comptage des pertes et fixe la taille des tampons de la socket
+ * s a 'size' octets (SOCKET_BUFFER_DEFAULT si 0).
+ */
+void init_socket_monitor(int s, int size);
+
+/*
+ * Enregistre le compteur de pertes (cumule) donne par le noyau avec un
+ * datagramme recu.
+ */
+void record_rx_drops(uint32_t drops);
+
+/*
+ * Enregistre que l'envoi a du attendre que la socket se libere.
+ */
+void record_send_blocked();
+
+/*
+ * Agrandit les tampons si des pertes ou des attentes ont eu lieu depuis
+ * le dernier appel.
+ */
+void socket_maintenance();
+
+/*
+ * Affiche la taille des tampons et les compteurs de pertes.
+ */
+void print_socket_stats();
+
+#endif /* SOCKET_MONITOR_H */
@@ -0,0 +1,225 @@
+#include "spsc.h"
+
+#include "inputReader.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <errno.h>
+#include <time.h>
+
+#define CACHE_LINE 64
+
+struct spsc {
+    // Cote consommateur.
+    _Alignas(CACHE_LINE) atomic_size_t head;
+    size_t tail_cache;              // Derniere valeur lue de tail.
+
+    // Cote producteur.
+    _Alignas(CACHE_LINE) atomic_size_t tail;
+    size_t head_cache;              // Derniere valeur lue de head.
+    atomic_ulong pushed;
+    atomic_ulong full;
+    atomic_ulong max_depth;
+
+    // Attentes (chemin lent).
+    _Alignas(CACHE_LINE) atomic_int sleepers;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+
+    const char* name;
+    size_t mask;
+    void** slots;
+};
+
+/*******************/
+/*  Constructeur   */
+/*******************/
+
+struct spsc* create_spsc(const char* name, int capacity) {
+    if(capacity <= 0 || (capacity & (capacity - 1)) != 0) {
+        fprintf(stderr, "create_spsc: capacité invalide (%d).\n", capacity);
+        exit(EXIT_FAILURE);
+    }
+
+    struct spsc* r = aligned_alloc(CACHE_LINE, sizeof(struct spsc));
+    void** slots = malloc(capacity * sizeof(void*));
+    if(r == NULL || slots == NULL) {
+        fprintf(stderr, "malloc() failed.");
+        exit(1);
+    }
+
+    memset(r, 0, sizeof(struct spsc));
+    atomic_init(&r->head, 0);
+    atomic_init(&r->tail, 0);
+    atomic_init(&r->pushed, 0);
+    atomic_init(&r->full, 0);
+    atomic_init(&r->max_depth, 0);
+    atomic_init(&r->sleepers, 0);
+    pthread_mutex_init(&r->mutex, NULL);
+    pthread_cond_init(&r->cond, NULL);
+
+    r->name = name;
+    r->mask = capacity - 1;
+    r->slots = slots;
+    return r;
+}
+
+/*******************/
+/*   Destructeur   */
+/*******************/
+
+void destroy_spsc(struct spsc* r) {
+    pthread_mutex_destroy(&r->mutex);
+    pthread_cond_destroy(&r->cond);
+    free(r->slots);
+    free(r);
+}
+
+/*******************/
+/*    Attentes     */
+/*******************/
+
+// Reveille l'autre cote s'il attend. Les indices et sleepers sont
+// sequentiellement coherents: soit l'attente voit le nouvel indice, soit on
+// la voit ici.
+static void wake(struct spsc* r) {
+    if( atomic_load(&r->sleepers) == 0 )
+        return;
+
+    pthread_mutex_lock(&r->mutex);
+    pthread_cond_broadcast(&r->cond);
+    pthread_mutex_unlock(&r->mutex);
+}
+
+static short not_full(struct spsc* r) {
+    return atomic_load(&r->tail) - atomic_load(&r->head) <= r->mask;
+}
+
+static short not_empty(struct spsc* r) {
+    return atomic_load(&r->tail) != atomic_load(&r->head);
+}
+
+// Attend (au plus timeout ms, sans limite si timeout < 0) que ready(r) soit vrai.
+static void wait_for(struct spsc* r, short (*ready)(struct spsc*), int timeout) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += timeout / 1000;
+    deadline.tv_nsec += (long)(timeout % 1000) * 1000000;
+    if(deadline.tv_nsec >= 1000000000) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000;
+    }
+
+    pthread_mutex_lock(&r->mutex);
+    atomic_fetch_add(&r->sleepers, 1);
+    while( !ready(r) ) {
+        if(timeout < 0)
+            pthread_cond_wait(&r->cond, &r->mutex);
+        else if( pthread_cond_timedwait(&r->cond, &r->mutex, &deadline) == ETIMEDOUT )
+            break;
+    }
+    atomic_fetch_sub(&r->sleepers, 1);
+    pthread_mutex_unlock(&r->mutex);
+}
+
+/*******************/
+/*   Producteur    */
+/*******************/
+
+static short try_push(struct spsc* r, void* item) {
+    size_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+
+    // head n'est relu (ligne de cache du consommateur) que si la file
+    // semble pleine.
+    if(tail - r->head_cache > r->mask) {
+        r->head_cache = atomic_load(&r->head);
+        if(tail - r->head_cache > r->mask)
+            return 0;
+    }
+
+    r->slots[tail & r->mask] = item;
+    atomic_store(&r->tail, tail + 1);
+
+    atomic_store_explicit(&r->pushed, atomic_load_explicit(&r->pushed, memory_order_relaxed) + 1,
+                          memory_order_relaxed);
+
+    // Meme principe pour la profondeur maximale.
+    unsigned long max = atomic_load_explicit(&r->max_depth, memory_order_relaxed);
+    if(tail + 1 - r->head_cache > max) {
+        r->head_cache = atomic_load(&r->head);
+        if(tail + 1 - r->head_cache > max)
+            atomic_store_explicit(&r->max_depth, tail + 1 - r->head_cache, memory_order_relaxed);
+    }
+
+    wake(r);
+    return 1;
+}
+
+static void count_full(struct spsc* r) {
+    atomic_store_explicit(&r->full, atomic_load_explicit(&r->full, memory_order_relaxed) + 1,
+                          memory_order_relaxed);
+}
+
+short spsc_push(struct spsc* r, void* item) {
+    if( try_push(r, item) )
+        return 1;
+
+    count_full(r);
+    return 0;
+}
+
+void spsc_push_wait(struct spsc* r, void* item) {
+    if( try_push(r, item) )
+        return;
+
+    count_full(r);
+    while( !try_push(r, item) )
+        wait_for(r, not_full, 100);
+}
+
+/*******************/
+/*  Consommateur   */
+/*******************/
+
+void* spsc_pop(struct spsc* r) {
+    size_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+
+    if(head == r->tail_cache) {
+        r->tail_cache = atomic_load(&r->tail);
+        if(head == r->tail_cache)
+            return NULL;
+    }
+
+    void* item = r->slots[head & r->mask];
+    atomic_store(&r->head, head + 1);
+
+    wake(r);
+    return item;
+}
+
+void* spsc_pop_wait(struct spsc* r, int timeout) {
+    void* item = spsc_pop(r);
+    if(item != NULL)
+        return item;
+
+    wait_for(r, not_empty, timeout);
+    return spsc_pop(r);
+}
+
+/*******************/
+/*   Statistiques  */
+/*******************/
+
+int spsc_depth(struct spsc* r) {
+    size_t head = atomic_load(&r->head);
+    return atomic_load(&r->tail) - head;
+}
+
+void print_spsc_stats(struct spsc* r) {
+    printn("  %-16s %d/%lu en attente (au plus %lu), %lu passés, pleine %lu fois.",
+           r->name, spsc_depth(r), r->mask + 1, atomic_load(&r->max_depth),
+           atomic_load(&r->pushed), atomic_load(&r->full));
+}
@@ -0,0 +1,58 @@
+#ifndef SPSC_H
+#define SPSC_H
+
+/*
+ * File bornee sans verrou a un seul producteur et un seul consommateur
+ * (anneau de pointeurs). push et pop ne prennent aucun verrou; seules les
+ * attentes (file pleine pour le producteur, vide pour le consommateur)
+ * passent par une variable de condition. La file compte ses passages, les
+ * fois ou elle a ete trouvee pleine et sa profondeur maximale.
+ */
+
+struct spsc;
+
+/*
+ * Cree une file nommee 'name' de 'capacity' places (une puissance de 2).
+ */
+struct spsc* create_spsc(const char* name, int capacity);
+
+/*
+ * Libere la file r (qui doit etre vide).
+ */
+void destroy_spsc(struct spsc* r);
+
+/*
+ * Ajoute item (non NULL) a la file. Renvoie 0 si elle est pleine et 1 sinon.
+ * (Producteur seulement.)
+ */
+short spsc_push(struct spsc* r, void* item);
+
+/*
+ * Ajoute item a la file, en attendant qu'une place se libere si elle est
+ * pleine. (Producteur seulement.)
+ */
+void spsc_push_wait(struct spsc* r, void* item);
+
+/*
+ * Retire et renvoie le plus ancien element de la file, ou NULL si elle est
+ * vide. (Consommateur seulement.)
+ */
+void* spsc_pop(struct spsc* r);
+
+/*
+ * Comme spsc_pop(), en attendant au plus timeout ms qu'un element arrive.
+ */
+void* spsc_pop_wait(struct spsc* r, int timeout);
+
+/*
+ * Renvoie le nombre d'elements dans la file.
+ */
+int spsc_depth(struct spsc* r);
+
+/*
+ * Affiche la profondeur courante et maximale de la file, le nombre
+ * d'elements passes et le nombre de fois ou elle etait pleine.
+ */
+void print_spsc_stats(struct spsc* r);
+
+#endif /* SPSC_H */
@@ -0,0 +1,307 @@
+#include "timerWheel.h"
+
+#include "inputReader.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
+
+#define WHEEL_BITS 8
+#define WHEEL_SIZE (1 << WHEEL_BITS)
+#define WHEEL_MASK (WHEEL_SIZE - 1)
+#define WHEEL_LEVELS 4
+
+// Plus grand delai representable (les delais plus longs sont tronques).
+#define WHEEL_SPAN ((1ULL << (WHEEL_BITS * WHEEL_LEVELS)) - 1)
+
+static short debug = 0;
+
+struct timer {
+    struct timer* next;       // NULL si le temporisateur n'est pas arme.
+    struct timer* prev;
+    uint64_t expires;         // Echeance (ms).
+    void (*callback)(void*);
+    void* arg;
+};
+
+// Chaque case est une liste circulaire dont la tete est une sentinelle.
+static struct timer wheel[WHEEL_LEVELS][WHEEL_SIZE];
+
+// Prochaine milliseconde a traiter.
+static uint64_t current = 0;
+static short initialized = 0;
+
+static unsigned long armed = 0;
+static unsigned long fired = 0;
+
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/*******************/
+/*       Lock      */
+/*******************/
+
+static void lock(const char* func_name) {
+    if( pthread_mutex_lock(&mutex) != 0 ) {
+        perror(func_name);
+        exit(EXIT_FAILURE);
+    }
+}
+
+static void unlock(const char* func_name) {
+    if( pthread_mutex_unlock(&mutex) != 0 ) {
+        perror(func_name);
+        exit(EXIT_FAILURE);
+    }
+}
+
+/*******************/
+/*     Horloge     */
+/*******************/
+
+uint64_t timer_now() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+/*******************/
+/*      Listes     */
+/*******************/
+
+static void init_list(struct timer* head) {
+    head->next = head;
+    head->prev = head;
+}
+
+static short is_empty(struct timer* head) {
+    return head->next == head;
+}
+
+static void link_timer(struct timer* head, struct timer* t) {
+    t->prev = head->prev;
+    t->next = head;
+    head->prev->next = t;
+    head->prev = t;
+}
+
+static void unlink_timer(struct timer* t) {
+    t->prev->next = t->next;
+    t->next->prev = t->prev;
+    t->next = NULL;
+    t->prev = NULL;
+}
+
+// Deplace tous les temporisateurs de 'from' vers 'to' (vide).
+static void move_list(struct timer* from, struct timer* to) {
+    init_list(to);
+    if( is_empty(from) )
+        return;
+
+    to->next = from->next;
+    to->prev = from->prev;
+    to->next->prev = to;
+    to->prev->next = to;
+    init_list(from);
+}
+
+/*******************/
+/*       Roue      */
+/*******************/
+
+// Verrou pris.
+static void init_wheel() {
+    if(initialized)
+        return;
+
+    for(int l = 0; l < WHEEL_LEVELS; l++)
+        for(int i = 0; i < WHEEL_SIZE; i++)
+            init_list(&wheel[l][i]);
+
+    current = timer_now();
+    initialized = 1;
+}
+
+// Range t dans la case correspondant a son echeance. Verrou pris.
+static void insert(struct timer* t) {
+    if(t->expires < current)
+        t->expires = current;
+
+    uint64_t delta = t->expires - current;
+    if(delta > WHEEL_SPAN) {
+        delta = WHEEL_SPAN;
+        t->expires = current + delta;
+    }
+
+    int level = 0;
+    while( level < WHEEL_LEVELS-1 && delta >= (1ULL << (WHEEL_BITS * (level+1))) )
+        level++;
+
+    int slot = (t->expires >> (WHEEL_BITS * level)) & WHEEL_MASK;
+    link_timer(&wheel[level][slot], t);
+}
+
+// Redistribue la case courante du niveau 'level' dans les niveaux inferieurs.
+// Verrou pris.
+static void cascade(int level) {
+    int slot = (current >> (WHEEL_BITS * level)) & WHEEL_MASK;
+    struct timer list;
+    move_list(&wheel[level][slot], &list);
+
+    while( !is_empty(&list) ) {
+        struct timer* t = list.next;
+        unlink_timer(t);
+        insert(t);
+    }
+}
+
+/*******************/
+/*  Constructeur   */
+/*******************/
+
+struct timer* create_timer(void (*callback)(void*), void* arg) {
+    struct timer* t = malloc(sizeof(struct timer));
+    if(t == NULL) {
+        fprintf(stderr, "malloc() failed.");
+        exit(1);
+    }
+
+    t->next = NULL;
+    t->prev = NULL;
+    t->expires = 0;
+    t->callback = callback;
+    t->arg = arg;
+    return t;
+}
+
+/*******************/
+/*   Destructeur   */
+/*******************/
+
+void destroy_timer(struct timer* t) {
+    if(t == NULL)
+        return;
+
+    cancel_timer(t);
+    free(t);
+}
+
+/*******************/
+/*   Armement      */
+/*******************/
+
+void schedule_timer(struct timer* t, long delay) {
+    lock("schedule_timer");
+    init_wheel();
+
+    if(t->next != NULL)
+        unlink_timer(t);
+    else
+        armed++;
+
+    t->expires = timer_now() + (delay > 0 ? delay : 0);
+    insert(t);
+
+    unlock("schedule_timer");
+}
+
+void cancel_timer(struct timer* t) {
+    lock("cancel_timer");
+    if(t->next != NULL) {
+        unlink_timer(t);
+        armed--;
+    }
+    unlock("cancel_timer");
+}
+
+short timer_pending(struct timer* t) {
+    lock("timer_pending");
+    short res = t->next != NULL;
+    unlock("timer_pending");
+    return res;
+}
+
+/*******************/
+/*    Execution    */
+/*******************/
+
+int next_timer_delay() {
+    lock("next_timer_delay");
+    init_wheel();
+
+    uint64_t now = timer_now();
+    if(armed == 0 || current <= now) {
+        unlock("next_timer_delay");
+        return armed == 0 ? TIMER_MAX_WAIT : 0;
+    }
+
+    // current vaut au plus now+1: on cherche la premiere case non vide, ou
+    // la premiere cascade qui ramenera des temporisateurs.
+    int delay = 0;
+    for(uint64_t tick = current; delay < TIMER_MAX_WAIT; tick++, delay++) {
+        if( tick - current < WHEEL_SIZE && !is_empty(&wheel[0][tick & WHEEL_MASK]) )
+            break;
+
+        short found = 0;
+        for(int l = 1; l < WHEEL_LEVELS && (tick >> (WHEEL_BITS * (l-1)) & WHEEL_MASK) == 0; l++)
+            if( !is_empty(&wheel[l][(tick >> (WHEEL_BITS * l)) & WHEEL_MASK]) ) {
+                found = 1;
+                break;
+            }
+        if(found)
+            break;
+    }
+
+    unlock("next_timer_delay");
+    return delay + (int)(current - now);
+}
+
+void run_timers() {
+    lock("run_timers");
+    init_wheel();
+
+    uint64_t now = timer_now();
+
+    // Rien d'arme: inutile de parcourir les millisecondes ecoulees.
+    if(armed == 0 && current <= now)
+        current = now + 1;
+
+    while(current <= now) {
+        int slot = current & WHEEL_MASK;
+        for(int l = 1; l < WHEEL_LEVELS && (current >> (WHEEL_BITS * (l-1)) & WHEEL_MASK) == 0; l++)
+            cascade(l);
+
+        struct timer expired;
+        move_list(&wheel[0][slot], &expired);
+        current++;
+
+        // Les rappels peuvent armer ou annuler des temporisateurs (y compris
+        // ceux de 'expired'): on les execute un par un, verrou relache.
+        while( !is_empty(&expired) ) {
+            struct timer* t = expired.next;
+            unlink_timer(t);
+            armed--;
+            fired++;
+
+            unlock("run_timers");
+            if(debug)
+                printn("Temporisateur %p déclenché.", (void*)t);
+            t->callback(t->arg);
+            lock("run_timers");
+        }
+    }
+
+    unlock("run_timers");
+}
+
+/*******************/
+/*   Statistiques  */
+/*******************/
+
+void print_timer_stats() {
+    lock("print_timer_stats");
+    unsigned long a = armed, f = fired;
+    unlock("print_timer_stats");
+
+    printn("Temporisateurs: %lu armés, %lu déclenchés.", a, f);
+}
@@ -0,0 +1,64 @@
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include <stdint.h>
+
+/*
+ * Roue de temporisateurs hierarchique (resolution: la milliseconde).
+ * 4 niveaux de 256 cases couvrent 2^32 ms (~49 jours); armer, rearmer et
+ * annuler un temporisateur coute O(1). Les rappels sont executes par
+ * run_timers(), appelee depuis la boucle principale (et seulement elle).
+ */
+
+struct timer;
+
+// Delai maximal d'attente rendu par next_timer_delay() (en ms).
+#define TIMER_MAX_WAIT 1000
+
+/*
+ * Cree un temporisateur (desarme) qui appellera callback(arg).
+ */
+struct timer* create_timer(void (*callback)(void*), void* arg);
+
+/*
+ * Desarme et libere t.
+ */
+void destroy_timer(struct timer* t);
+
+/*
+ * Arme t pour dans 'delay' ms (le rearme s'il l'etait deja).
+ */
+void schedule_timer(struct timer* t, long delay);
+
+/*
+ * Desarme t (sans effet s'il ne l'etait pas).
+ */
+void cancel_timer(struct timer* t);
+
+/*
+ * Renvoie 1 si t est arme et 0 sinon.
+ */
+short timer_pending(struct timer* t);
+
+/*
+ * Renvoie l'heure courante de la roue (ms, horloge monotone).
+ */
+uint64_t timer_now();
+
+/*
+ * Renvoie le nombre de ms avant la prochaine echeance possible (borne par
+ * TIMER_MAX_WAIT), a utiliser comme delai d'attente de la boucle principale.
+ */
+int next_timer_delay();
+
+/*
+ * Execute les rappels de tous les temporisateurs echus.
+ */
+void run_timers();
+
+/*
+ * Affiche le nombre de temporisateurs armes et declenches.
+ */
+void print_timer_stats();
+
+#endif /* TIMER_WHEEL_H */
@@ -6,6 +6,11 @@
 #include "neighbourManager.h"
 #include "dataManager.h"
 #include "inputReader.h"
+#include "plumtree.h"
+#include "mpr.h"
+#include "history.h"
+#include "catchup.h"
+#include "reconcile.h"
 
 #include <malloc.h>
 #include <stdlib.h>
@@ -18,6 +23,7 @@ struct tlv {
     uint8_t type;
     uint8_t body_length;
     uint8_t* body;
+    struct payload* payload;    // Tlv data: contenu, qui suit le body.
 };
 
 /****************************/
@@ -34,6 +40,7 @@ struct tlv* create_tlv(uint8_t type, int length) {
     t->body_length = length;
     t->body = malloc(length);
     memset(t->body, 0, length);
+    t->payload = NULL;
     return t;
 }
 
@@ -71,12 +78,22 @@ struct tlv* create_neighbour_tlv(uint128_t ip, uint16_t port) {
     return neighbour;
 }
 
-struct tlv* create_data_tlv(uint64_t sender_id, uint32_t nonce, uint8_t type, uint8_t* data, size_t data_len) {
-    struct tlv* data_tlv = create_tlv(4, data_len + 13);
+struct tlv* create_data_payload_tlv(uint64_t sender_id, uint32_t nonce, uint8_t type, struct payload* p) {
+    // Le body ne contient que l'entete: le contenu est partage.
+    struct tlv* data_tlv = create_tlv(4, 13);
     ((uint64_t*)data_tlv->body)[0] = sender_id;
     ((uint32_t*)data_tlv->body)[2] = nonce;
     data_tlv->body[12] = type;
-    memcpy(data_tlv->body+13, data, data_len);
+    data_tlv->payload = hold_payload(p);
+    data_tlv->body_length += payload_length(p);
+
+    return data_tlv;
+}
+
+struct tlv* create_data_tlv(uint64_t sender_id, uint32_t nonce, uint8_t type, uint8_t* data, size_t data_len) {
+    struct payload* p = create_payload(data, data_len);
+    struct tlv* data_tlv = create_data_payload_tlv(sender_id, nonce, type, p);
+    release_payload(p);
 
     return data_tlv;
 }
@@ -105,12 +122,65 @@ struct tlv* create_warning_tlv(uint8_t* message, size_t message_len) {
 }
 
 
+struct tlv* create_id_list_tlv(uint8_t type, uint64_t ids[], uint32_t nonces[], int count) {
+    assert(count <= MAX_IHAVE);
+    struct tlv* list = create_tlv(type, count * 12);
+    for(int i = 0; i < count; i++) {
+        memcpy(list->body + i*12, &ids[i], 8);
+        memcpy(list->body + i*12 + 8, &nonces[i], 4);
+    }
+
+    return list;
+}
+
+struct tlv* create_ihave_tlv(uint64_t ids[], uint32_t nonces[], int count) {
+    return create_id_list_tlv(8, ids, nonces, count);
+}
+
+struct tlv* create_graft_tlv(uint64_t sender_id, uint32_t nonce) {
+    struct tlv* graft = create_tlv(9, 12);
+    ((uint64_t*)graft->body)[0] = sender_id;
+    ((uint32_t*)graft->body)[2] = nonce;
+
+    return graft;
+}
+
+struct tlv* create_prune_tlv() {
+    return create_tlv(10, 0);
+}
+
+struct tlv* create_relay_tlv(uint8_t relay) {
+    struct tlv* t = create_tlv(11, 1);
+    t->body[0] = relay;
+
+    return t;
+}
+
+struct tlv* create_sketch_tlv(uint8_t first, const uint8_t* cells, int count) {
+    assert(count <= MAX_SKETCH_CELLS);
+    struct tlv* sketch = create_tlv(14, 1 + count * SKETCH_CELL_SIZE);
+    sketch->body[0] = first;
+    memcpy(sketch->body + 1, cells, count * SKETCH_CELL_SIZE);
+
+    return sketch;
+}
+
+struct tlv* create_echo_tlv(uint8_t reply, uint32_t stamp, uint16_t hold) {
+    struct tlv* echo = create_tlv(15, 7);
+    echo->body[0] = reply;
+    memcpy(echo->body + 1, &stamp, 4);
+    memcpy(echo->body + 5, &hold, 2);
+
+    return echo;
+}
+
 /****************************/
 /*        Destructors       */
 /****************************/
 
 void destroy_tlv(struct tlv* t) {
     if(t != NULL) {
+        release_payload(t->payload);
         free(t->body);
         free(t);
     }
@@ -120,13 +190,17 @@ void destroy_tlv(struct tlv* t) {
 /*     Getters     */
 /*******************/
 
-uint8_t get_tlv_length(struct tlv* tlv) {
+int get_tlv_length(struct tlv* tlv) {
     return tlv->body_length + 2;
 }
 
+uint8_t get_tlv_type(struct tlv* tlv) {
+    return tlv->type;
+}
+
 uint64_t get_source_id(struct tlv* tlv) {
-    // Si c'est un TLV Data, Ack, Hello court ou long ...
-    if (tlv->type == 2 || tlv->type == 4 || tlv->type == 5)
+    // Si c'est un TLV Data, Ack, Hello court ou long, Graft ...
+    if (tlv->type == 2 || tlv->type == 4 || tlv->type == 5 || tlv->type == 9)
         return ((uint64_t*)tlv->body)[0];
 
     return -1;
@@ -157,13 +231,53 @@ uint64_t get_destination_id(struct tlv* tlv) {
 }
 
 uint32_t get_nonce(struct tlv* tlv) {
-    // Si c'est un TLV Data ou Ack ...
-    if (tlv->type == 4 || tlv->type == 5)
+    // Si c'est un TLV Data, Ack ou Graft ...
+    if (tlv->type == 4 || tlv->type == 5 || tlv->type == 9)
         return ((uint32_t*)tlv->body)[2];
 
     return -1;
 }
 
+int get_id_list_count(struct tlv* tlv) {
+    // Si c'est un TLV IHave, Summary ou Request ...
+    if (tlv->type == 8 || tlv->type == 12 || tlv->type == 13)
+        return tlv->body_length / 12;
+
+    return 0;
+}
+
+void get_id_list_item(struct tlv* tlv, int i, uint64_t* id, uint32_t* nonce) {
+    memcpy(id, tlv->body + i*12, 8);
+    memcpy(nonce, tlv->body + i*12 + 8, 4);
+}
+
+int get_sketch_cells(struct tlv* tlv, uint8_t* first, const uint8_t** cells) {
+    // Si c'est un TLV Sketch ...
+    if (tlv->type != 14 || tlv->body_length < 1)
+        return 0;
+
+    *first = tlv->body[0];
+    *cells = tlv->body + 1;
+    return (tlv->body_length - 1) / SKETCH_CELL_SIZE;
+}
+
+short get_relay(struct tlv* tlv) {
+    return tlv->type == 11 && tlv->body_length > 0 && tlv->body[0] != 0;
+}
+
+short get_echo(struct tlv* tlv, uint8_t* reply, uint32_t* stamp, uint16_t* hold) {
+    if(tlv->type != 15 || tlv->body_length < 7)
+        return 0;
+
+    *reply = tlv->body[0];
+    memcpy(stamp, tlv->body + 1, 4);
+    memcpy(hold, tlv->body + 5, 2);
+    return 1;
+}
+
+uint8_t get_go_away_code(struct tlv* tlv) {
+    return tlv->type == 6 && tlv->body_length > 0 ? tlv->body[0] : 0;
+}
 
 uint8_t get_data_type(struct tlv* tlv) {
     // Si c'est un TLV Data ...
@@ -173,16 +287,24 @@ uint8_t get_data_type(struct tlv* tlv) {
     return -1;
 }
 
-short get_data(struct tlv* tlv, uint8_t** buffer, size_t* length) {
+short get_data(struct tlv* tlv, const uint8_t** buffer, size_t* length) {
     // Si c'est un TLV Data ...
     if (tlv->type != 4)
         return -1;
 
-    *buffer = tlv->body+13;
-    *length = tlv->body_length - 13;
+    *buffer = payload_data(tlv->payload);
+    *length = payload_length(tlv->payload);
     return 0;
 }
 
+struct payload* get_data_payload(struct tlv* tlv) {
+    // Si c'est un TLV Data ...
+    if (tlv->type != 4)
+        return NULL;
+
+    return tlv->payload;
+}
+
 static short print_warning(struct tlv* t) {
     if( t->type != 7)
         return -1;
@@ -203,11 +325,16 @@ void interpret_tlv( struct tlv* t, uint128_t ip, uint16_t port) {
     struct neighbour* n;
     struct sockaddr_in6 sin6;
 
-    uint8_t* buff;
+    const uint8_t* buff;
     size_t len;
 
     struct msg* m;
     struct received_data* rd;
+    short long_hello;
+
+    uint8_t echo_reply;
+    uint32_t echo_stamp;
+    uint16_t echo_hold;
 
     switch(t->type) {
     case PAD1:
@@ -235,17 +362,29 @@ void interpret_tlv( struct tlv* t, uint128_t ip, uint16_t port) {
         if( !add_neighbour(n) ) {
             destroy_neighbour(n);
             n = get_neighbour(ip, port);
+
+            // Liste de voisins pleine de meilleurs voisins.
+            if(n == NULL)
+                break;
         }else{
             remove_from_potentials(n);
+
+            // Nouveau voisin: on repond tout de suite par un hello long
+            // pour devenir symetriques en un aller-retour.
+            m = create_msg();
+            add_hello_long_tlv(m, get_my_id(), get_source_id(t));
+            get_sockaddr6(n, &sin6);
+            send_msg(m, (struct sockaddr*)&sin6, sizeof(sin6));
+            destroy_msg(m);
+            m = NULL;
         }
 
         assert(n != NULL);
 
-        update_hello_date(n);
-        if(t->body_length == 16 && get_destination_id(t) == get_my_id())
-            update_longHello_date(n);
+        long_hello = t->body_length == 16 && get_destination_id(t) == get_my_id();
+        hello_received(n, long_hello);
 
-        else if(t->body_length == 16 && debug)
+        if(t->body_length == 16 && !long_hello && debug)
             fprintn(stderr, "Message rejeté, hello long avec un mauvais id-destination.(reçu: %lx, mon id: %lx)",(unsigned long)get_destination_id(t),(unsigned long)get_my_id());
 
         break;
@@ -255,10 +394,10 @@ void interpret_tlv( struct tlv* t, uint128_t ip, uint16_t port) {
         if(debug)
             printn("Neighbour reçu.");
 
+        add_two_hop(ip, port, get_neighbour_ip(t), get_neighbour_port(t));
+
         n = create_neighbour(get_neighbour_ip(t), get_neighbour_port(t), get_source_id(t));
-        if( !is_neighbour(n) ) {
-            add_potential_neighbour(n);
-        }else {
+        if( is_neighbour(n) || !add_potential_neighbour(n) ) {
             destroy_neighbour(n);
             n = NULL;
         }
@@ -269,30 +408,28 @@ void interpret_tlv( struct tlv* t, uint128_t ip, uint16_t port) {
             printn("Data reçu.");
 
         get_data(t, &buff, &len);
-        rd = create_received_data( get_source_id(t), get_nonce(t), get_data_type(t), buff, len);
+        rd = create_received_data( get_source_id(t), get_nonce(t), get_data_type(t), get_data_payload(t) );
+
+        n = get_neighbour(ip, port);
 
         // Si on ne l'avait pas
         if( add_received_data(rd) ) {
-            if(get_data_type(t) == 0)
-                printn("%s", buff);
-            init_symeterics(rd);
+            history_append(get_source_id(t), get_nonce(t), get_data_type(t), get_data_payload(t));
+            set_received_from(rd, n);
+            deliver_data(get_source_id(t), get_data_type(t), buff, len);
+            init_symeterics(rd, n);
             inondation(rd);
+            plumtree_on_data(rd, n, 1);
+            plumtree_announce(rd, n);
         } else {
             destroy_received_data(rd);
             rd = get_received_data(get_source_id(t), get_nonce(t));
+            plumtree_on_data(rd, n, 0);
         }
 
-        n = get_neighbour(ip, port);
-
-        received(rd, n);
-
         if( n != NULL ) {
-            m = create_msg();
-            add_ack_tlv(m, get_source_id(t), get_nonce(t));
-            get_sockaddr6(n, &sin6);
-            send_msg(m, (struct sockaddr*)&sin6, sizeof(sin6));
-            destroy_msg(m);
-            m = NULL;
+            received(rd, n);
+            send_ack(n, get_source_id(t), get_nonce(t));
         }
 
         break;
@@ -314,10 +451,16 @@ void interpret_tlv( struct tlv* t, uint128_t ip, uint16_t port) {
         if(debug)
             printn("GoAway reçu.");
 
+        // Il ne veut plus rien de nous: on cesse tout de suite de lui
+        // envoyer nos donnees.
+        forget_floods_to(ip, port);
+
         n = get_neighbour(ip, port);
         if( n != NULL ) {
-            remove_from_neighbours(n);
-            add_potential_neighbour(n);
+            // Un pair qui s'en va n'a rien fait de mal.
+            if( get_go_away_code(t) != GO_AWAY_LEAVING )
+                count_go_away(n);
+            demote_neighbour(n);
         }
         break;
 
@@ -328,6 +471,77 @@ void interpret_tlv( struct tlv* t, uint128_t ip, uint16_t port) {
 
         print_warning(t);
         break;
+
+    case IHAVE:
+
+        if(debug)
+            printn("IHave reçu.");
+
+        plumtree_on_ihave(t, get_neighbour(ip, port));
+        break;
+
+    case GRAFT:
+
+        if(debug)
+            printn("Graft reçu.");
+
+        plumtree_on_graft(get_source_id(t), get_nonce(t), get_neighbour(ip, port));
+        break;
+
+    case PRUNE:
+
+        if(debug)
+            printn("Prune reçu.");
+
+        plumtree_on_prune(get_neighbour(ip, port));
+        break;
+
+    case RELAY:
+
+        if(debug)
+            printn("Relay reçu.");
+
+        n = get_neighbour(ip, port);
+        if(n != NULL)
+            set_relay_selector(n, get_relay(t));
+        break;
+
+    case SUMMARY:
+
+        if(debug)
+            printn("Summary reçu.");
+
+        catchup_on_summary(t, get_neighbour(ip, port));
+        break;
+
+    case REQUEST:
+
+        if(debug)
+            printn("Request reçu.");
+
+        catchup_on_request(t, get_neighbour(ip, port));
+        break;
+
+    case SKETCH:
+
+        if(debug)
+            printn("Sketch reçu.");
+
+        reconcile_on_sketch(t, get_neighbour(ip, port));
+        break;
+
+    case ECHO:
+
+        if(debug)
+            printn("Echo reçu.");
+
+        if( get_echo(t, &echo_reply, &echo_stamp, &echo_hold) ) {
+            if(echo_reply)
+                echo_received(ip, port, echo_stamp, echo_hold);
+            else
+                send_echo_reply(ip, port, echo_stamp);
+        }
+        break;
     }
 }
 
@@ -339,5 +553,12 @@ void interpret_tlv( struct tlv* t, uint128_t ip, uint16_t port) {
 void tlv_to_data(struct tlv* t, uint8_t buffer[]) {
     buffer[0] = t->type;
     buffer[1] = t->body_length;
-    memcpy(buffer+2, t->body, t->body_length);
+    if(t->payload == NULL) {
+        memcpy(buffer+2, t->body, t->body_length);
+        return;
+    }
+
+    size_t len = payload_length(t->payload);
+    memcpy(buffer+2, t->body, t->body_length - len);
+    memcpy(buffer+2 + t->body_length - len, payload_data(t->payload), len);
 }
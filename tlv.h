@@ -1,13 +1,26 @@
 #ifndef TLV_H
 #define TLV_H
 
+#include "payload.h"
+
 #include <stdint.h>
 #include <sys/socket.h>
 
 /*
  * Enumeration listant les tlvs.
  */
-enum tlv_type {PAD1, PADN, HELLO, NEIGHBOUR, DATA, ACK, GO_AWAY, WARNING};
+enum tlv_type {PAD1, PADN, HELLO, NEIGHBOUR, DATA, ACK, GO_AWAY, WARNING,
+               IHAVE, GRAFT, PRUNE, RELAY, SUMMARY, REQUEST, SKETCH, ECHO};
+
+// Code d'un GoAway envoye par un pair qui quitte le reseau.
+#define GO_AWAY_LEAVING 1
+
+// Nombre maximum d'identifiants (id,nonce) dans un tlv IHave, Summary ou Request.
+#define MAX_IHAVE 21
+
+// Taille d'une case d'esquisse et nombre maximum de cases dans un tlv Sketch.
+#define SKETCH_CELL_SIZE 18
+#define MAX_SKETCH_CELLS 13
 
 typedef unsigned __int128 uint128_t;
 
@@ -47,6 +60,11 @@ struct tlv* create_neighbour_tlv(uint128_t ip, uint16_t port);
  */
 struct tlv* create_data_tlv(uint64_t sender_id, uint32_t nonce, uint8_t type, uint8_t* data, size_t data_len);
 
+/*
+ * Creee un tlv data dont le contenu est p (partage, sans copie).
+ */
+struct tlv* create_data_payload_tlv(uint64_t sender_id, uint32_t nonce, uint8_t type, struct payload* p);
+
 /*
  * Creee un tlv ack l'id source et le nonce du message.
  */
@@ -62,6 +80,47 @@ struct tlv* create_goAway_tlv(uint8_t code, uint8_t* message, size_t message_len
  */
 struct tlv* create_warning_tlv(uint8_t* message, size_t message_len);
 
+/*
+ * Creee un tlv IHave annoncant les donnees (ids[i],nonces[i]) pour i < count.
+ * (count au plus MAX_IHAVE)
+ */
+struct tlv* create_ihave_tlv(uint64_t ids[], uint32_t nonces[], int count);
+
+/*
+ * Creee un tlv de type 'type' (IHave, Summary ou Request) contenant les
+ * identifiants (ids[i],nonces[i]) pour i < count. (count au plus MAX_IHAVE)
+ */
+struct tlv* create_id_list_tlv(uint8_t type, uint64_t ids[], uint32_t nonces[], int count);
+
+/*
+ * Creee un tlv Graft demandant la donnee (sender_id,nonce).
+ */
+struct tlv* create_graft_tlv(uint64_t sender_id, uint32_t nonce);
+
+/*
+ * Creee un tlv Prune.
+ */
+struct tlv* create_prune_tlv();
+
+/*
+ * Creee un tlv Relay indiquant au destinataire s'il est (1) ou non (0)
+ * un de nos relais multipoints.
+ */
+struct tlv* create_relay_tlv(uint8_t relay);
+
+/*
+ * Creee un tlv Sketch contenant les cases first a first+count-1 (count au
+ * plus MAX_SKETCH_CELLS) d'une esquisse, deja codees dans 'cells'.
+ */
+struct tlv* create_sketch_tlv(uint8_t first, const uint8_t* cells, int count);
+
+/*
+ * Creee un tlv Echo: une demande (reply a 0) portant la date 'stamp' de
+ * l'emetteur, ou la reponse (reply a 1) qui renvoie cette date avec le
+ * temps 'hold' (ms) pendant lequel elle a ete retenue avant de partir.
+ */
+struct tlv* create_echo_tlv(uint8_t reply, uint32_t stamp, uint16_t hold);
+
 /****************************/
 /*        Destructors       */
 /****************************/
@@ -76,9 +135,14 @@ void destroy_tlv(struct tlv* t);
 /*******************/
 
 /*
- * Renvoie la longueur du body du tlv 'tlv'.
+ * Renvoie la longueur totale (entete comprise) du tlv 'tlv'.
  */
-uint8_t get_tlv_length(struct tlv* tlv);
+int get_tlv_length(struct tlv* tlv);
+
+/*
+ * Renvoie le type du tlv 'tlv' (cf. enum tlv_type).
+ */
+uint8_t get_tlv_type(struct tlv* tlv);
 
 /*
  * Renvoie l'id source du tlv 'tlv' si il est d'un type qui en contient un, et -1 sinon.
@@ -95,6 +159,41 @@ uint64_t get_destination_id(struct tlv* tlv);
  */
 uint32_t get_nonce(struct tlv* tlv);
 
+/*
+ * Renvoie le nombre d'identifiants du tlv 'tlv' si il est de type IHave,
+ * Summary ou Request, et 0 sinon.
+ */
+int get_id_list_count(struct tlv* tlv);
+
+/*
+ * Stocke dans *id et *nonce le i-eme identifiant du tlv IHave, Summary ou
+ * Request 'tlv'.
+ */
+void get_id_list_item(struct tlv* tlv, int i, uint64_t* id, uint32_t* nonce);
+
+/*
+ * Si tlv est de type Sketch, stocke l'indice de sa premiere case dans *first
+ * et ses cases codees dans *cells, et renvoie leur nombre. Sinon renvoie 0.
+ */
+int get_sketch_cells(struct tlv* tlv, uint8_t* first, const uint8_t** cells);
+
+/*
+ * Renvoie 1 si le tlv Relay 'tlv' designe son destinataire comme relais et 0 sinon.
+ */
+short get_relay(struct tlv* tlv);
+
+/*
+ * Si 'tlv' est un tlv Echo, stocke son sens (1 pour une reponse), sa date
+ * et son temps de retenue dans *reply, *stamp et *hold et renvoie 1.
+ * Sinon renvoie 0.
+ */
+short get_echo(struct tlv* tlv, uint8_t* reply, uint32_t* stamp, uint16_t* hold);
+
+/*
+ * Renvoie le code du tlv GoAway 'tlv' (0 si il n'en a pas).
+ */
+uint8_t get_go_away_code(struct tlv* tlv);
+
 /*
  * Renvoie le type de donnee du tlv 'tlv' si il est de type data, et -1 sinon.
  */
@@ -104,7 +203,12 @@ uint8_t get_data_type(struct tlv* tlv);
  * Si tlv est de type data, stocke sont body dans *buffer et sa longueur dans *length et renvoie 0.
  * Sinon renvoie -1;
  */
-short get_data(struct tlv* tlv, uint8_t** buffer, size_t* length);
+short get_data(struct tlv* tlv, const uint8_t** buffer, size_t* length);
+
+/*
+ * Renvoie le contenu (partage) du tlv 'tlv' si il est de type data, et NULL sinon.
+ */
+struct payload* get_data_payload(struct tlv* tlv);
 
 /********************/
 /*  Interpretation  */